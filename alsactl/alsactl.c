@@ -50,6 +50,7 @@ int force_restore = 1;
 int ignore_nocards = 0;
 int do_lock = 0;
 int use_syslog = 0;
+int use_cache = 0;
 char *command;
 char *statefile = NULL;
 char *lockpath = SYS_LOCKPATH;
@@ -92,8 +93,12 @@ static struct arg args[] = {
 { FILEARG | 'r', "runstate", "save restore and init state to this file (only errors)" },
 { 0, NULL, "  default settings is 'no file set'" },
 { 'R', "remove", "remove runstate file at first, otherwise append errors" },
+{ 'k', "cache", "store and restore through a binary cache of the state file" },
 { INTARG | 'p', "period", "store period in seconds for the daemon command" },
 { FILEARG | 'e', "pid-file", "pathname for the process id (daemon mode)" },
+{ HEADER, NULL, "Available monitor options:" },
+{ INTARG | 'C', "coalesce", "merge the events of one control within this period in ms" },
+{ FILEARG | 'o', "format", "event output format: text, json or binary" },
 { HEADER, NULL, "Available init options:" },
 { ENVARG | 'E', "env", "set environment variable for init phase (NAME=VALUE)" },
 { FILEARG | 'i', "initfile", "main configuation file for init phase" },
@@ -254,6 +259,8 @@ int main(int argc, char *argv[])
 	int use_nice = NO_NICE;
 	int sched_idle = 0;
 	int initflags = 0;
+	int coalesce = 0;
+	char *format = NULL;
 	struct arg *a;
 	struct option *o;
 	int i, j, k, res;
@@ -350,6 +357,9 @@ int main(int argc, char *argv[])
 		case 'R':
 			removestate = 1;
 			break;
+		case 'k':
+			use_cache = 1;
+			break;
 		case 'P':
 			force_restore = 0;
 			break;
@@ -363,6 +373,14 @@ int main(int argc, char *argv[])
 		case 'e':
 			pidfile = optarg;
 			break;
+		case 'C':
+			coalesce = atoi(optarg);
+			if (coalesce < 0)
+				coalesce = 0;
+			break;
+		case 'o':
+			format = optarg;
+			break;
 		case 'b':
 			background = 1;
 			break;
@@ -466,7 +484,7 @@ int main(int argc, char *argv[])
 	} else if (!strcmp(cmd, "kill")) {
 		res = state_daemon_kill(pidfile, cardname);
 	} else if (!strcmp(cmd, "monitor")) {
-		res = monitor(cardname);
+		res = monitor(cardname, coalesce, format);
 	} else if (!strcmp(cmd, "info")) {
 		res = general_info(cardname);
 	} else if (!strcmp(cmd, "clean")) {
@@ -481,6 +499,7 @@ int main(int argc, char *argv[])
 	}
 
 	snd_config_update_free_global();
+	init_rules_free();
 	if (use_syslog) {
 		if (daemoncmd)
 			syslog(LOG_INFO, "alsactl daemon stopped");
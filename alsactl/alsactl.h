@@ -8,6 +8,7 @@ extern int force_restore;
 extern int ignore_nocards;
 extern int do_lock;
 extern int use_syslog;
+extern int use_cache;
 extern char *command;
 extern char *statefile;
 extern char *lockpath;
@@ -51,17 +52,39 @@ int snd_card_iterator_error(struct snd_card_iterator *iter);
 
 int load_configuration(const char *file, snd_config_t **top, int *open_failed);
 int init(const char *cfgdir, const char *file, int flags, const char *cardname);
+int init_rules_prepare(const char *filename);
+int init_rules_load(const char *cfgdir);
+int init_rules_save(const char *cfgdir);
+void init_rules_free(void);
 int init_ucm(int flags, int cardno);
 int state_lock(const char *file, int timeout);
 int state_unlock(int lock_fd, const char *file);
 int card_lock(int card_number, int timeout);
 int card_unlock(int lock_fd, int card_number);
 int save_state(const char *file, const char *cardname);
+int state_tree_load(const char *file, snd_config_t **top);
+int state_tree_save(const char *file, snd_config_t *top);
+int state_tree_store_card(snd_config_t *top, int cardno);
+int state_tree_store_control(snd_config_t *top, const char *cardid,
+			     snd_ctl_t *handle, snd_ctl_elem_id_t *id);
+
+struct state_cache;
+struct cache_values;
+int state_cache_store(const char *file, const char *cardname,
+		      snd_config_t *top);
+int state_cache_add(struct cache_values *values, unsigned int numid,
+		    snd_ctl_elem_type_t type, unsigned int count,
+		    snd_ctl_elem_value_t *ctl);
+int state_cache_controls(snd_ctl_t *handle, const char *cardid,
+			 snd_config_t *top, struct cache_values *values);
+int state_cache_load(const char *file, struct state_cache **cache);
+void state_cache_free(struct state_cache *cache);
+int state_cache_restore(struct state_cache *cache, int cardno);
 int load_state(const char *cfgdir, const char *file,
 	       const char *initfile, int initflags,
 	       const char *cardname, int do_init);
 int power(const char *argv[], int argc);
-int monitor(const char *name);
+int monitor(const char *name, int coalesce, const char *format);
 int general_info(const char *name);
 int state_daemon(const char *file, const char *cardname, int period,
 		 const char *pidfile);
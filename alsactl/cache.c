@@ -0,0 +1,675 @@
+/*
+ *  Advanced Linux Sound Architecture Control Program - binary state cache
+ *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * The cache holds the raw values of the writable controls, indexed by
+ * numid, next to the text state file. It is translated by store from
+ * the tree the text file was written from, and it is valid only for the
+ * text file of the same mtime and size. A card is
+ * restored from it only when its driver, its control list and the
+ * type, range and dB scale of every control hash as at store time,
+ * otherwise the text file is used.
+ */
+
+#include "aconfig.h"
+#include "version.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "alsactl.h"
+
+#define CACHE_MAGIC	"ALSCACHE"
+#define CACHE_VERSION	2
+#define CACHE_SUFFIX	".cache"
+
+struct cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t cards;
+	int64_t mtime_sec;		/* of the text state file */
+	int64_t mtime_nsec;
+	int64_t size;
+};
+
+struct cache_card {
+	char id[32];
+	uint64_t hash;			/* driver and controls */
+	uint32_t controls;
+	uint32_t size;			/* bytes of the controls */
+};
+
+struct cache_control {
+	uint32_t numid;
+	uint32_t type;
+	uint32_t count;
+	uint32_t size;			/* bytes of the values, 8 aligned */
+};
+
+/* the controls of one card while the cache is stored */
+struct cache_values {
+	char *data;
+	size_t size;
+	size_t alloc;
+	unsigned int controls;
+};
+
+struct state_cache {
+	char *buf;
+	size_t size;
+	unsigned int cards;
+	struct cache_card **card;
+};
+
+static char *cache_name(const char *file)
+{
+	char *name;
+
+	name = malloc(strlen(file) + sizeof(CACHE_SUFFIX));
+	if (name == NULL)
+		return NULL;
+	strcpy(name, file);
+	strcat(name, CACHE_SUFFIX);
+	return name;
+}
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *p = data;
+
+	/* FNV-1a */
+	while (size-- > 0) {
+		hash ^= *p++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static uint64_t hash_string(uint64_t hash, const char *s)
+{
+	return hash_bytes(hash, s, strlen(s) + 1);
+}
+
+static uint64_t hash_uint(uint64_t hash, unsigned int val)
+{
+	uint32_t v = val;
+
+	return hash_bytes(hash, &v, sizeof(v));
+}
+
+/* hash of the type, range and dB scale of one control */
+static uint64_t elem_hash(snd_ctl_t *handle, snd_ctl_elem_id_t *id,
+			  snd_ctl_elem_info_t *info, uint64_t h)
+{
+	unsigned int tlv[64];
+	long long min64, max64, step64;
+
+	snd_ctl_elem_info_set_id(info, id);
+	if (snd_ctl_elem_info(handle, info) < 0)
+		return hash_uint(h, ~0U);
+	h = hash_uint(h, snd_ctl_elem_info_get_type(info));
+	h = hash_uint(h, snd_ctl_elem_info_get_count(info));
+	switch (snd_ctl_elem_info_get_type(info)) {
+	case SND_CTL_ELEM_TYPE_INTEGER:
+		h = hash_uint(h, snd_ctl_elem_info_get_min(info));
+		h = hash_uint(h, snd_ctl_elem_info_get_max(info));
+		h = hash_uint(h, snd_ctl_elem_info_get_step(info));
+		break;
+	case SND_CTL_ELEM_TYPE_INTEGER64:
+		min64 = snd_ctl_elem_info_get_min64(info);
+		max64 = snd_ctl_elem_info_get_max64(info);
+		step64 = snd_ctl_elem_info_get_step64(info);
+		h = hash_bytes(h, &min64, sizeof(min64));
+		h = hash_bytes(h, &max64, sizeof(max64));
+		h = hash_bytes(h, &step64, sizeof(step64));
+		break;
+	case SND_CTL_ELEM_TYPE_ENUMERATED:
+		h = hash_uint(h, snd_ctl_elem_info_get_items(info));
+		break;
+	default:
+		break;
+	}
+	if (snd_ctl_elem_info_is_tlv_readable(info)) {
+		memset(tlv, 0, sizeof(tlv));
+		if (snd_ctl_elem_tlv_read(handle, id, tlv, sizeof(tlv)) < 0)
+			return hash_uint(h, ~0U);
+		h = hash_bytes(h, tlv, sizeof(tlv));
+	}
+	return h;
+}
+
+/*
+ * Hash of the driver, of the control ids and of the control types,
+ * ranges and dB scales, the raw values in the cache are valid only for
+ * these.
+ */
+static int card_hash(snd_ctl_t *handle, snd_ctl_card_info_t *info,
+		     snd_ctl_elem_list_t *list, uint64_t *hash)
+{
+	snd_ctl_elem_id_t *id;
+	snd_ctl_elem_info_t *einfo;
+	unsigned int idx, count;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	int err;
+
+	snd_ctl_elem_id_alloca(&id);
+	snd_ctl_elem_info_alloca(&einfo);
+	h = hash_string(h, snd_ctl_card_info_get_driver(info));
+	h = hash_string(h, snd_ctl_card_info_get_mixername(info));
+	h = hash_string(h, snd_ctl_card_info_get_components(info));
+
+	err = snd_ctl_elem_list(handle, list);
+	if (err < 0)
+		return err;
+	count = snd_ctl_elem_list_get_count(list);
+	if (count > 0) {
+		if (snd_ctl_elem_list_alloc_space(list, count) < 0)
+			return -ENOMEM;
+		err = snd_ctl_elem_list(handle, list);
+		if (err < 0)
+			return err;
+	}
+	for (idx = 0; idx < count; idx++) {
+		snd_ctl_elem_list_get_id(list, idx, id);
+		h = hash_uint(h, snd_ctl_elem_id_get_numid(id));
+		h = hash_uint(h, snd_ctl_elem_id_get_interface(id));
+		h = hash_uint(h, snd_ctl_elem_id_get_device(id));
+		h = hash_uint(h, snd_ctl_elem_id_get_subdevice(id));
+		h = hash_string(h, snd_ctl_elem_id_get_name(id));
+		h = hash_uint(h, snd_ctl_elem_id_get_index(id));
+		h = elem_hash(handle, id, einfo, h);
+	}
+	*hash = h;
+	return 0;
+}
+
+static size_t value_size(snd_ctl_elem_type_t type, unsigned int count)
+{
+	size_t size;
+
+	switch (type) {
+	case SND_CTL_ELEM_TYPE_BOOLEAN:
+	case SND_CTL_ELEM_TYPE_INTEGER:
+	case SND_CTL_ELEM_TYPE_ENUMERATED:
+	case SND_CTL_ELEM_TYPE_INTEGER64:
+		return count * sizeof(int64_t);
+	case SND_CTL_ELEM_TYPE_BYTES:
+		size = count;
+		break;
+	case SND_CTL_ELEM_TYPE_IEC958:
+		size = sizeof(snd_aes_iec958_t);
+		break;
+	default:
+		return 0;
+	}
+	return (size + 7) & ~(size_t)7;
+}
+
+static void value_get(snd_ctl_elem_value_t *ctl, snd_ctl_elem_type_t type,
+		      unsigned int count, char *data)
+{
+	int64_t *v = (int64_t *)data;
+	unsigned int idx;
+
+	switch (type) {
+	case SND_CTL_ELEM_TYPE_BOOLEAN:
+		for (idx = 0; idx < count; idx++)
+			v[idx] = snd_ctl_elem_value_get_boolean(ctl, idx);
+		break;
+	case SND_CTL_ELEM_TYPE_INTEGER:
+		for (idx = 0; idx < count; idx++)
+			v[idx] = snd_ctl_elem_value_get_integer(ctl, idx);
+		break;
+	case SND_CTL_ELEM_TYPE_ENUMERATED:
+		for (idx = 0; idx < count; idx++)
+			v[idx] = snd_ctl_elem_value_get_enumerated(ctl, idx);
+		break;
+	case SND_CTL_ELEM_TYPE_INTEGER64:
+		for (idx = 0; idx < count; idx++)
+			v[idx] = snd_ctl_elem_value_get_integer64(ctl, idx);
+		break;
+	case SND_CTL_ELEM_TYPE_BYTES:
+		memcpy(data, snd_ctl_elem_value_get_bytes(ctl), count);
+		break;
+	case SND_CTL_ELEM_TYPE_IEC958:
+		snd_ctl_elem_value_get_iec958(ctl, (snd_aes_iec958_t *)data);
+		break;
+	default:
+		break;
+	}
+}
+
+/* append the value of one control, as parsed from the saved tree */
+int state_cache_add(struct cache_values *values, unsigned int numid,
+		    snd_ctl_elem_type_t type, unsigned int count,
+		    snd_ctl_elem_value_t *ctl)
+{
+	struct cache_control control;
+	size_t size;
+	char *p;
+
+	control.numid = numid;
+	control.type = type;
+	control.count = count;
+	control.size = value_size(type, count);
+	if (control.size == 0)
+		return 0;
+	size = values->size + sizeof(control) + control.size;
+	if (size > values->alloc) {
+		p = realloc(values->data, size * 2);
+		if (p == NULL)
+			return -ENOMEM;
+		values->data = p;
+		values->alloc = size * 2;
+	}
+	p = values->data + values->size;
+	memcpy(p, &control, sizeof(control));
+	memset(p + sizeof(control), 0, control.size);
+	value_get(ctl, type, count, p + sizeof(control));
+	values->size = size;
+	values->controls++;
+	return 0;
+}
+
+static void value_set(snd_ctl_elem_value_t *ctl, snd_ctl_elem_type_t type,
+		      unsigned int count, const char *data)
+{
+	const int64_t *v = (const int64_t *)data;
+	unsigned int idx;
+
+	switch (type) {
+	case SND_CTL_ELEM_TYPE_BOOLEAN:
+		for (idx = 0; idx < count; idx++)
+			snd_ctl_elem_value_set_boolean(ctl, idx, v[idx]);
+		break;
+	case SND_CTL_ELEM_TYPE_INTEGER:
+		for (idx = 0; idx < count; idx++)
+			snd_ctl_elem_value_set_integer(ctl, idx, v[idx]);
+		break;
+	case SND_CTL_ELEM_TYPE_ENUMERATED:
+		for (idx = 0; idx < count; idx++)
+			snd_ctl_elem_value_set_enumerated(ctl, idx, v[idx]);
+		break;
+	case SND_CTL_ELEM_TYPE_INTEGER64:
+		for (idx = 0; idx < count; idx++)
+			snd_ctl_elem_value_set_integer64(ctl, idx, v[idx]);
+		break;
+	case SND_CTL_ELEM_TYPE_BYTES:
+		for (idx = 0; idx < count; idx++)
+			snd_ctl_elem_value_set_byte(ctl, idx,
+						    (unsigned char)data[idx]);
+		break;
+	case SND_CTL_ELEM_TYPE_IEC958:
+		snd_ctl_elem_value_set_iec958(ctl,
+					      (const snd_aes_iec958_t *)data);
+		break;
+	default:
+		break;
+	}
+}
+
+static int write_all(int fd, const void *data, size_t size)
+{
+	const char *p = data;
+	ssize_t n;
+
+	while (size > 0) {
+		n = write(fd, p, size);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += n;
+		size -= n;
+	}
+	return 0;
+}
+
+/*
+ * Append one card to the cache file. The card is skipped when its saved
+ * state doesn't match its controls.
+ */
+static int cache_store_card(int fd, int cardno, snd_config_t *top,
+			    uint32_t *cards)
+{
+	snd_ctl_t *handle;
+	snd_ctl_card_info_t *info;
+	snd_ctl_elem_list_t *list;
+	struct cache_values values;
+	struct cache_card card;
+	char name[32];
+	int err;
+
+	snd_ctl_card_info_alloca(&info);
+	snd_ctl_elem_list_alloca(&list);
+	memset(&values, 0, sizeof(values));
+
+	sprintf(name, "hw:%d", cardno);
+	err = snd_ctl_open(&handle, name, SND_CTL_READONLY);
+	if (err < 0)
+		return err;
+	err = snd_ctl_card_info(handle, info);
+	if (err < 0)
+		goto _close;
+	memset(&card, 0, sizeof(card));
+	snprintf(card.id, sizeof(card.id), "%s", snd_ctl_card_info_get_id(info));
+	err = card_hash(handle, info, list, &card.hash);
+	if (err < 0)
+		goto _free;
+
+	err = state_cache_controls(handle, card.id, top, &values);
+	if (err < 0) {
+		/* the restore of this card uses the text file */
+		dbg("card %d is not cached: %s", cardno, snd_strerror(err));
+		err = 0;
+		goto _free;
+	}
+	card.controls = values.controls;
+	card.size = values.size;
+	err = write_all(fd, &card, sizeof(card));
+	if (err >= 0 && card.size > 0)
+		err = write_all(fd, values.data, card.size);
+	if (err >= 0)
+		(*cards)++;
+ _free:
+	free(values.data);
+	snd_ctl_elem_list_free_space(list);
+ _close:
+	snd_ctl_close(handle);
+	return err;
+}
+
+/*
+ * Write the cache for the text state file just written from top. The
+ * values are translated from the tree, the cards are only asked for
+ * their control lists.
+ */
+int state_cache_store(const char *file, const char *cardname,
+		      snd_config_t *top)
+{
+	struct cache_header header;
+	struct snd_card_iterator iter;
+	struct stat st;
+	char *name, *nname = NULL;
+	int fd = -1, err;
+
+	if (!strcmp(file, "-"))
+		return 0;
+	name = cache_name(file);
+	if (name == NULL)
+		return -ENOMEM;
+	if (stat(file, &st) < 0) {
+		err = -errno;
+		goto out;
+	}
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+	header.version = CACHE_VERSION;
+	header.mtime_sec = st.st_mtim.tv_sec;
+	header.mtime_nsec = st.st_mtim.tv_nsec;
+	header.size = st.st_size;
+
+	/* a unique name, the daemon and store may write at the same time */
+	nname = malloc(strlen(name) + 8);
+	if (nname == NULL) {
+		err = -ENOMEM;
+		goto out;
+	}
+	strcpy(nname, name);
+	strcat(nname, ".XXXXXX");
+	fd = mkstemp(nname);
+	if (fd < 0) {
+		err = -errno;
+		free(nname);
+		nname = NULL;
+		goto out;
+	}
+	if (fchmod(fd, 0644) < 0) {
+		err = -errno;
+		goto out;
+	}
+	/* the card count is written at the end */
+	err = write_all(fd, &header, sizeof(header));
+	if (err < 0)
+		goto out;
+	err = snd_card_iterator_sinit(&iter, cardname);
+	if (err < 0)
+		goto out;
+	while (snd_card_iterator_next(&iter)) {
+		err = cache_store_card(fd, iter.card, top, &header.cards);
+		if (err < 0)
+			goto out;
+	}
+	if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+		err = -EIO;
+		goto out;
+	}
+	if (close(fd) < 0) {
+		fd = -1;
+		err = -errno;
+		goto out;
+	}
+	fd = -1;
+	if (rename(nname, name) < 0)
+		err = -errno;
+out:
+	if (fd >= 0)
+		close(fd);
+	if (err < 0) {
+		error("Cannot store cache for %s: %s", file, snd_strerror(err));
+		if (nname)
+			unlink(nname);
+	}
+	free(nname);
+	free(name);
+	return err;
+}
+
+static int cache_index(struct state_cache *cache)
+{
+	struct cache_header *header = (struct cache_header *)cache->buf;
+	struct cache_card *card;
+	struct cache_control *control;
+	size_t pos = sizeof(*header), end;
+	unsigned int i, j;
+
+	cache->card = calloc(header->cards, sizeof(*cache->card));
+	if (header->cards > 0 && cache->card == NULL)
+		return -ENOMEM;
+	for (i = 0; i < header->cards; i++) {
+		if (cache->size - pos < sizeof(*card))
+			return -EINVAL;
+		card = (struct cache_card *)(cache->buf + pos);
+		pos += sizeof(*card);
+		if (cache->size - pos < card->size)
+			return -EINVAL;
+		end = pos + card->size;
+		/* check the controls, the restore trusts them */
+		for (j = 0; j < card->controls; j++) {
+			if (end - pos < sizeof(*control))
+				return -EINVAL;
+			control = (struct cache_control *)(cache->buf + pos);
+			pos += sizeof(*control);
+			if (control->size != value_size(control->type, control->count) ||
+			    end - pos < control->size)
+				return -EINVAL;
+			pos += control->size;
+		}
+		if (pos != end)
+			return -EINVAL;
+		cache->card[i] = card;
+	}
+	cache->cards = header->cards;
+	return 0;
+}
+
+/* load the cache if it belongs to the current text state file */
+int state_cache_load(const char *file, struct state_cache **_cache)
+{
+	struct state_cache *cache;
+	struct cache_header *header;
+	struct stat st, cst;
+	char *name;
+	ssize_t n;
+	size_t pos;
+	int fd, err;
+
+	*_cache = NULL;
+	if (stat(file, &st) < 0)
+		return -errno;
+	name = cache_name(file);
+	if (name == NULL)
+		return -ENOMEM;
+	fd = open(name, O_RDONLY);
+	free(name);
+	if (fd < 0)
+		return -errno;
+	cache = calloc(1, sizeof(*cache));
+	if (cache == NULL) {
+		err = -ENOMEM;
+		goto _close;
+	}
+	if (fstat(fd, &cst) < 0) {
+		err = -errno;
+		goto _error;
+	}
+	err = -EINVAL;
+	if ((size_t)cst.st_size < sizeof(*header))
+		goto _error;
+	cache->size = cst.st_size;
+	cache->buf = malloc(cache->size);
+	if (cache->buf == NULL) {
+		err = -ENOMEM;
+		goto _error;
+	}
+	for (pos = 0; pos < cache->size; pos += n) {
+		n = read(fd, cache->buf + pos, cache->size - pos);
+		if (n <= 0) {
+			err = n < 0 ? -errno : -EIO;
+			goto _error;
+		}
+	}
+	header = (struct cache_header *)cache->buf;
+	if (memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) ||
+	    header->version != CACHE_VERSION)
+		goto _error;
+	if (header->mtime_sec != st.st_mtim.tv_sec ||
+	    header->mtime_nsec != st.st_mtim.tv_nsec ||
+	    header->size != st.st_size) {
+		dbg("cache is older than %s", file);
+		err = -ESTALE;
+		goto _error;
+	}
+	err = cache_index(cache);
+	if (err < 0)
+		goto _error;
+	close(fd);
+	*_cache = cache;
+	return 0;
+
+_error:
+	state_cache_free(cache);
+_close:
+	close(fd);
+	return err;
+}
+
+void state_cache_free(struct state_cache *cache)
+{
+	if (cache == NULL)
+		return;
+	free(cache->card);
+	free(cache->buf);
+	free(cache);
+}
+
+/*
+ * Restore the card from the cache. An error means the cache doesn't
+ * match the card (or a write failed) and the text file is to be used.
+ */
+int state_cache_restore(struct state_cache *cache, int cardno)
+{
+	snd_ctl_t *handle;
+	snd_ctl_card_info_t *info;
+	snd_ctl_elem_list_t *list;
+	snd_ctl_elem_value_t *ctl;
+	struct cache_card *card = NULL;
+	struct cache_control *control;
+	const char *p;
+	char name[32];
+	uint64_t hash;
+	unsigned int i;
+	int err;
+
+	snd_ctl_card_info_alloca(&info);
+	snd_ctl_elem_list_alloca(&list);
+	snd_ctl_elem_value_alloca(&ctl);
+
+	sprintf(name, "hw:%d", cardno);
+	err = snd_ctl_open(&handle, name, 0);
+	if (err < 0)
+		return err;
+	err = snd_ctl_card_info(handle, info);
+	if (err < 0)
+		goto _close;
+	for (i = 0; i < cache->cards; i++) {
+		if (!strcmp(cache->card[i]->id, snd_ctl_card_info_get_id(info))) {
+			card = cache->card[i];
+			break;
+		}
+	}
+	if (card == NULL) {
+		err = -ENOENT;
+		goto _close;
+	}
+	err = card_hash(handle, info, list, &hash);
+	if (err < 0)
+		goto _free;
+	if (hash != card->hash) {
+		dbg("cache doesn't match the controls of card %d", cardno);
+		err = -ESTALE;
+		goto _free;
+	}
+	p = (const char *)(card + 1);
+	for (i = 0; i < card->controls; i++) {
+		control = (struct cache_control *)p;
+		p += sizeof(*control);
+		snd_ctl_elem_value_clear(ctl);
+		snd_ctl_elem_value_set_numid(ctl, control->numid);
+		value_set(ctl, control->type, control->count, p);
+		p += control->size;
+		err = snd_ctl_elem_write(handle, ctl);
+		if (err < 0) {
+			dbg("cache write of control #%u failed: %s",
+			    control->numid, snd_strerror(err));
+			goto _free;
+		}
+	}
+	dbg("card %d restored from cache, %u controls", cardno, card->controls);
+	err = 0;
+ _free:
+	snd_ctl_elem_list_free_space(list);
+ _close:
+	snd_ctl_close(handle);
+	return err;
+}
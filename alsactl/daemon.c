@@ -29,23 +29,52 @@
 #include <signal.h>
 #include <time.h>
 #include <poll.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/inotify.h>
 #include "alsactl.h"
 
+struct id_entry {
+	struct id_entry *next;
+	unsigned int hash;
+	snd_ctl_elem_id_t *id;
+};
+
+/* a hash set of the control ids, looked up for every event */
 struct id_list {
-	snd_ctl_elem_id_t **list;
+	struct id_entry **table;
+	unsigned int mask;
 	int size;
 };
 
 struct card {
 	int index;
 	int pfds;
+	struct pollfd *pfd;		/* registered in the epoll set */
 	snd_ctl_t *handle;
+	char id[32];
 	struct id_list whitelist;
 	struct id_list blacklist;
+	struct id_list changed;		/* controls to store */
+	bool rebuild;			/* store all controls */
+	bool pending;			/* hotplugged, not restored yet */
+	unsigned long events;		/* element events */
+	unsigned long events_last;	/* at the last report */
+	time_t start;
+	time_t events_time;
+};
+
+/* the state file as last written or loaded */
+struct state_tree {
+	snd_config_t *top;
+	struct timespec mtime;
+	off_t size;
 };
 
 static int quit = 0;
 static int rescan = 0;
+static int hotplug = 0;
 static int save_now = 0;
 
 static void signal_handler_quit(int sig)
@@ -68,29 +97,75 @@ static void signal_handler_rescan(int sig)
 
 static void free_list(struct id_list *list)
 {
-	int i;
-
-	for (i = 0; i < list->size; i++)
-		free(list->list[i]);
-	free(list->list);
+	struct id_entry *e, *next;
+	unsigned int i;
+
+	for (i = 0; list->table && i <= list->mask; i++) {
+		for (e = list->table[i]; e; e = next) {
+			next = e->next;
+			free(e->id);
+			free(e);
+		}
+	}
+	free(list->table);
+	list->table = NULL;
+	list->mask = 0;
+	list->size = 0;
 }
 
 static void card_free(struct card **card)
 {
 	struct card *c = *card;
 
+	free_list(&c->changed);
 	free_list(&c->blacklist);
 	free_list(&c->whitelist);
 	if (c->handle)
 		snd_ctl_close(c->handle);
+	free(c->pfd);
 	free(c);
 	*card = NULL;
 }
 
-static void add_card(struct card ***cards, int *count, const char *cardname)
+/* the events of every descriptor point to its pollfd in card->pfd */
+static int card_register(struct card *card, int epfd)
+{
+	struct epoll_event ev;
+	int i;
+
+	card->pfd = calloc(card->pfds, sizeof(*card->pfd));
+	if (card->pfd == NULL)
+		return -ENOMEM;
+	i = snd_ctl_poll_descriptors(card->handle, card->pfd, card->pfds);
+	if (i != card->pfds)
+		return i < 0 ? i : -EIO;
+	for (i = 0; i < card->pfds; i++) {
+		ev.events = card->pfd[i].events;
+		ev.data.ptr = &card->pfd[i];
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, card->pfd[i].fd, &ev) < 0)
+			return -errno;
+	}
+	return 0;
+}
+
+/*
+ * The descriptors are removed explicitly, closing them is not enough
+ * when a forked process still has them open.
+ */
+static void card_unregister(struct card *card, int epfd)
+{
+	int i;
+
+	for (i = 0; card->pfd && i < card->pfds; i++)
+		epoll_ctl(epfd, EPOLL_CTL_DEL, card->pfd[i].fd, NULL);
+}
+
+static void add_card(struct card ***cards, int *count, const char *cardname,
+		     int epfd, bool pending)
 {
 	struct card *card, **cc;
-	int i, index, findex;
+	snd_ctl_card_info_t *info;
+	int i, index, findex, err;
 	char device[16];
 
 	index = snd_card_get_index(cardname);
@@ -108,11 +183,20 @@ static void add_card(struct card ***cards, int *count, const char *cardname)
 	if (card == NULL)
 		return;
 	card->index = index;
+	card->rebuild = true;
+	card->pending = pending;
+	card->start = card->events_time = time(NULL);
 	sprintf(device, "hw:%i", index);
 	if (snd_ctl_open(&card->handle, device, SND_CTL_READONLY|SND_CTL_NONBLOCK) < 0) {
 		card_free(&card);
 		return;
 	}
+	snd_ctl_card_info_alloca(&info);
+	if (snd_ctl_card_info(card->handle, info) < 0) {
+		card_free(&card);
+		return;
+	}
+	snprintf(card->id, sizeof(card->id), "%s", snd_ctl_card_info_get_id(info));
 	card->pfds = snd_ctl_poll_descriptors_count(card->handle);
 	if (card->pfds < 0) {
 		card_free(&card);
@@ -122,11 +206,20 @@ static void add_card(struct card ***cards, int *count, const char *cardname)
 		card_free(&card);
 		return;
 	}
+	err = card_register(card, epfd);
+	if (err < 0) {
+		error("Cannot watch card %s: %s", card->id, snd_strerror(err));
+		card_unregister(card, epfd);
+		card_free(&card);
+		return;
+	}
+	dbg("card %s added", card->id);
 	if (findex >= 0) {
 		(*cards)[findex] = card;
 	} else {
 		cc = realloc(*cards, sizeof(void *) * (*count + 1));
 		if (cc == NULL) {
+			card_unregister(card, epfd);
 			card_free(&card);
 			return;
 		}
@@ -136,7 +229,8 @@ static void add_card(struct card ***cards, int *count, const char *cardname)
 	}
 }
 
-static void add_cards(struct card ***cards, int *count)
+static void add_cards(struct card ***cards, int *count, int epfd,
+		      bool pending)
 {
 	int card = -1;
 	char cardname[16];
@@ -148,11 +242,25 @@ static void add_cards(struct card ***cards, int *count)
 			break;
 		if (card >= 0) {
 			sprintf(cardname, "%i", card);
-			add_card(cards, count, cardname);
+			add_card(cards, count, cardname, epfd, pending);
 		}
 	}
 }
 
+static unsigned int id_hash(snd_ctl_elem_id_t *id)
+{
+	const char *name = snd_ctl_elem_id_get_name(id);
+	unsigned int hash = 2166136261u;
+
+	hash = (hash ^ snd_ctl_elem_id_get_interface(id)) * 16777619u;
+	hash = (hash ^ snd_ctl_elem_id_get_device(id)) * 16777619u;
+	hash = (hash ^ snd_ctl_elem_id_get_subdevice(id)) * 16777619u;
+	hash = (hash ^ snd_ctl_elem_id_get_index(id)) * 16777619u;
+	while (*name)
+		hash = (hash ^ (unsigned char)*name++) * 16777619u;
+	return hash;
+}
+
 static int compare_ids(snd_ctl_elem_id_t *id1, snd_ctl_elem_id_t *id2)
 {
 	if (id1 == NULL || id2 == NULL)
@@ -164,54 +272,86 @@ static int compare_ids(snd_ctl_elem_id_t *id1, snd_ctl_elem_id_t *id2)
 	       snd_ctl_elem_id_get_subdevice(id1) == snd_ctl_elem_id_get_subdevice(id2);
 }
 
-static int in_list(struct id_list *list, snd_ctl_elem_id_t *id)
+/* the link pointing to the entry, or to the end of its bucket */
+static struct id_entry **find_in_list(struct id_list *list,
+				      snd_ctl_elem_id_t *id, unsigned int hash)
 {
-	int i;
-	snd_ctl_elem_id_t *id1;
+	struct id_entry **e;
 
-	for (i = 0; i < list->size; i++) {
-		id1 = list->list[i];
-		if (id1 == NULL)
-			continue;
-		if (compare_ids(id, id1))
-			return 1;
-	}
-	return 0;
+	for (e = &list->table[hash & list->mask]; *e; e = &(*e)->next)
+		if ((*e)->hash == hash && compare_ids(id, (*e)->id))
+			break;
+	return e;
+}
+
+static int in_list(struct id_list *list, snd_ctl_elem_id_t *id)
+{
+	if (list->size == 0)
+		return 0;
+	return *find_in_list(list, id, id_hash(id)) != NULL;
 }
 
 static void remove_from_list(struct id_list *list, snd_ctl_elem_id_t *id)
 {
-	int i;
+	struct id_entry **e, *e1;
+
+	if (list->size == 0)
+		return;
+	e = find_in_list(list, id, id_hash(id));
+	if (*e == NULL)
+		return;
+	e1 = *e;
+	*e = e1->next;
+	free(e1->id);
+	free(e1);
+	list->size--;
+}
 
-	for (i = 0; i < list->size; i++) {
-		if (compare_ids(id, list->list[i])) {
-			free(list->list[i]);
-			list->list[i] = NULL;
+static int grow_list(struct id_list *list)
+{
+	struct id_entry **table, *e, *next;
+	unsigned int i, mask;
+
+	mask = list->table ? list->mask * 2 + 1 : 15;
+	table = calloc(mask + 1, sizeof(*table));
+	if (table == NULL)
+		return -ENOMEM;
+	for (i = 0; list->table && i <= list->mask; i++) {
+		for (e = list->table[i]; e; e = next) {
+			next = e->next;
+			e->next = table[e->hash & mask];
+			table[e->hash & mask] = e;
 		}
 	}
+	free(list->table);
+	list->table = table;
+	list->mask = mask;
+	return 0;
 }
 
 static void add_to_list(struct id_list *list, snd_ctl_elem_id_t *id)
 {
-	snd_ctl_elem_id_t *id1;
-	snd_ctl_elem_id_t **n;
-	int i;
+	struct id_entry **e, *e1;
+	unsigned int hash = id_hash(id);
 
-	if (snd_ctl_elem_id_malloc(&id1))
-		return;
-	snd_ctl_elem_id_copy(id1, id);
-	for (i = 0; i < list->size; i++) {
-		if (list->list[i] == NULL) {
-			list->list[i] = id1;
+	if (list->table == NULL || (unsigned int)list->size > list->mask) {
+		if (grow_list(list) < 0)
 			return;
-		}
 	}
-	n = realloc(list->list, sizeof(void *) * (list->size + 1));
-	if (n == NULL)
+	e = find_in_list(list, id, hash);
+	if (*e)
+		return;
+	e1 = calloc(1, sizeof(*e1));
+	if (e1 == NULL)
 		return;
-	n[list->size] = id1;
+	if (snd_ctl_elem_id_malloc(&e1->id)) {
+		free(e1);
+		return;
+	}
+	snd_ctl_elem_id_copy(e1->id, id);
+	e1->hash = hash;
+	*e = e1;
 	list->size++;
-	list->list = n;
 }
 
 static int check_lists(struct card *card, snd_ctl_elem_id_t *id)
@@ -250,11 +390,19 @@ static int card_events(struct card *card)
 		type = snd_ctl_event_get_type(ev);
 		if (type != SND_CTL_EVENT_ELEM)
 			continue;
+		card->events++;
 		mask = snd_ctl_event_elem_get_mask(ev);
 		snd_ctl_event_elem_get_id(ev, id);
+		/* the restore of a hotplugged card writes its controls */
+		if (mask != SND_CTL_EVENT_MASK_REMOVE &&
+		    (mask & SND_CTL_EVENT_MASK_VALUE))
+			card->pending = false;
 		if (mask == SND_CTL_EVENT_MASK_REMOVE) {
 			remove_from_list(&card->whitelist, id);
 			remove_from_list(&card->blacklist, id);
+			remove_from_list(&card->changed, id);
+			/* the control set changed, store the whole card */
+			card->rebuild = true;
 			continue;
 		}
 		if (mask & SND_CTL_EVENT_MASK_INFO) {
@@ -264,8 +412,175 @@ static int card_events(struct card *card)
 		if (mask & (SND_CTL_EVENT_MASK_VALUE|
 			    SND_CTL_EVENT_MASK_ADD|
 			    SND_CTL_EVENT_MASK_TLV)) {
-			if (check_lists(card, id))
+			if (check_lists(card, id)) {
+				if (mask & SND_CTL_EVENT_MASK_ADD)
+					card->rebuild = true;
+				else
+					add_to_list(&card->changed, id);
 				res = 1;
+			}
+		}
+	}
+	return res;
+}
+
+static void card_stored(struct card *card)
+{
+	free_list(&card->changed);
+	card->rebuild = false;
+}
+
+/* the event rate since the last report */
+static void card_rate(struct card *card)
+{
+	time_t now = time(NULL);
+	unsigned long events = card->events - card->events_last;
+
+	if (now > card->events_time)
+		dbg("card %s: %lu events in %lds, %lu/s, %d changed controls",
+		    card->id, events, (long)(now - card->events_time),
+		    events / (now - card->events_time), card->changed.size);
+	card->events_last = card->events;
+	card->events_time = now;
+}
+
+static bool state_file_changed(const char *file, struct state_tree *tree)
+{
+	struct stat st;
+
+	if (stat(file, &st) < 0)
+		return tree->size >= 0;
+	return st.st_mtim.tv_sec != tree->mtime.tv_sec ||
+	       st.st_mtim.tv_nsec != tree->mtime.tv_nsec ||
+	       st.st_size != tree->size;
+}
+
+static void state_file_stat(const char *file, struct state_tree *tree)
+{
+	struct stat st;
+
+	if (stat(file, &st) < 0) {
+		tree->size = -1;
+		return;
+	}
+	tree->mtime = st.st_mtim;
+	tree->size = st.st_size;
+}
+
+/*
+ * Store only the changed controls in the kept state tree and write it.
+ * A card is read completely when it was added, when its control set
+ * changed or when the file was changed by somebody else, so the cost of
+ * a periodic save doesn't grow with the number of controls. A hotplugged
+ * card is not stored before it was restored, its driver defaults would
+ * replace its saved state.
+ */
+static void save_cards(const char *file, const char *cardname,
+		       struct state_tree *tree, struct card **cards, int count,
+		       bool cache)
+{
+	struct card *card;
+	struct id_entry *e;
+	unsigned int j;
+	int i, err, lock_fd;
+
+	lock_fd = state_lock(file, LOCK_TIMEOUT);
+	if (lock_fd < 0)
+		return;
+	if (tree->top == NULL || state_file_changed(file, tree)) {
+		if (state_tree_load(file, &tree->top) < 0)
+			goto out;
+		for (i = 0; i < count; i++)
+			if (cards[i])
+				cards[i]->rebuild = true;
+	}
+	for (i = 0; i < count; i++) {
+		card = cards[i];
+		if (card == NULL || card->pending)
+			continue;
+		card_rate(card);
+		for (j = 0; card->changed.table && j <= card->changed.mask &&
+			    !card->rebuild; j++) {
+			for (e = card->changed.table[j]; e && !card->rebuild;
+			     e = e->next) {
+				err = state_tree_store_control(tree->top,
+							       card->id,
+							       card->handle,
+							       e->id);
+				if (err < 0)
+					card->rebuild = true;
+			}
+		}
+		if (card->rebuild &&
+		    state_tree_store_card(tree->top, card->index) < 0)
+			continue;
+		card_stored(card);
+	}
+	if (state_tree_save(file, tree->top) >= 0) {
+		state_file_stat(file, tree);
+		/* the cache is worth it only for the final save */
+		if (cache)
+			state_cache_store(file, cardname, tree->top);
+	}
+out:
+	state_unlock(lock_fd, file);
+	snd_config_update_free_global();
+}
+
+/* the card owning the pollfd of an epoll event, if it was not freed */
+static struct card *find_card(struct card **cards, int count,
+			      struct pollfd *pfd)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (cards[i] && pfd >= cards[i]->pfd &&
+		    pfd < cards[i]->pfd + cards[i]->pfds)
+			return cards[i];
+	}
+	return NULL;
+}
+
+/*
+ * New soundcards are noticed by their control device appearing in
+ * /dev/snd, so they are tracked without waiting for a rescan request.
+ * They are stored only after the rescan request of nrestore or their
+ * first value change, as udev restores them after they appear.
+ */
+static int hotplug_open(void)
+{
+	int fd, err;
+
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	if (inotify_add_watch(fd, "/dev/snd", IN_CREATE | IN_MOVED_TO) < 0) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+	return fd;
+}
+
+/* returns 1 if a control device was created */
+static int hotplug_events(int fd)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	ssize_t len;
+	char *pos;
+	int res = 0;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (pos = buf; pos < buf + len; pos += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)pos;
+			if (ev->mask & IN_Q_OVERFLOW)
+				res = 1;
+			else if (ev->len > 0 &&
+				 strncmp(ev->name, "controlC", 8) == 0) {
+				dbg("hotplug: /dev/snd/%s", ev->name);
+				res = 1;
+			}
 		}
 	}
 	return res;
@@ -359,11 +674,16 @@ static int check_another_instance(const char *pidfile)
 int state_daemon(const char *file, const char *cardname, int period,
 		 const char *pidfile)
 {
-	int count = 0, pcount, psize = 0, i, j, k, changed = 0;
-	time_t last_write, now;
+	int count = 0, i, j, n, err, changed = 0;
+	int epfd = -1, tfd = -1, hfd = -1;
+	uint64_t expirations;
 	unsigned short revents;
-	struct card **cards = NULL;
-	struct pollfd *pfd = NULL, *pfdn;
+	struct card **cards = NULL, *card;
+	struct pollfd *pfd;
+	struct epoll_event ev[16];
+	struct itimerspec timeout = { .it_value.tv_sec = period };
+	struct state_tree tree = { .top = NULL };
+	sigset_t mask, omask;
 
 	if (check_another_instance(pidfile))
 		return 0;
@@ -373,87 +693,133 @@ int state_daemon(const char *file, const char *cardname, int period,
 	signal(SIGINT, signal_handler_quit);
 	signal(SIGUSR1, signal_handler_rescan);
 	signal(SIGUSR2, signal_handler_save_and_quit);
+	/* the signals are delivered only while waiting in epoll_pwait() */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGUSR2);
+	sigprocmask(SIG_BLOCK, &mask, &omask);
 	write_pid_file(pidfile);
-	time(&last_write);
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		error("epoll failed: %s", strerror(errno));
+		goto out;
+	}
+	/* the save deadline, armed by the first change after a save */
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (tfd < 0) {
+		error("timerfd failed: %s", strerror(errno));
+		goto out;
+	}
+	ev[0].events = EPOLLIN;
+	ev[0].data.ptr = &tfd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev[0]) < 0) {
+		error("epoll failed: %s", strerror(errno));
+		goto out;
+	}
+	hfd = hotplug_open();
+	if (hfd < 0) {
+		dbg("no hotplug detection: %s", strerror(-hfd));
+	} else {
+		ev[0].events = EPOLLIN;
+		ev[0].data.ptr = &hfd;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, hfd, &ev[0]) < 0) {
+			close(hfd);
+			hfd = -1;
+		}
+	}
+
 	while (!quit || save_now) {
 		if (save_now)
 			goto save;
-		if (rescan) {
+		if (rescan || hotplug) {
+			/* a rescan request comes after the restore */
 			if (cardname) {
-				add_card(&cards, &count, cardname);
+				add_card(&cards, &count, cardname, epfd, !rescan);
 			} else {
-				add_cards(&cards, &count);
+				add_cards(&cards, &count, epfd, !rescan);
 			}
+			for (i = 0; rescan && i < count; i++)
+				if (cards[i])
+					cards[i]->pending = false;
 			snd_config_update_free_global();
-			rescan = 0;
+			rescan = hotplug = 0;
 		}
-		for (i = pcount = 0; i < count; i++) {
-			if (cards[i] == NULL)
-				continue;
-			pcount += cards[i]->pfds;
+		n = epoll_pwait(epfd, ev, ARRAY_SIZE(ev), -1, &omask);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			error("epoll failed: %s", strerror(errno));
+			break;
 		}
-		if (pcount > psize) {
-			pfdn = realloc(pfd, sizeof(struct pollfd) * pcount);
-			if (pfdn) {
-				psize = pcount;
-				pfd = pfdn;
-			} else {
-				error("No enough memory...");
-				goto out;
+		for (i = 0; i < n; i++) {
+			if (ev[i].data.ptr == &tfd) {
+				if (read(tfd, &expirations, sizeof(expirations)) > 0)
+					save_now = changed;
+				continue;
 			}
-		}
-		for (i = j = 0; i < count; i++) {
-			if (cards[i] == NULL)
+			if (ev[i].data.ptr == &hfd) {
+				if (hotplug_events(hfd))
+					hotplug = 1;
 				continue;
-			k = snd_ctl_poll_descriptors(cards[i]->handle, pfd + j, pcount - j);
-			if (k != cards[i]->pfds) {
-				error("poll prepare failed: %i", k);
-				goto out;
 			}
-			j += k;
-		}
-		i = poll(pfd, j, (period / 2) * 1000);
-		if (i < 0 && errno == EINTR)
-			continue;
-		if (i < 0) {
-			error("poll failed: %s", strerror(errno));
-			break;
-		}
-		time(&now);
-		for (i = j = 0; i < count; i++) {
-			if (cards[i] == NULL)
+			pfd = ev[i].data.ptr;
+			card = find_card(cards, count, pfd);
+			if (card == NULL)
 				continue;
-			k = snd_ctl_poll_descriptors_revents(cards[i]->handle,
-					pfd + j, cards[i]->pfds, &revents);
-			if (k < 0) {
-				error("poll post failed: %i\n", k);
+			pfd->revents = ev[i].events;
+			err = snd_ctl_poll_descriptors_revents(card->handle,
+					card->pfd, card->pfds, &revents);
+			pfd->revents = 0;
+			if (err < 0) {
+				error("poll post failed: %i\n", err);
 				goto out;
 			}
-			j += cards[i]->pfds;
-			if (revents & (POLLERR|POLLNVAL)) {
-				card_free(&cards[i]);
+			if (revents & (POLLERR|POLLNVAL|POLLHUP)) {
+				dbg("card %s removed", card->id);
+				card_unregister(card, epfd);
+				for (j = 0; j < count; j++)
+					if (cards[j] == card)
+						card_free(&cards[j]);
 			} else if (revents & POLLIN) {
-				if (card_events(cards[i])) {
+				if (card_events(card) && !changed) {
 					/* delay the write */
-					if (!changed)
-						last_write = now;
 					changed = 1;
+					timerfd_settime(tfd, 0, &timeout, NULL);
 				}
 			}
 		}
-		if ((now - last_write >= period && changed) || save_now) {
+		if (save_now) {
 save:
 			changed = save_now = 0;
-			save_state(file, cardname);
+			save_cards(file, cardname, &tree, cards, count,
+				   quit && use_cache);
 		}
 	}
 out:
-	free(pfd);
+	if (tree.top)
+		snd_config_delete(tree.top);
+	if (hfd >= 0)
+		close(hfd);
+	if (tfd >= 0)
+		close(tfd);
 	remove(pidfile);
 	if (cards) {
-		for (i = 0; i < count; i++)
+		for (i = 0; i < count; i++) {
+			if (cards[i] == NULL)
+				continue;
+			if (cards[i]->events)
+				info("card %s: %lu control events in %lds",
+				     cards[i]->id, cards[i]->events,
+				     (long)(time(NULL) - cards[i]->start));
 			card_free(&cards[i]);
+		}
 		free(cards);
 	}
+	if (epfd >= 0)
+		close(epfd);
+	sigprocmask(SIG_SETMASK, &omask, NULL);
 	return 0;
 }
@@ -0,0 +1,145 @@
+/*
+ *  Benchmark of the alsactl init rules: the rule files are parsed, stored
+ *  to the rule cache and loaded back, and the cards given on the command
+ *  line are initialized.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "aconfig.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include "alsactl.h"
+
+int debugflag = 0;
+int force_restore = 1;
+int ignore_nocards = 0;
+int do_lock = 0;
+int use_syslog = 0;
+int use_cache = 0;
+char *command = "init-bench";
+char *statefile = NULL;
+char *lockpath = "/tmp";
+char *lockfile = "asound.state.lock";
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void usage(void)
+{
+	printf("Usage: init-bench [-r rounds] [-U] [-d] <rule file> [card...]\n"
+	       "  -r  rounds of the parse and the cache load (default 100)\n"
+	       "  -U  initialize the cards without UCM\n"
+	       "  -d  debug messages\n"
+	       "The cards are initialized to their default state.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	char cfgdir[] = "/tmp/init-bench.XXXXXX";
+	char path[PATH_MAX];
+	const char *rules;
+	int rounds = 100, flags = 0, i, c, err;
+	double start, parse_us, load_us, card_us;
+
+	while ((c = getopt(argc, argv, "r:Udh")) >= 0) {
+		switch (c) {
+		case 'r':
+			rounds = atoi(optarg);
+			if (rounds < 1)
+				rounds = 1;
+			break;
+		case 'U':
+			flags |= FLAG_UCM_DISABLED;
+			break;
+		case 'd':
+			debugflag = 1;
+			break;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind >= argc) {
+		usage();
+		return EXIT_FAILURE;
+	}
+	rules = argv[optind++];
+
+	/* the cache and the card configurations go to a private directory */
+	if (mkdtemp(cfgdir) == NULL) {
+		fprintf(stderr, "Cannot create %s: %s\n", cfgdir, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	start = now_us();
+	for (i = 0; i < rounds; i++) {
+		init_rules_free();
+		err = init_rules_prepare(rules);
+		if (err < 0) {
+			fprintf(stderr, "Cannot parse %s: %s\n", rules, strerror(-err));
+			goto out;
+		}
+	}
+	parse_us = (now_us() - start) / rounds;
+
+	err = init_rules_save(cfgdir);
+	if (err < 0) {
+		fprintf(stderr, "Cannot save the rule cache: %s\n", strerror(-err));
+		goto out;
+	}
+	start = now_us();
+	for (i = 0; i < rounds; i++) {
+		init_rules_free();
+		err = init_rules_load(cfgdir);
+		if (err < 0) {
+			fprintf(stderr, "Cannot load the rule cache: %s\n", strerror(-err));
+			goto out;
+		}
+	}
+	load_us = (now_us() - start) / rounds;
+
+	printf("rules: parse %.1f us, cache load %.1f us\n", parse_us, load_us);
+
+	/* the first card is initialized with the rules cached already */
+	use_cache = 1;
+	for (; optind < argc; optind++) {
+		start = now_us();
+		err = init(cfgdir, rules, flags, argv[optind]);
+		card_us = now_us() - start;
+		printf("card %s: init %.1f us%s\n", argv[optind], card_us,
+		       err < 0 ? " (failed)" : "");
+	}
+	err = 0;
+
+out:
+	init_rules_free();
+	snprintf(path, sizeof(path), "%s/init-rules.cache", cfgdir);
+	unlink(path);
+	rmdir(cfgdir);
+	return err < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -37,6 +37,8 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <math.h>
+#include <stdint.h>
+#include <time.h>
 #include "aconfig.h"
 #include "alsactl.h"
 #include "list.h"
@@ -60,8 +62,53 @@ struct pair {
 	struct pair *next;
 };
 
+#define PAIR_HASH	64
+
+/* a key of a rule with its operation and value */
+struct rule_key {
+	char *key;
+	char *value;
+	enum key_op op;
+};
+
+enum rule_status {
+	RULE_OK,
+	RULE_INVALID,		/* a key cannot be parsed after the keys */
+	RULE_TOO_LONG,		/* the file is not parsed further */
+};
+
+struct rule_line {
+	unsigned int linenum;
+	enum rule_status status;
+	unsigned int first;	/* index to keys */
+	unsigned int count;
+};
+
+/*
+ * A rule file split to the keys of the rules. The files are parsed
+ * once and reused for all cards while their modification time and
+ * size do not change.
+ */
+struct rule_file {
+	struct rule_file *next;
+	char *filename;
+	struct timespec mtime;
+	off_t size;
+	int users;		/* parse() calls, INCLUDE may nest */
+	bool stale;		/* changed while in use */
+	char *text;		/* the joined lines, the keys point here */
+	size_t textlen;
+	struct rule_line *lines;
+	unsigned int nlines;
+	struct rule_key *keys;
+	unsigned int nkeys;
+};
+
+static struct rule_file *rule_files;
+static bool rule_files_changed;	/* a file was parsed, see init_rules_save */
+
 struct space {
-	struct pair *pairs;
+	struct pair *pairs[PAIR_HASH];
 	char *rootdir;
 	char *go_to;
 	char *program_result;
@@ -95,17 +142,18 @@ static void Perror(struct space *space, const char *fmt, ...)
 
 static void free_space(struct space *space)
 {
-	struct pair *pair = space->pairs;
-	struct pair *next = pair;
+	struct pair *pair, *next;
+	int i;
 
-	while (next) {
-		pair = next;
-		next = pair->next;
-		free(pair->value);
-		free(pair->key);
-		free(pair);
+	for (i = 0; i < PAIR_HASH; i++) {
+		for (pair = space->pairs[i]; pair; pair = next) {
+			next = pair->next;
+			free(pair->value);
+			free(pair->key);
+			free(pair);
+		}
+		space->pairs[i] = NULL;
 	}
-	space->pairs = NULL;
 	if (space->ctl_value) {
 		snd_ctl_elem_value_free(space->ctl_value);
 		space->ctl_value = NULL;
@@ -135,9 +183,18 @@ static void free_space(struct space *space)
 	free(space);
 }
 
+static unsigned int pair_hash(const char *key)
+{
+	unsigned int hash = 0;
+
+	while (*key)
+		hash = hash * 31 + (unsigned char)*key++;
+	return hash % PAIR_HASH;
+}
+
 static struct pair *value_find(struct space *space, const char *key)
 {
-	struct pair *pair = space->pairs;
+	struct pair *pair = space->pairs[pair_hash(key)];
 	
 	while (pair && strcmp(pair->key, key) != 0)
 		pair = pair->next;
@@ -147,6 +204,7 @@ static struct pair *value_find(struct space *space, const char *key)
 static int value_set(struct space *space, const char *key, const char *value)
 {
 	struct pair *pair;
+	unsigned int hash = pair_hash(key);
 	
 	pair = value_find(space, key);
 	if (pair) {
@@ -169,8 +227,8 @@ static int value_set(struct space *space, const char *key, const char *value)
 			free(pair);
 			return -ENOMEM;
 		}
-		pair->next = space->pairs;
-		space->pairs = pair;
+		pair->next = space->pairs[hash];
+		space->pairs[hash] = pair;
 	}
 	return 0;
 }
@@ -1284,23 +1342,21 @@ static int conf_name_filter(const struct dirent *d)
 	return ext && !strcmp(ext, ".conf");
 }
 
-static int parse_line(struct space *space, char *line, size_t linesize)
+static int parse_line(struct space *space, struct rule_file *rf,
+		      struct rule_line *rl)
 {
-	char *linepos;
 	char *key, *value, *attr, *temp;
 	struct pair *pair;
 	enum key_op op;
 	int err = 0, count;
+	unsigned int k;
 	char string[PATH_SIZE];
 	char result[PATH_SIZE];
 
-	linepos = line;
-	while (*linepos != '\0') {
-		op = KEY_OP_UNSET;
-		
-		err = get_key(&linepos, &key, &op, &value);
-		if (err < 0)
-			goto invalid;
+	for (k = 0; k < rl->count; k++) {
+		key = rf->keys[rl->first + k].key;
+		op = rf->keys[rl->first + k].op;
+		value = rf->keys[rl->first + k].value;
 
 		if (strncasecmp(key, "LABEL", 5) == 0) {
 			if (op != KEY_OP_ASSIGN) {
@@ -1648,6 +1704,8 @@ static int parse_line(struct space *space, char *line, size_t linesize)
 
 		Perror(space, "unknown key '%s'", key);
 	}
+	if (k == rl->count && rl->status == RULE_INVALID)
+		goto invalid;
 	return err;
 
 invalid:
@@ -1655,37 +1713,79 @@ invalid:
 	return -EINVAL;
 }
 
-static int parse(struct space *space, const char *filename)
+static void rule_file_free(struct rule_file *rf)
 {
-	char *buf, *bufline, *line;
-	size_t bufsize, pos, count, linesize;
-	unsigned int linenum, i, j, linenum_adj;
-	int err;
+	free(rf->filename);
+	free(rf->text);
+	free(rf->lines);
+	free(rf->keys);
+	free(rf);
+}
 
-	dbg("start of file '%s'", filename);
+static int rule_file_add_line(struct rule_file *rf, unsigned int *lsize,
+			      unsigned int linenum, enum rule_status status)
+{
+	struct rule_line *lines;
 
-	if (file_map(filename, &buf, &bufsize) != 0) {
-		err = errno;
-		error("Unable to open file '%s': %s", filename, strerror(err));
-		return -err;
+	if (rf->nlines >= *lsize) {
+		lines = realloc(rf->lines, (*lsize + 64) * sizeof(*lines));
+		if (lines == NULL)
+			return -ENOMEM;
+		rf->lines = lines;
+		*lsize += 64;
+	}
+	lines = &rf->lines[rf->nlines++];
+	lines->linenum = linenum;
+	lines->status = status;
+	lines->first = rf->nkeys;
+	lines->count = 0;
+	return 0;
+}
+
+static int rule_file_add_key(struct rule_file *rf, unsigned int *ksize,
+			     char *key, enum key_op op, char *value)
+{
+	struct rule_key *keys;
+
+	if (rf->nkeys >= *ksize) {
+		keys = realloc(rf->keys, (*ksize + 256) * sizeof(*keys));
+		if (keys == NULL)
+			return -ENOMEM;
+		rf->keys = keys;
+		*ksize += 256;
 	}
+	keys = &rf->keys[rf->nkeys++];
+	keys->key = key;
+	keys->op = op;
+	keys->value = value;
+	rf->lines[rf->nlines - 1].count++;
+	return 0;
+}
 
-	err = 0;	
+/* split the rule lines to the keys */
+static int rule_file_compile(struct rule_file *rf, const char *buf,
+			     size_t bufsize)
+{
+	const char *bufline;
+	char *line, *linepos, *end, *key, *value;
+	size_t pos, count;
+	unsigned int linenum, i, linenum_adj, lsize = 0, ksize = 0;
+	enum key_op op;
+	int err;
+
+	/* the joined lines are not longer than the file */
+	rf->text = malloc(bufsize + 1);
+	if (rf->text == NULL)
+		return -ENOMEM;
+	line = rf->text;
 	pos = 0;
 	linenum = 0;
-	linesize = 128;
-	line = malloc(linesize);
-	if (line == NULL) {
-		file_unmap(buf, bufsize);
-		return -ENOMEM;
-	}
-	space->filename = filename;
-	while (!err && pos < bufsize && !space->quit) {
+	while (pos < bufsize) {
 		count = line_width(buf, bufsize, pos);
 		bufline = buf + pos;
 		pos += count + 1;
 		linenum++;
-		
+
 		/* skip whitespaces */
 		while (count > 0 && isspace(bufline[0])) {
 			bufline++;
@@ -1693,52 +1793,505 @@ static int parse(struct space *space, const char *filename)
 		}
 		if (count == 0)
 			continue;
-			
+
 		/* comment check */
 		if (bufline[0] == '#')
 			continue;
-		
-		if (count > linesize - 1) {
-			free(line);
-			line = NULL;
-			linesize = (count + 127 + 1) & ~127;
-			if (linesize > 2048) {
-				error("file %s, line %i too long", filename, linenum);
-				err = -EINVAL;
-				break;
-			}
-			line = malloc(linesize);
-			if (line == NULL) {
-				err = -EINVAL;
-				break;
-			}
+
+		if (count >= 2048) {
+			err = rule_file_add_line(rf, &lsize, linenum,
+						 RULE_TOO_LONG);
+			return err;
 		}
-		
+
 		/* skip backslash and newline from multiline rules */
 		linenum_adj = 0;
-		for (i = j = 0; i < count; i++) {
-			if (bufline[i] == '\\' && bufline[i+1] == '\n') {
+		end = line;
+		for (i = 0; i < count; i++) {
+			if (bufline[i] == '\\' && i + 1 < count &&
+			    bufline[i+1] == '\n') {
 				linenum_adj++;
 				continue;
 			}
-			line[j++] = bufline[i];
+			*end++ = bufline[i];
 		}
-		line[j] = '\0';
+		*end = '\0';
 
 		dbg("read (%i) '%s'", linenum, line);
-		space->linenum = linenum;
-		err = parse_line(space, line, linesize);
+		err = rule_file_add_line(rf, &lsize, linenum, RULE_OK);
+		if (err < 0)
+			return err;
+		linepos = line;
+		line = end + 1;
+		while (*linepos != '\0') {
+			op = KEY_OP_UNSET;
+			if (get_key(&linepos, &key, &op, &value) < 0) {
+				rf->lines[rf->nlines - 1].status = RULE_INVALID;
+				break;
+			}
+			err = rule_file_add_key(rf, &ksize, key, op, value);
+			if (err < 0)
+				return err;
+		}
+		linenum += linenum_adj;
+	}
+	rf->textlen = line - rf->text;
+	return 0;
+}
+
+/* the parsed rule file, parse it when it is not known or it changed */
+static struct rule_file *rule_file_get(const char *filename, int *err)
+{
+	struct rule_file *rf, **prev;
+	struct stat st;
+	char *buf;
+	size_t bufsize;
+
+	if (stat(filename, &st) < 0) {
+		*err = -errno;
+		return NULL;
+	}
+	for (prev = &rule_files; *prev; prev = &(*prev)->next) {
+		rf = *prev;
+		if (strcmp(rf->filename, filename))
+			continue;
+		if (rf->mtime.tv_sec == st.st_mtim.tv_sec &&
+		    rf->mtime.tv_nsec == st.st_mtim.tv_nsec &&
+		    rf->size == st.st_size)
+			return rf;
+		*prev = rf->next;
+		if (rf->users > 0)
+			rf->stale = true;
+		else
+			rule_file_free(rf);
+		break;
+	}
+
+	if (file_map(filename, &buf, &bufsize) != 0) {
+		*err = -errno;
+		return NULL;
+	}
+	rf = calloc(1, sizeof(*rf));
+	if (rf == NULL) {
+		*err = -ENOMEM;
+		goto _unmap;
+	}
+	rf->filename = strdup(filename);
+	if (rf->filename == NULL) {
+		*err = -ENOMEM;
+		goto _free;
+	}
+	rf->mtime = st.st_mtim;
+	rf->size = st.st_size;
+	*err = rule_file_compile(rf, buf, bufsize);
+	if (*err < 0)
+		goto _free;
+	file_unmap(buf, bufsize);
+	rf->next = rule_files;
+	rule_files = rf;
+	rule_files_changed = true;
+	return rf;
+
+ _free:
+	rule_file_free(rf);
+ _unmap:
+	file_unmap(buf, bufsize);
+	return NULL;
+}
+
+void init_rules_free(void)
+{
+	struct rule_file *rf;
+
+	while ((rf = rule_files) != NULL) {
+		rule_files = rf->next;
+		rule_file_free(rf);
+	}
+}
+
+/* parse the file and the files it includes, without running the rules */
+static int rules_prepare(const char *filename, int depth)
+{
+	struct rule_file *rf;
+	struct rule_key *key;
+	struct dirent **list;
+	struct stat st;
+	char string[PATH_SIZE], *rootdir;
+	unsigned int i;
+	int err, j, num, count;
+
+	if (depth > 16)
+		return -ELOOP;
+	rf = rule_file_get(filename, &err);
+	if (rf == NULL)
+		return err;
+	rootdir = new_root_dir(filename);
+	if (rootdir == NULL)
+		return -ENOMEM;
+	rf->users++;
+	for (i = 0, err = 0; i < rf->nkeys && err == 0; i++) {
+		key = &rf->keys[i];
+		if (strcasecmp(key->key, "INCLUDE") || key->op != KEY_OP_ASSIGN)
+			continue;
+		if (key->value[0] == '/') {
+			strlcpy(string, key->value, sizeof(string));
+		} else {
+			strlcpy(string, rootdir, sizeof(string));
+			strlcat(string, "/", sizeof(string));
+			strlcat(string, key->value, sizeof(string));
+		}
+		if (stat(string, &st))
+			continue;
+		if (!S_ISDIR(st.st_mode)) {
+			err = rules_prepare(string, depth + 1);
+			continue;
+		}
+		num = scandir(string, &list, conf_name_filter, alphasort);
+		if (num < 0)
+			continue;
+		count = strlen(string);
+		for (j = 0; j < num; j++) {
+			string[count] = '\0';
+			strlcat(string, "/", sizeof(string));
+			strlcat(string, list[j]->d_name, sizeof(string));
+			free(list[j]);
+			if (err == 0)
+				err = rules_prepare(string, depth + 1);
+		}
+		free(list);
+	}
+	if (--rf->users == 0 && rf->stale)
+		rule_file_free(rf);
+	free(rootdir);
+	return err;
+}
+
+int init_rules_prepare(const char *filename)
+{
+	return rules_prepare(filename, 0);
+}
+
+/*
+ * The rule cache keeps the parsed rule files in the configuration
+ * directory. A file is taken from the cache only when its modification
+ * time and size match, the others are parsed again.
+ */
+#define RULES_CACHE		"init-rules.cache"
+#define RULES_CACHE_MAGIC	"ALSRULES"
+#define RULES_CACHE_VERSION	1
+
+struct rules_cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t files;
+	uint32_t line_size;	/* sizeof(struct rule_line) */
+	uint32_t reserved;
+};
+
+struct rules_cache_file {
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	int64_t size;
+	uint32_t name_len;	/* including the terminating zero */
+	uint32_t text_len;
+	uint32_t nlines;
+	uint32_t nkeys;
+};
+
+/*
+ * A file is stored as struct rules_cache_file, the name, the text, the
+ * lines and the keys. Every part is padded to 8 bytes.
+ */
+#define RULES_CACHE_ALIGN(len)	(((len) + 7) & ~(size_t)7)
+
+/* the keys are stored as offsets to the text */
+struct rules_cache_key {
+	uint32_t key;
+	uint32_t value;
+	uint32_t op;
+};
+
+static void rules_cache_path(char *path, size_t size, const char *cfgdir)
+{
+	snprintf(path, size, "%s/" RULES_CACHE, cfgdir);
+}
+
+static struct rule_file *rule_file_find(const char *filename)
+{
+	struct rule_file *rf;
+
+	for (rf = rule_files; rf; rf = rf->next)
+		if (strcmp(rf->filename, filename) == 0)
+			return rf;
+	return NULL;
+}
+
+/* bounds checked read from the cache */
+static const void *cache_take(const char *buf, size_t size, size_t *pos,
+			      size_t len)
+{
+	const void *res;
+
+	len = RULES_CACHE_ALIGN(len);
+	if (len > size - *pos)
+		return NULL;
+	res = buf + *pos;
+	*pos += len;
+	return res;
+}
+
+static struct rule_file *rules_cache_file(const struct rules_cache_file *cf,
+					  const char *name, const char *text,
+					  const struct rule_line *lines,
+					  const struct rules_cache_key *keys)
+{
+	struct rule_file *rf;
+	unsigned int i;
+
+	rf = calloc(1, sizeof(*rf));
+	if (rf == NULL)
+		return NULL;
+	rf->filename = strdup(name);
+	rf->text = malloc(cf->text_len + 1);
+	rf->lines = malloc((cf->nlines + 1) * sizeof(*rf->lines));
+	rf->keys = malloc((cf->nkeys + 1) * sizeof(*rf->keys));
+	if (!rf->filename || !rf->text || !rf->lines || !rf->keys)
+		goto _free;
+	memcpy(rf->text, text, cf->text_len);
+	rf->text[cf->text_len] = '\0';
+	rf->textlen = cf->text_len;
+	rf->mtime.tv_sec = cf->mtime_sec;
+	rf->mtime.tv_nsec = cf->mtime_nsec;
+	rf->size = cf->size;
+	for (i = 0; i < cf->nlines; i++) {
+		rf->lines[i] = lines[i];
+		if (rf->lines[i].first > cf->nkeys ||
+		    rf->lines[i].count > cf->nkeys - rf->lines[i].first)
+			goto _free;
+	}
+	rf->nlines = cf->nlines;
+	for (i = 0; i < cf->nkeys; i++) {
+		if (keys[i].key >= cf->text_len ||
+		    keys[i].value >= cf->text_len ||
+		    keys[i].op > KEY_OP_ASSIGN_FINAL)
+			goto _free;
+		rf->keys[i].key = rf->text + keys[i].key;
+		rf->keys[i].value = rf->text + keys[i].value;
+		rf->keys[i].op = keys[i].op;
+	}
+	rf->nkeys = cf->nkeys;
+	return rf;
+
+ _free:
+	rule_file_free(rf);
+	return NULL;
+}
+
+int init_rules_load(const char *cfgdir)
+{
+	const struct rules_cache_header *hdr;
+	const struct rules_cache_file *cf;
+	const struct rule_line *lines;
+	const struct rules_cache_key *keys;
+	const char *name, *text;
+	struct rule_file *rf;
+	struct stat st;
+	char path[PATH_MAX], *buf;
+	size_t size, pos = 0;
+	unsigned int i, loaded = 0;
+	int err = 0;
+
+	rules_cache_path(path, sizeof(path), cfgdir);
+	if (file_map(path, &buf, &size) != 0)
+		return -errno;
+	hdr = cache_take(buf, size, &pos, sizeof(*hdr));
+	if (hdr == NULL || memcmp(hdr->magic, RULES_CACHE_MAGIC, 8) ||
+	    hdr->version != RULES_CACHE_VERSION ||
+	    hdr->line_size != sizeof(struct rule_line)) {
+		err = -EINVAL;
+		goto _unmap;
+	}
+	for (i = 0; i < hdr->files; i++) {
+		cf = cache_take(buf, size, &pos, sizeof(*cf));
+		if (cf == NULL)
+			break;
+		name = cache_take(buf, size, &pos, cf->name_len);
+		text = cache_take(buf, size, &pos, cf->text_len);
+		lines = cache_take(buf, size, &pos,
+				   (size_t)cf->nlines * sizeof(*lines));
+		keys = cache_take(buf, size, &pos,
+				  (size_t)cf->nkeys * sizeof(*keys));
+		if (!name || !text || !lines || !keys ||
+		    cf->name_len == 0 || name[cf->name_len - 1] != '\0') {
+			err = -EINVAL;
+			break;
+		}
+		if (rule_file_find(name))
+			continue;
+		if (stat(name, &st) < 0 ||
+		    st.st_mtim.tv_sec != cf->mtime_sec ||
+		    st.st_mtim.tv_nsec != cf->mtime_nsec ||
+		    st.st_size != cf->size) {
+			dbg("rule cache: '%s' changed", name);
+			continue;
+		}
+		rf = rules_cache_file(cf, name, text, lines, keys);
+		if (rf == NULL) {
+			err = -EINVAL;
+			break;
+		}
+		rf->next = rule_files;
+		rule_files = rf;
+		loaded++;
+	}
+	dbg("rule cache: %u of %u files loaded", loaded, hdr->files);
+
+ _unmap:
+	file_unmap(buf, size);
+	return err;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int write_padding(int fd, size_t len)
+{
+	static const char zero[8];
+
+	return write_all(fd, zero, RULES_CACHE_ALIGN(len) - len);
+}
+
+static int rules_cache_write(int fd, struct rule_file *rf)
+{
+	struct rules_cache_file cf;
+	struct rules_cache_key key;
+	unsigned int i;
+	int err;
+
+	memset(&cf, 0, sizeof(cf));
+	cf.mtime_sec = rf->mtime.tv_sec;
+	cf.mtime_nsec = rf->mtime.tv_nsec;
+	cf.size = rf->size;
+	cf.name_len = strlen(rf->filename) + 1;
+	cf.text_len = rf->textlen;
+	cf.nlines = rf->nlines;
+	cf.nkeys = rf->nkeys;
+	err = write_all(fd, &cf, sizeof(cf));
+	if (err >= 0)
+		err = write_all(fd, rf->filename, cf.name_len);
+	if (err >= 0)
+		err = write_padding(fd, cf.name_len);
+	if (err >= 0)
+		err = write_all(fd, rf->text, rf->textlen);
+	if (err >= 0)
+		err = write_padding(fd, rf->textlen);
+	if (err >= 0)
+		err = write_all(fd, rf->lines, rf->nlines * sizeof(*rf->lines));
+	if (err >= 0)
+		err = write_padding(fd, rf->nlines * sizeof(*rf->lines));
+	for (i = 0; err >= 0 && i < rf->nkeys; i++) {
+		key.key = rf->keys[i].key - rf->text;
+		key.value = rf->keys[i].value - rf->text;
+		key.op = rf->keys[i].op;
+		err = write_all(fd, &key, sizeof(key));
+	}
+	if (err >= 0)
+		err = write_padding(fd, rf->nkeys * sizeof(key));
+	return err;
+}
+
+int init_rules_save(const char *cfgdir)
+{
+	struct rules_cache_header hdr;
+	struct rule_file *rf;
+	char path[PATH_MAX], tmp[PATH_MAX];
+	int fd, err = 0;
+
+	rules_cache_path(path, sizeof(path), cfgdir);
+	/* a unique name, concurrent runs each write their own file */
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return -errno;
+	if (fchmod(fd, 0644) < 0) {
+		err = -errno;
+		close(fd);
+		unlink(tmp);
+		return err;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, RULES_CACHE_MAGIC, 8);
+	hdr.version = RULES_CACHE_VERSION;
+	hdr.line_size = sizeof(struct rule_line);
+	for (rf = rule_files; rf; rf = rf->next)
+		hdr.files++;
+	err = write_all(fd, &hdr, sizeof(hdr));
+	for (rf = rule_files; err >= 0 && rf; rf = rf->next)
+		err = rules_cache_write(fd, rf);
+	if (close(fd) < 0 && err >= 0)
+		err = -errno;
+	if (err >= 0 && rename(tmp, path) < 0)
+		err = -errno;
+	if (err < 0) {
+		unlink(tmp);
+		return err;
+	}
+	rule_files_changed = false;
+	return 0;
+}
+
+static int parse(struct space *space, const char *filename)
+{
+	struct rule_file *rf;
+	struct rule_line *rl;
+	unsigned int i;
+	int err;
+
+	dbg("start of file '%s'", filename);
+
+	rf = rule_file_get(filename, &err);
+	if (rf == NULL) {
+		error("Unable to open file '%s': %s", filename, strerror(-err));
+		return err;
+	}
+
+	err = 0;
+	rf->users++;
+	space->filename = filename;
+	for (i = 0; !err && i < rf->nlines && !space->quit; i++) {
+		rl = &rf->lines[i];
+		if (rl->status == RULE_TOO_LONG) {
+			error("file %s, line %i too long", filename, rl->linenum);
+			err = -EINVAL;
+			break;
+		}
+		space->linenum = rl->linenum;
+		err = parse_line(space, rf, rl);
 		if (err == -EJUSTRETURN) {
 			err = 0;
 			break;
 		}
-		linenum += linenum_adj;
 	}
 
-	free(line);
+	if (--rf->users == 0 && rf->stale)
+		rule_file_free(rf);
 	space->filename = NULL;
 	space->linenum = -1;
-	file_unmap(buf, bufsize);
 	dbg("end of file '%s'", filename);
 	return err ? err : -abs(space->exit_code);
 }
@@ -1747,13 +2300,20 @@ int init(const char *cfgdir, const char *filename, int flags, const char *cardna
 {
 	struct space *space;
 	struct snd_card_iterator iter;
-	int err = 0, lasterr = 0;
+	struct timespec start, end;
+	int err = 0, lasterr = 0, cache_err;
 	
 	sysfs_init();
+	if (use_cache && rule_files == NULL) {
+		cache_err = init_rules_load(cfgdir);
+		if (cache_err < 0)
+			dbg("rule cache not loaded: %s", strerror(-cache_err));
+	}
 	err = snd_card_iterator_sinit(&iter, cardname);
 	if (err < 0)
 		goto out;
 	while (snd_card_iterator_next(&iter)) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
 		err = snd_card_clean_cfgdir(cfgdir, iter.card);
 		if (err < 0) {
 			if (lasterr == 0)
@@ -1776,11 +2336,20 @@ int init(const char *cfgdir, const char *filename, int flags, const char *cardna
 			}
 		}
 		free_space(space);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		dbg("card %i initialized in %ld us", iter.card,
+		    (long)((end.tv_sec - start.tv_sec) * 1000000 +
+			   (end.tv_nsec - start.tv_nsec) / 1000));
 		if (err < 0)
 			goto out;
 	}
 	err = lasterr ? lasterr : snd_card_iterator_error(&iter);
 out:
+	if (use_cache && rule_files_changed) {
+		cache_err = init_rules_save(cfgdir);
+		if (cache_err < 0)
+			dbg("rule cache not saved: %s", strerror(-cache_err));
+	}
 	sysfs_cleanup();
 	return err;
 }
@@ -20,21 +20,39 @@
 
 static char sysfs_path[PATH_SIZE];
 
-/* attribute value cache */
-static LIST_HEAD(attr_list);
+/* attribute value cache, hashed by the path */
+#define ATTR_HASH	64
+
 struct sysfs_attr {
-	struct list_head node;
+	struct sysfs_attr *next;
 	char path[PATH_SIZE];
+	bool read;			/* value is valid */
 	char *value;			/* points to value_local if value is cached */
 	char value_local[NAME_SIZE];
 };
 
+static struct sysfs_attr *attr_hash[ATTR_HASH];
+
+/*
+ * The directories listed with one scan. The attributes found there are
+ * added to the cache and read on the first use, the missing ones are
+ * known without a system call.
+ */
+struct sysfs_dir {
+	struct sysfs_dir *next;
+	bool listed;			/* false if the scan failed */
+	char path[PATH_SIZE];
+};
+
+static struct sysfs_dir *dir_list;
+
 static int sysfs_init(void)
 {
 	const char *env;
 	char sysfs_test[PATH_SIZE];
 
-	INIT_LIST_HEAD(&attr_list);
+	memset(attr_hash, 0, sizeof(attr_hash));
+	dir_list = NULL;
 
 	env = getenv("SYSFS_PATH");
 	if (env) {
@@ -60,13 +78,113 @@ static int sysfs_init(void)
 
 static void sysfs_cleanup(void)
 {
-	struct sysfs_attr *attr_loop;
-	struct sysfs_attr *attr_temp;
+	struct sysfs_attr *attr, *attr_next;
+	struct sysfs_dir *dir, *dir_next;
+	int i;
 
-	list_for_each_entry_safe(attr_loop, attr_temp, &attr_list, node) {
-		list_del(&attr_loop->node);
-		free(attr_loop);
+	for (i = 0; i < ATTR_HASH; i++) {
+		for (attr = attr_hash[i]; attr; attr = attr_next) {
+			attr_next = attr->next;
+			free(attr);
+		}
+		attr_hash[i] = NULL;
 	}
+	for (dir = dir_list; dir; dir = dir_next) {
+		dir_next = dir->next;
+		free(dir);
+	}
+	dir_list = NULL;
+}
+
+static unsigned int sysfs_hash(const char *path)
+{
+	unsigned int hash = 0;
+
+	while (*path)
+		hash = hash * 31 + (unsigned char)*path++;
+	return hash % ATTR_HASH;
+}
+
+static struct sysfs_attr *sysfs_attr_find(const char *path)
+{
+	struct sysfs_attr *attr;
+
+	for (attr = attr_hash[sysfs_hash(path)]; attr; attr = attr->next)
+		if (strcmp(attr->path, path) == 0)
+			return attr;
+	return NULL;
+}
+
+static struct sysfs_attr *sysfs_attr_add(const char *path)
+{
+	struct sysfs_attr *attr;
+	unsigned int hash = sysfs_hash(path);
+
+	attr = calloc(1, sizeof(struct sysfs_attr));
+	if (attr == NULL)
+		return NULL;
+	strlcpy(attr->path, path, sizeof(attr->path));
+	attr->next = attr_hash[hash];
+	attr_hash[hash] = attr;
+	return attr;
+}
+
+/* list the directory of the attribute path once */
+static struct sysfs_dir *sysfs_scan_dir(const char *path)
+{
+	char dir_full[PATH_SIZE];
+	char attr_path[PATH_SIZE];
+	struct sysfs_dir *dir;
+	struct sysfs_attr *attr;
+	struct dirent *dent;
+	const char *pos;
+	size_t len;
+	DIR *d;
+
+	pos = strrchr(path, '/');
+	if (pos == NULL)
+		return NULL;
+	len = pos - path;
+	for (dir = dir_list; dir; dir = dir->next)
+		if (strncmp(dir->path, path, len) == 0 && dir->path[len] == '\0')
+			return dir;
+
+	dir = calloc(1, sizeof(*dir));
+	if (dir == NULL)
+		return NULL;
+	if (len >= sizeof(dir->path))
+		len = sizeof(dir->path) - 1;
+	memcpy(dir->path, path, len);
+	dir->path[len] = '\0';
+	dir->next = dir_list;
+	dir_list = dir;
+
+	strlcpy(dir_full, sysfs_path, sizeof(dir_full));
+	strlcat(dir_full, dir->path, sizeof(dir_full));
+	d = opendir(dir_full);
+	if (d == NULL) {
+		dbg("scan '%s' failed: %s", dir_full, strerror(errno));
+		return dir;
+	}
+	while ((dent = readdir(d)) != NULL) {
+		if (dent->d_name[0] == '.')
+			continue;
+		strlcpy(attr_path, dir->path, sizeof(attr_path));
+		strlcat(attr_path, "/", sizeof(attr_path));
+		strlcat(attr_path, dent->d_name, sizeof(attr_path));
+		if (sysfs_attr_find(attr_path))
+			continue;
+		attr = sysfs_attr_add(attr_path);
+		if (attr == NULL)
+			break;
+		/* directories have no value */
+		if (dent->d_type == DT_DIR)
+			attr->read = true;
+	}
+	closedir(d);
+	dir->listed = true;
+	dbg("scanned '%s'", dir_full);
+	return dir;
 }
 
 static char *sysfs_attr_get_value(const char *devpath, const char *attr_name)
@@ -74,8 +192,8 @@ static char *sysfs_attr_get_value(const char *devpath, const char *attr_name)
 	char path_full[PATH_SIZE];
 	const char *path;
 	char value[NAME_SIZE];
-	struct sysfs_attr *attr_loop;
 	struct sysfs_attr *attr;
+	struct sysfs_dir *dir;
 	struct stat statbuf;
 	int fd;
 	ssize_t size;
@@ -89,22 +207,29 @@ static char *sysfs_attr_get_value(const char *devpath, const char *attr_name)
 	strlcat(path_full, attr_name, sizeof(path_full));
 
 	/* look for attribute in cache */
-	list_for_each_entry(attr_loop, &attr_list, node) {
-		if (strcmp(attr_loop->path, path) == 0) {
-			dbg("found in cache '%s'", attr_loop->path);
-			return attr_loop->value;
+	attr = sysfs_attr_find(path);
+	if (attr == NULL) {
+		dir = sysfs_scan_dir(path);
+		attr = sysfs_attr_find(path);
+		if (attr == NULL) {
+			/* also negatives are kept in cache */
+			attr = sysfs_attr_add(path);
+			if (attr == NULL)
+				return NULL;
+			if (dir && dir->listed) {
+				dbg("'%s' is not in the directory", path_full);
+				attr->read = true;
+			}
 		}
 	}
+	if (attr->read) {
+		dbg("found in cache '%s'", attr->path);
+		return attr->value;
+	}
 
-	/* store attribute in cache (also negatives are kept in cache) */
+	/* store attribute value in cache */
 	dbg("new uncached attribute '%s'", path_full);
-	attr = malloc(sizeof(struct sysfs_attr));
-	if (attr == NULL)
-		return NULL;
-	memset(attr, 0x00, sizeof(struct sysfs_attr));
-	strlcpy(attr->path, path, sizeof(attr->path));
-	dbg("add to cache '%s'", path_full);
-	list_add(&attr->node, &attr_list);
+	attr->read = true;
 
 	if (lstat(path_full, &statbuf) != 0) {
 		dbg("stat '%s' failed: %s", path_full, strerror(errno));
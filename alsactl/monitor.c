@@ -30,6 +30,7 @@
 #include <sys/signalfd.h>
 
 #include <stddef.h>
+#include <stdint.h>
 #include "list.h"
 
 #include "alsactl.h"
@@ -41,6 +42,62 @@ struct src_entry {
 	struct list_head list;
 };
 
+enum {
+	FORMAT_TEXT,
+	FORMAT_JSON,
+	FORMAT_BINARY,
+};
+
+/* an element event, or the merged events of one element */
+struct pending {
+	struct pending *hnext;		/* in the hash bucket */
+	struct pending *next;		/* in the order of arrival */
+	struct src_entry *src;
+	unsigned int numid;
+	int iface;
+	int device;
+	int subdevice;
+	int index;
+	char name[44];
+	unsigned int mask;
+	unsigned int count;		/* merged events */
+	struct timespec time;		/* of the last event */
+};
+
+#define PENDING_HASH	256
+#define PENDING_MAX	4096
+
+struct monitor {
+	int coalesce;			/* in ms, 0 to write every event */
+	int format;
+	struct pending *hash[PENDING_HASH];
+	struct pending *first;
+	struct pending **last;
+	unsigned int pending;
+	struct timespec deadline;
+	unsigned long events;		/* read from the devices */
+	unsigned long coalesced;	/* merged to an earlier event */
+	unsigned long dropped;		/* lost by a failed write */
+	unsigned long unflushed;	/* written to the buffer */
+};
+
+/*
+ * The record of the binary format, in the host byte order. The strings
+ * are padded with zeros.
+ */
+struct monitor_record {
+	uint64_t time_ns;		/* CLOCK_REALTIME */
+	uint32_t numid;
+	uint32_t mask;			/* SND_CTL_EVENT_MASK_* */
+	uint32_t count;
+	int32_t iface;
+	int32_t device;
+	int32_t subdevice;
+	int32_t index;
+	char card[16];
+	char name[44];
+};
+
 static void remove_source_entry(struct src_entry *entry)
 {
 	list_del(&entry->list);
@@ -101,7 +158,7 @@ static int open_ctl(const char *name, snd_ctl_t **ctlp)
 	snd_ctl_t *ctl;
 	int err;
 
-	err = snd_ctl_open(&ctl, name, SND_CTL_READONLY);
+	err = snd_ctl_open(&ctl, name, SND_CTL_READONLY | SND_CTL_NONBLOCK);
 	if (err < 0) {
 		fprintf(stderr, "Cannot open ctl %s\n", name);
 		return err;
@@ -197,46 +254,243 @@ static int check_control_cdev(int infd, bool *retry)
 	return err;
 }
 
-static int print_event(snd_ctl_t *ctl, const char *name)
+static void print_mask_text(unsigned int mask)
 {
-	snd_ctl_event_t *event;
-	unsigned int mask;
-	int err;
-
-	snd_ctl_event_alloca(&event);
-	err = snd_ctl_read(ctl, event);
-	if (err < 0)
-		return err;
-
-	if (snd_ctl_event_get_type(event) != SND_CTL_EVENT_ELEM)
-		return 0;
-
-	printf("node %s, #%d (%i,%i,%i,%s,%i)",
-	       name,
-	       snd_ctl_event_elem_get_numid(event),
-	       snd_ctl_event_elem_get_interface(event),
-	       snd_ctl_event_elem_get_device(event),
-	       snd_ctl_event_elem_get_subdevice(event),
-	       snd_ctl_event_elem_get_name(event),
-	       snd_ctl_event_elem_get_index(event));
-
-	mask = snd_ctl_event_elem_get_mask(event);
 	if (mask == SND_CTL_EVENT_MASK_REMOVE) {
-		printf(" REMOVE\n");
-		return 0;
+		fputs(" REMOVE", stdout);
+		return;
 	}
-
 	if (mask & SND_CTL_EVENT_MASK_VALUE)
-		printf(" VALUE");
+		fputs(" VALUE", stdout);
 	if (mask & SND_CTL_EVENT_MASK_INFO)
-		printf(" INFO");
+		fputs(" INFO", stdout);
 	if (mask & SND_CTL_EVENT_MASK_ADD)
-		printf(" ADD");
+		fputs(" ADD", stdout);
 	if (mask & SND_CTL_EVENT_MASK_TLV)
-		printf(" TLV");
-	printf("\n");
-	fflush(stdout);
-	return 0;
+		fputs(" TLV", stdout);
+}
+
+static void print_mask_json(unsigned int mask)
+{
+	static const struct {
+		unsigned int mask;
+		const char *name;
+	} names[] = {
+		{ SND_CTL_EVENT_MASK_VALUE, "VALUE" },
+		{ SND_CTL_EVENT_MASK_INFO, "INFO" },
+		{ SND_CTL_EVENT_MASK_ADD, "ADD" },
+		{ SND_CTL_EVENT_MASK_TLV, "TLV" },
+	};
+	const char *sep = "";
+	unsigned int i;
+
+	if (mask == SND_CTL_EVENT_MASK_REMOVE) {
+		fputs("[\"REMOVE\"]", stdout);
+		return;
+	}
+	putchar('[');
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (mask & names[i].mask) {
+			printf("%s\"%s\"", sep, names[i].name);
+			sep = ",";
+		}
+	}
+	putchar(']');
+}
+
+static void print_string_json(const char *s)
+{
+	putchar('"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			printf("\\u%04x", *s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+static void write_event(struct monitor *mon, struct pending *ev)
+{
+	struct monitor_record rec;
+
+	switch (mon->format) {
+	case FORMAT_JSON:
+		fputs("{\"card\":", stdout);
+		print_string_json(ev->src->name);
+		printf(",\"numid\":%u,\"iface\":%i,\"device\":%i,"
+		       "\"subdevice\":%i,\"name\":",
+		       ev->numid, ev->iface, ev->device, ev->subdevice);
+		print_string_json(ev->name);
+		printf(",\"index\":%i,\"mask\":", ev->index);
+		print_mask_json(ev->mask);
+		printf(",\"count\":%u,\"time\":%lld.%06ld}\n", ev->count,
+		       (long long)ev->time.tv_sec, ev->time.tv_nsec / 1000);
+		break;
+	case FORMAT_BINARY:
+		memset(&rec, 0, sizeof(rec));
+		rec.time_ns = (uint64_t)ev->time.tv_sec * 1000000000 +
+			      ev->time.tv_nsec;
+		rec.numid = ev->numid;
+		rec.mask = ev->mask;
+		rec.count = ev->count;
+		rec.iface = ev->iface;
+		rec.device = ev->device;
+		rec.subdevice = ev->subdevice;
+		rec.index = ev->index;
+		strncpy(rec.card, ev->src->name, sizeof(rec.card) - 1);
+		memcpy(rec.name, ev->name, sizeof(rec.name));
+		fwrite(&rec, sizeof(rec), 1, stdout);
+		break;
+	default:
+		printf("node %s, #%d (%i,%i,%i,%s,%i)",
+		       ev->src->name, ev->numid, ev->iface, ev->device,
+		       ev->subdevice, ev->name, ev->index);
+		print_mask_text(ev->mask);
+		if (ev->count > 1)
+			printf(" (%u events)", ev->count);
+		putchar('\n');
+		break;
+	}
+	mon->unflushed += ev->count;
+}
+
+/* the events lost in a failed write are counted as dropped */
+static void flush_output(struct monitor *mon)
+{
+	if (fflush(stdout) == EOF) {
+		mon->dropped += mon->unflushed;
+		clearerr(stdout);
+	}
+	mon->unflushed = 0;
+}
+
+static void flush_pending(struct monitor *mon)
+{
+	struct pending *ev, *next;
+
+	for (ev = mon->first; ev; ev = next) {
+		next = ev->next;
+		write_event(mon, ev);
+		free(ev);
+	}
+	memset(mon->hash, 0, sizeof(mon->hash));
+	mon->first = NULL;
+	mon->last = &mon->first;
+	mon->pending = 0;
+}
+
+static void print_counters(struct monitor *mon)
+{
+	fprintf(stderr, "events %lu, coalesced %lu, dropped %lu\n",
+		mon->events, mon->coalesced, mon->dropped);
+}
+
+static void add_pending(struct monitor *mon, struct pending *ev)
+{
+	struct pending *p, **bucket;
+	struct timespec now;
+
+	bucket = &mon->hash[(ev->numid ^ (uintptr_t)ev->src >> 4) %
+			   PENDING_HASH];
+	for (p = *bucket; p; p = p->hnext) {
+		if (p->src != ev->src || p->numid != ev->numid)
+			continue;
+		/* a removed element may come back with the same numid */
+		if (ev->mask == SND_CTL_EVENT_MASK_REMOVE ||
+		    p->mask == SND_CTL_EVENT_MASK_REMOVE)
+			p->mask = ev->mask;
+		else
+			p->mask |= ev->mask;
+		p->count++;
+		p->time = ev->time;
+		mon->coalesced++;
+		return;
+	}
+
+	if (mon->pending >= PENDING_MAX)
+		flush_pending(mon);
+	p = malloc(sizeof(*p));
+	if (p == NULL) {
+		write_event(mon, ev);
+		return;
+	}
+	*p = *ev;
+	p->hnext = *bucket;
+	*bucket = p;
+	p->next = NULL;
+	*mon->last = p;
+	mon->last = &p->next;
+	if (mon->pending++ == 0) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		mon->deadline.tv_sec = now.tv_sec + mon->coalesce / 1000;
+		mon->deadline.tv_nsec = now.tv_nsec +
+					(mon->coalesce % 1000) * 1000000;
+		if (mon->deadline.tv_nsec >= 1000000000) {
+			mon->deadline.tv_sec++;
+			mon->deadline.tv_nsec -= 1000000000;
+		}
+	}
+}
+
+/* the epoll timeout until the pending events are written */
+static int pending_timeout(struct monitor *mon)
+{
+	struct timespec now;
+	long long ms;
+
+	if (mon->pending == 0)
+		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (mon->deadline.tv_sec - now.tv_sec) * 1000LL +
+	     (mon->deadline.tv_nsec - now.tv_nsec + 999999) / 1000000;
+	return ms > 0 ? ms : 0;
+}
+
+static int read_events(struct monitor *mon, struct src_entry *entry)
+{
+	snd_ctl_event_t *event;
+	struct pending ev;
+	int err;
+
+	snd_ctl_event_alloca(&event);
+	memset(&ev, 0, sizeof(ev));
+	ev.src = entry;
+	ev.count = 1;
+	while ((err = snd_ctl_read(entry->handle, event)) > 0) {
+		if (snd_ctl_event_get_type(event) != SND_CTL_EVENT_ELEM)
+			continue;
+		mon->events++;
+		ev.numid = snd_ctl_event_elem_get_numid(event);
+		ev.iface = snd_ctl_event_elem_get_interface(event);
+		ev.device = snd_ctl_event_elem_get_device(event);
+		ev.subdevice = snd_ctl_event_elem_get_subdevice(event);
+		ev.index = snd_ctl_event_elem_get_index(event);
+		snprintf(ev.name, sizeof(ev.name), "%s",
+			 snd_ctl_event_elem_get_name(event));
+		ev.mask = snd_ctl_event_elem_get_mask(event);
+		clock_gettime(CLOCK_REALTIME, &ev.time);
+		if (mon->coalesce > 0)
+			add_pending(mon, &ev);
+		else
+			write_event(mon, &ev);
+	}
+	return err == -EAGAIN ? 0 : err;
+}
+
+/* SIGUSR1 reports the counters, the other signals quit */
+static bool check_signal(struct monitor *mon, int sigfd)
+{
+	struct signalfd_siginfo info;
+
+	if (read(sigfd, &info, sizeof(info)) != sizeof(info))
+		return false;
+	if (info.ssi_signo != SIGUSR1)
+		return false;
+	print_counters(mon);
+	return true;
 }
 
 static int operate_dispatcher(int epfd, uint32_t op, struct epoll_event *epev,
@@ -299,15 +553,16 @@ static int prepare_dispatcher(int epfd, int sigfd, int infd,
 	return err;
 }
 
-static int run_dispatcher(int epfd, int sigfd, int infd, struct list_head *srcs,
-			  bool *retry)
+static int run_dispatcher(struct monitor *mon, int epfd, int sigfd, int infd,
+			  struct list_head *srcs, bool *retry)
 {
 	struct src_entry *entry;
 	unsigned int max_ev_count;
 	struct epoll_event *epev;
 	int err = 0;
 
-	max_ev_count = 0;
+	/* the signal and the inotify descriptors */
+	max_ev_count = 2;
 	list_for_each_entry(entry, srcs, list)
 		max_ev_count += entry->pfd_count;
 
@@ -319,21 +574,23 @@ static int run_dispatcher(int epfd, int sigfd, int infd, struct list_head *srcs,
 		int count;
 		int i;
 
-		count = epoll_wait(epfd, epev, max_ev_count, -1);
+		count = epoll_wait(epfd, epev, max_ev_count,
+				   pending_timeout(mon));
 		if (count < 0) {
 			if (errno == EINTR)
 				continue;
-			err = count;
+			err = -errno;
 			break;
 		}
-		if (count == 0)
-			continue;
 
 		for (i = 0; i < count; ++i) {
 			struct epoll_event *ev = epev + i;
 
-			if (ev->data.fd == sigfd)
+			if (ev->data.fd == sigfd) {
+				if (check_signal(mon, sigfd))
+					continue;
 				goto end;
+			}
 
 			if (ev->data.fd == infd) {
 				err = check_control_cdev(infd, retry);
@@ -344,14 +601,21 @@ static int run_dispatcher(int epfd, int sigfd, int infd, struct list_head *srcs,
 
 			entry = ev->data.ptr;
 			if (ev->events & EPOLLIN)
-				print_event(entry->handle, entry->name);
+				read_events(mon, entry);
 			if (ev->events & EPOLLERR) {
+				/* the pending events refer to the entry */
+				flush_pending(mon);
 				operate_dispatcher(epfd, EPOLL_CTL_DEL, NULL, entry);
 				remove_source_entry(entry);
 			}
 		}
+		if (pending_timeout(mon) == 0)
+			flush_pending(mon);
+		flush_output(mon);
 	}
 end:
+	flush_pending(mon);
+	flush_output(mon);
 	free(epev);
 	return err;
 }
@@ -377,6 +641,7 @@ static int prepare_signalfd(int *sigfd)
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGINT);
 	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR1);
 
 	if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
 		return -errno;
@@ -389,9 +654,22 @@ static int prepare_signalfd(int *sigfd)
 	return 0;
 }
 
-int monitor(const char *name)
+static int parse_format(const char *format)
+{
+	if (format == NULL || strcmp(format, "text") == 0)
+		return FORMAT_TEXT;
+	if (strcmp(format, "json") == 0)
+		return FORMAT_JSON;
+	if (strcmp(format, "binary") == 0)
+		return FORMAT_BINARY;
+	return -EINVAL;
+}
+
+int monitor(const char *name, int coalesce, const char *format)
 {
 	LIST_HEAD(srcs);
+	static char buf[64 * 1024];
+	struct monitor mon = { .coalesce = coalesce };
 	int sigfd = 0;
 	int epfd;
 	int infd;
@@ -399,6 +677,15 @@ int monitor(const char *name)
 	bool retry;
 	int err = 0;
 
+	mon.format = parse_format(format);
+	if (mon.format < 0) {
+		error("Unknown monitor format '%s'", format);
+		return mon.format;
+	}
+	mon.last = &mon.first;
+	/* the output is flushed after every batch of events */
+	setvbuf(stdout, buf, _IOFBF, sizeof(buf));
+
 	err = prepare_signalfd(&sigfd);
 	if (err < 0)
 		return err;
@@ -427,7 +714,7 @@ retry:
 
 	err = prepare_dispatcher(epfd, sigfd, infd, &srcs);
 	if (err >= 0)
-		err = run_dispatcher(epfd, sigfd, infd, &srcs, &retry);
+		err = run_dispatcher(&mon, epfd, sigfd, infd, &srcs, &retry);
 	clear_dispatcher(epfd, sigfd, infd, &srcs);
 
 	if (retry) {
@@ -439,6 +726,7 @@ retry:
 	}
 error:
 	clear_source_list(&srcs);
+	print_counters(&mon);
 
 	if (wd > 0)
 		inotify_rm_watch(infd, wd);
@@ -27,6 +27,8 @@
 #include <stdio.h>
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
+#include <signal.h>
 #include "alsactl.h"
 
 
@@ -1201,8 +1203,181 @@ static int restore_config_value2(snd_ctl_t *handle, snd_ctl_elem_info_t *info,
 	return 0;
 }
 
-static int set_control(snd_ctl_t *handle, snd_config_t *control,
-		       int *maxnumid, int doit)
+/*
+ * The controls of the card are listed once per restore and the saved
+ * controls are resolved against this list, so only the controls which
+ * exist are queried and the name lookups do not need an ioctl.
+ */
+struct ctl_plan {
+	snd_ctl_elem_list_t *list;
+	unsigned int count;
+	unsigned int *numid;		/* numid to list index + 1 */
+	unsigned int numids;
+	unsigned int *head;		/* id hash to list index + 1 */
+	unsigned int *next;
+	unsigned int mask;
+	unsigned char *flags;
+};
+
+#define PLAN_SEEN	(1<<0)		/* info is obtained */
+#define PLAN_READABLE	(1<<1)
+
+static unsigned int plan_hash(int iface, long device, long subdevice,
+			      const char *name, long index)
+{
+	unsigned int hash = 2166136261u;
+
+	hash = (hash ^ iface) * 16777619u;
+	hash = (hash ^ device) * 16777619u;
+	hash = (hash ^ subdevice) * 16777619u;
+	hash = (hash ^ index) * 16777619u;
+	while (*name)
+		hash = (hash ^ (unsigned char)*name++) * 16777619u;
+	return hash;
+}
+
+static void plan_free(struct ctl_plan *plan)
+{
+	if (plan->list) {
+		snd_ctl_elem_list_free_space(plan->list);
+		snd_ctl_elem_list_free(plan->list);
+	}
+	free(plan->numid);
+	free(plan->head);
+	free(plan->next);
+	free(plan->flags);
+	memset(plan, 0, sizeof(*plan));
+}
+
+static int plan_build(snd_ctl_t *handle, struct ctl_plan *plan)
+{
+	unsigned int idx, numid, count, hash;
+	int err;
+
+	plan_free(plan);
+	err = snd_ctl_elem_list_malloc(&plan->list);
+	if (err < 0)
+		return err;
+	err = snd_ctl_elem_list(handle, plan->list);
+	if (err < 0)
+		goto _err;
+	count = snd_ctl_elem_list_get_count(plan->list);
+	if (count > 0) {
+		err = snd_ctl_elem_list_alloc_space(plan->list, count);
+		if (err < 0)
+			goto _err;
+		err = snd_ctl_elem_list(handle, plan->list);
+		if (err < 0)
+			goto _err;
+	}
+	count = snd_ctl_elem_list_get_used(plan->list);
+	plan->count = count;
+
+	for (plan->mask = 15; plan->mask < count; plan->mask = plan->mask * 2 + 1)
+		;
+	plan->head = calloc(plan->mask + 1, sizeof(*plan->head));
+	plan->next = calloc(count + 1, sizeof(*plan->next));
+	plan->flags = calloc(count + 1, 1);
+	for (idx = 0; idx < count; idx++) {
+		numid = snd_ctl_elem_list_get_numid(plan->list, idx);
+		if (numid >= plan->numids)
+			plan->numids = numid + 1;
+	}
+	plan->numid = calloc(plan->numids + 1, sizeof(*plan->numid));
+	if (!plan->head || !plan->next || !plan->flags || !plan->numid) {
+		err = -ENOMEM;
+		goto _err;
+	}
+	for (idx = 0; idx < count; idx++) {
+		numid = snd_ctl_elem_list_get_numid(plan->list, idx);
+		plan->numid[numid] = idx + 1;
+		hash = plan_hash(snd_ctl_elem_list_get_interface(plan->list, idx),
+				 snd_ctl_elem_list_get_device(plan->list, idx),
+				 snd_ctl_elem_list_get_subdevice(plan->list, idx),
+				 snd_ctl_elem_list_get_name(plan->list, idx),
+				 snd_ctl_elem_list_get_index(plan->list, idx));
+		plan->next[idx] = plan->head[hash & plan->mask];
+		plan->head[hash & plan->mask] = idx + 1;
+	}
+	return 0;
+
+ _err:
+	plan_free(plan);
+	return err;
+}
+
+static int plan_find_numid(struct ctl_plan *plan, unsigned int numid)
+{
+	if (numid >= plan->numids)
+		return -1;
+	return (int)plan->numid[numid] - 1;
+}
+
+static int plan_find_id(struct ctl_plan *plan, int iface, long device,
+			long subdevice, const char *name, long index)
+{
+	snd_ctl_elem_list_t *list = plan->list;
+	unsigned int idx;
+
+	idx = plan->head[plan_hash(iface, device, subdevice, name, index) &
+			 plan->mask];
+	for (; idx; idx = plan->next[idx - 1]) {
+		if ((int)snd_ctl_elem_list_get_interface(list, idx - 1) == iface &&
+		    snd_ctl_elem_list_get_device(list, idx - 1) == device &&
+		    snd_ctl_elem_list_get_subdevice(list, idx - 1) == subdevice &&
+		    snd_ctl_elem_list_get_index(list, idx - 1) == index &&
+		    strcmp(snd_ctl_elem_list_get_name(list, idx - 1), name) == 0)
+			return idx - 1;
+	}
+	return -1;
+}
+
+/* compare only the used part of the values */
+static int value_equal(snd_ctl_elem_value_t *a, snd_ctl_elem_value_t *b,
+		       snd_ctl_elem_type_t type, unsigned int count)
+{
+	snd_aes_iec958_t iec1, iec2;
+	unsigned int idx;
+
+	switch (type) {
+	case SND_CTL_ELEM_TYPE_BOOLEAN:
+	case SND_CTL_ELEM_TYPE_INTEGER:
+		for (idx = 0; idx < count; idx++)
+			if (snd_ctl_elem_value_get_integer(a, idx) !=
+			    snd_ctl_elem_value_get_integer(b, idx))
+				return 0;
+		return 1;
+	case SND_CTL_ELEM_TYPE_INTEGER64:
+		for (idx = 0; idx < count; idx++)
+			if (snd_ctl_elem_value_get_integer64(a, idx) !=
+			    snd_ctl_elem_value_get_integer64(b, idx))
+				return 0;
+		return 1;
+	case SND_CTL_ELEM_TYPE_ENUMERATED:
+		for (idx = 0; idx < count; idx++)
+			if (snd_ctl_elem_value_get_enumerated(a, idx) !=
+			    snd_ctl_elem_value_get_enumerated(b, idx))
+				return 0;
+		return 1;
+	case SND_CTL_ELEM_TYPE_BYTES:
+		return memcmp(snd_ctl_elem_value_get_bytes(a),
+			      snd_ctl_elem_value_get_bytes(b), count) == 0;
+	case SND_CTL_ELEM_TYPE_IEC958:
+		snd_ctl_elem_value_get_iec958(a, &iec1);
+		snd_ctl_elem_value_get_iec958(b, &iec2);
+		return memcmp(&iec1, &iec2, sizeof(iec1)) == 0;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Restore one control of the saved tree. With values, the parsed value
+ * goes to the binary cache instead of the card.
+ */
+static int set_control(snd_ctl_t *handle, struct ctl_plan *plan,
+		       snd_config_t *control, int *maxnumid, int doit,
+		       struct cache_values *values)
 {
 	snd_ctl_elem_value_t *ctl;
 	snd_ctl_elem_info_t *info;
@@ -1227,8 +1402,13 @@ static int set_control(snd_ctl_t *handle, snd_config_t *control,
 	int err;
 	char *set;
 	const char *id;
+	snd_ctl_elem_value_t *cur;
+	snd_ctl_elem_id_t *elem_id;
+	int pidx;
 	snd_ctl_elem_value_alloca(&ctl);
+	snd_ctl_elem_value_alloca(&cur);
 	snd_ctl_elem_info_alloca(&info);
+	snd_ctl_elem_id_alloca(&elem_id);
 	if (snd_config_get_type(control) != SND_CONFIG_TYPE_COMPOUND) {
 		cerror(doit, "control is not a compound");
 		return -EINVAL;
@@ -1313,26 +1493,40 @@ static int set_control(snd_ctl_t *handle, snd_config_t *control,
 	if (index < 0)
 		index = 0;
 
-	err = -EINVAL;
-	if (!force_restore) {
-		snd_ctl_elem_info_set_numid(info, numid);
+	err = -ENOENT;
+	pidx = -1;
+	if (!force_restore)
+		pidx = plan_find_numid(plan, numid);
+	if (pidx < 0 && name)
+		pidx = plan_find_id(plan, iface, device, subdevice, name, index);
+	if (pidx >= 0) {
+		snd_ctl_elem_list_get_id(plan->list, pidx, elem_id);
+		snd_ctl_elem_info_set_id(info, elem_id);
 		err = snd_ctl_elem_info(handle, info);
-	}
-	if (err < 0 && name) {
+		if (err == 0) {
+			plan->flags[pidx] |= PLAN_SEEN;
+			if (snd_ctl_elem_info_is_readable(info))
+				plan->flags[pidx] |= PLAN_READABLE;
+		}
+	} else if (!values && name && comment &&
+		   check_comment_access(comment, "user")) {
 		snd_ctl_elem_info_set_numid(info, 0);
 		snd_ctl_elem_info_set_interface(info, iface);
 		snd_ctl_elem_info_set_device(info, device);
 		snd_ctl_elem_info_set_subdevice(info, subdevice);
 		snd_ctl_elem_info_set_name(info, name);
 		snd_ctl_elem_info_set_index(info, index);
-		err = snd_ctl_elem_info(handle, info);
-		if (err < 0 && comment && check_comment_access(comment, "user")) {
-			err = add_user_control(handle, info, comment);
-			if (err < 0) {
-				cerror(doit, "failed to add user control #%d (%s)",
-				       numid, snd_strerror(err));
-				return err;
-			}
+		err = add_user_control(handle, info, comment);
+		if (err < 0) {
+			cerror(doit, "failed to add user control #%d (%s)",
+			       numid, snd_strerror(err));
+			return err;
+		}
+		/* the new control must be found by the next lookups */
+		err = plan_build(handle, plan);
+		if (err < 0) {
+			error("Cannot determine controls: %s", snd_strerror(err));
+			return err;
 		}
 	}
 	if (err < 0) {
@@ -1470,7 +1664,18 @@ static int set_control(snd_ctl_t *handle, snd_config_t *control,
 	}
 
  _ok:
-	err = doit ? snd_ctl_elem_write(handle, ctl) : 0;
+	if (values)
+		return state_cache_add(values, numid1, type, count, ctl);
+	if (!doit)
+		return 0;
+	/* the write is skipped when the control has the value already */
+	if (snd_ctl_elem_info_is_readable(info)) {
+		snd_ctl_elem_value_set_numid(cur, numid1);
+		if (snd_ctl_elem_read(handle, cur) == 0 &&
+		    value_equal(ctl, cur, type, count))
+			return 0;
+	}
+	err = snd_ctl_elem_write(handle, ctl);
 	if (err < 0) {
 		error("Cannot write control '%d:%ld:%ld:%s:%ld' : %s", (int)iface, device, subdevice, name, index, snd_strerror(err));
 		return err;
@@ -1482,19 +1687,19 @@ static int set_controls(int card, snd_config_t *top, int doit)
 {
 	snd_ctl_t *handle;
 	snd_ctl_card_info_t *info;
-	snd_ctl_elem_list_t *list;
 	snd_ctl_elem_info_t *elem_info;
 	snd_ctl_elem_id_t *elem_id;
 	snd_config_t *control;
 	snd_config_iterator_t i, next;
+	struct ctl_plan plan;
 	int err, maxnumid = -1, maxnumid2 = -1;
-	unsigned int idx, count = 0;
+	unsigned int idx;
 	char name[32], tmpid[16];
 	const char *id;
 	snd_ctl_card_info_alloca(&info);
-	snd_ctl_elem_list_alloca(&list);
 	snd_ctl_elem_info_alloca(&elem_info);
 	snd_ctl_elem_id_alloca(&elem_id);
+	memset(&plan, 0, sizeof(plan));
 	sprintf(name, "hw:%d", card);
 	dbg("device='%s', doit=%i", name, doit);
 	err = snd_ctl_open(&handle, name, 0);
@@ -1527,50 +1732,42 @@ static int set_controls(int card, snd_config_t *top, int doit)
 		cerror(doit, "state.%s.control is not a compound\n", id);
 		return -EINVAL;
 	}
+	err = plan_build(handle, &plan);
+	if (err < 0) {
+		error("Cannot determine controls: %s", snd_strerror(err));
+		goto _close;
+	}
+	dbg("list count: %u", plan.count);
 	snd_config_for_each(i, next, control) {
 		snd_config_t *n = snd_config_iterator_entry(i);
-		err = set_control(handle, n, &maxnumid, doit);
+		err = set_control(handle, &plan, n, &maxnumid, doit, NULL);
 		if (err < 0 && (!force_restore || !doit))
-			goto _close;
+			goto _free;
 	}
 
 	if (doit)
-		goto _close;
-
-	err = snd_ctl_elem_list(handle, list);
-	if (err < 0) {
-		error("Cannot determine controls: %s", snd_strerror(err));
-		goto _close;
-	}
-	count = snd_ctl_elem_list_get_count(list);
-	dbg("list count: %u", count);
-	if (count == 0)
-		goto _check;
-	snd_ctl_elem_list_set_offset(list, 0);
-	if (snd_ctl_elem_list_alloc_space(list, count) < 0) {
-		error("No enough memory...");
-		goto _close;
-	}
-	if ((err = snd_ctl_elem_list(handle, list)) < 0) {
-		error("Cannot determine controls (2): %s", snd_strerror(err));
 		goto _free;
-	}
-	maxnumid2 = 0;
-	/* skip non-readable elements */
-	for (idx = 0; idx < count; ++idx) {
-		snd_ctl_elem_info_clear(elem_info);
-		snd_ctl_elem_list_get_id(list, idx, elem_id);
-		snd_ctl_elem_info_set_id(elem_info, elem_id);
-		if (snd_ctl_elem_info(handle, elem_info) == 0) {
-			if (!snd_ctl_elem_info_is_readable(elem_info))
+
+	/* skip non-readable elements, the restored ones are known */
+	if (plan.count > 0)
+		maxnumid2 = 0;
+	for (idx = 0; idx < plan.count; ++idx) {
+		if (!(plan.flags[idx] & PLAN_SEEN)) {
+			snd_ctl_elem_info_clear(elem_info);
+			snd_ctl_elem_list_get_id(plan.list, idx, elem_id);
+			snd_ctl_elem_info_set_id(elem_info, elem_id);
+			if (snd_ctl_elem_info(handle, elem_info) < 0)
 				continue;
-			maxnumid2++;
+			plan.flags[idx] |= PLAN_SEEN;
+			if (snd_ctl_elem_info_is_readable(elem_info))
+				plan.flags[idx] |= PLAN_READABLE;
 		}
+		if (plan.flags[idx] & PLAN_READABLE)
+			maxnumid2++;
 	}
 
 	/* check if we have additional controls in driver */
 	/* in this case we should go through init procedure */
- _check:
 	dbg("maxnumid=%i maxnumid2=%i", maxnumid, maxnumid2);
 	if (maxnumid >= 0 && maxnumid != maxnumid2) {
 		/* not very informative */
@@ -1580,47 +1777,72 @@ static int set_controls(int card, snd_config_t *top, int doit)
 	}
 
  _free:
-	if (count > 0)
-		snd_ctl_elem_list_free_space(list);
+	plan_free(&plan);
  _close:
 	snd_ctl_close(handle);
 	dbg("result code: %i", err);
 	return err;
 }
 
-int save_state(const char *file, const char *cardname)
+/*
+ * Translate the controls of the card in the saved tree to the binary
+ * cache. They are resolved and parsed as for the restore, so the cache
+ * has the values of the text file.
+ */
+int state_cache_controls(snd_ctl_t *handle, const char *cardid,
+			 snd_config_t *top, struct cache_values *values)
 {
-	int err;
-	snd_config_t *config;
-	snd_input_t *in;
-	snd_output_t *out;
-	int stdio;
-	char *nfile = NULL;
-	int lock_fd = -EINVAL;
-	struct snd_card_iterator iter;
+	snd_ctl_elem_info_t *elem_info;
+	snd_ctl_elem_id_t *elem_id;
+	snd_config_t *control;
+	snd_config_iterator_t i, next;
+	struct ctl_plan plan;
+	int err, maxnumid = -1;
+	unsigned int idx;
+	snd_ctl_elem_info_alloca(&elem_info);
+	snd_ctl_elem_id_alloca(&elem_id);
 
-	err = snd_config_top(&config);
-	if (err < 0) {
-		error("snd_config_top error: %s", snd_strerror(err));
+	err = snd_config_searchv(top, &control, "state", cardid, "control", NULL);
+	if (err < 0)
+		return err;
+	if (snd_config_get_type(control) != SND_CONFIG_TYPE_COMPOUND)
+		return -EINVAL;
+	memset(&plan, 0, sizeof(plan));
+	err = plan_build(handle, &plan);
+	if (err < 0)
 		return err;
+	snd_config_for_each(i, next, control) {
+		snd_config_t *n = snd_config_iterator_entry(i);
+		err = set_control(handle, &plan, n, &maxnumid, 0, values);
+		if (err < 0)
+			goto _free;
 	}
-	stdio = !strcmp(file, "-");
-	if (!stdio) {
-		nfile = malloc(strlen(file) + 5);
-		if (nfile == NULL) {
-			error("No enough memory...");
-			err = -ENOMEM;
-			goto out;
-		}
-		strcpy(nfile, file);
-		strcat(nfile, ".new");
-		lock_fd = state_lock(file, LOCK_TIMEOUT);
-		if (lock_fd < 0) {
-			err = lock_fd;
-			goto out;
+
+	/* a readable control missing in the tree needs the init */
+	for (idx = 0; idx < plan.count; ++idx) {
+		if (plan.flags[idx] & PLAN_SEEN)
+			continue;
+		snd_ctl_elem_info_clear(elem_info);
+		snd_ctl_elem_list_get_id(plan.list, idx, elem_id);
+		snd_ctl_elem_info_set_id(elem_info, elem_id);
+		if (snd_ctl_elem_info(handle, elem_info) == 0 &&
+		    snd_ctl_elem_info_is_readable(elem_info)) {
+			err = -EAGAIN;
+			break;
 		}
 	}
-	if (!stdio && (err = snd_input_stdio_open(&in, file, "r")) >= 0) {
+ _free:
+	plan_free(&plan);
+	return err;
+}
+
+/* load the state file into config, a missing or broken file is empty */
+static void load_state_file(const char *file, snd_config_t *config)
+{
+	snd_input_t *in;
+	int err;
+
+	if ((err = snd_input_stdio_open(&in, file, "r")) >= 0) {
 		err = snd_config_load(config, in);
 		snd_input_close(in);
 #if 0
@@ -1630,22 +1852,25 @@ int save_state(const char *file, const char *cardname)
 		}
 #endif
 	}
+}
 
-	err = snd_card_iterator_sinit(&iter, cardname);
-	if (err < 0)
-		goto out;
-	while (snd_card_iterator_next(&iter)) {
-		if ((err = get_controls(iter.card, config)))
-			goto out;
-	}
-	if (iter.first) {
-		err = snd_card_iterator_error(&iter);
-		goto out;
-	}
+/* write config to file through file.new, or to stdout for "-" */
+static int write_state_file(const char *file, snd_config_t *config)
+{
+	snd_output_t *out;
+	char *nfile = NULL;
+	int err;
 
-	if (stdio) {
+	if (!strcmp(file, "-")) {
 		err = snd_output_stdio_attach(&out, stdout, 0);
 	} else {
+		nfile = malloc(strlen(file) + 5);
+		if (nfile == NULL) {
+			error("No enough memory...");
+			return -ENOMEM;
+		}
+		strcpy(nfile, file);
+		strcat(nfile, ".new");
 		err = snd_output_stdio_open(&out, nfile, "w");
 	}
 	if (err < 0) {
@@ -1662,28 +1887,250 @@ int save_state(const char *file, const char *cardname)
 		if (err < 0)
 			error("rename failed: %s (%s)", strerror(-err), file);
 	}
+out:
+	free(nfile);
+	return err;
+}
+
+int save_state(const char *file, const char *cardname)
+{
+	int err;
+	snd_config_t *config;
+	int stdio;
+	int lock_fd = -EINVAL;
+	struct snd_card_iterator iter;
+
+	err = snd_config_top(&config);
+	if (err < 0) {
+		error("snd_config_top error: %s", snd_strerror(err));
+		return err;
+	}
+	stdio = !strcmp(file, "-");
+	if (!stdio) {
+		lock_fd = state_lock(file, LOCK_TIMEOUT);
+		if (lock_fd < 0) {
+			err = lock_fd;
+			goto out;
+		}
+		load_state_file(file, config);
+	}
+
+	err = snd_card_iterator_sinit(&iter, cardname);
+	if (err < 0)
+		goto out;
+	while (snd_card_iterator_next(&iter)) {
+		if ((err = get_controls(iter.card, config)))
+			goto out;
+	}
+	if (iter.first) {
+		err = snd_card_iterator_error(&iter);
+		goto out;
+	}
+
+	err = write_state_file(file, config);
+	if (err >= 0 && use_cache && !stdio)
+		state_cache_store(file, cardname, config);
 out:
 	if (!stdio && lock_fd >= 0)
 		state_unlock(lock_fd, file);
-	free(nfile);
 	snd_config_delete(config);
 	snd_config_update_free_global();
 	return err;
 }
 
+/*
+ * Incremental store for the daemon: the state tree is kept in memory
+ * and only the changed controls are read from the cards. The tree is
+ * loaded again when the file was changed by somebody else.
+ */
+int state_tree_load(const char *file, snd_config_t **top)
+{
+	int err;
+
+	if (*top) {
+		snd_config_delete(*top);
+		*top = NULL;
+	}
+	err = snd_config_top(top);
+	if (err < 0) {
+		error("snd_config_top error: %s", snd_strerror(err));
+		return err;
+	}
+	load_state_file(file, *top);
+	return 0;
+}
+
+int state_tree_save(const char *file, snd_config_t *top)
+{
+	return write_state_file(file, top);
+}
+
+/* re-read all controls of the card */
+int state_tree_store_card(snd_config_t *top, int cardno)
+{
+	return get_controls(cardno, top);
+}
+
+/* re-read one control of the card, keeping its place in the tree */
+int state_tree_store_control(snd_config_t *top, const char *cardid,
+			     snd_ctl_t *handle, snd_ctl_elem_id_t *id)
+{
+	snd_config_t *control, *old, *tmp, *n;
+	snd_config_iterator_t i, next;
+	int err;
+
+	err = snd_config_searchv(top, &control, "state", cardid, "control", NULL);
+	if (err < 0)
+		return err;
+	err = snd_config_make_compound(&tmp, NULL, 0);
+	if (err < 0)
+		return err;
+	err = get_control(handle, id, tmp);
+	if (err < 0)
+		goto out;
+	if (snd_config_search(control, num_str(snd_ctl_elem_id_get_numid(id)), &old) < 0)
+		old = NULL;
+	snd_config_for_each(i, next, tmp) {
+		n = snd_config_iterator_entry(i);
+		snd_config_remove(n);
+		if (old) {
+			/* n has the id of old, it takes its place and is freed */
+			err = snd_config_substitute(old, n);
+			old = NULL;
+		} else {
+			err = snd_config_add(control, n);
+		}
+		if (err < 0) {
+			snd_config_delete(n);
+			goto out;
+		}
+	}
+out:
+	snd_config_delete(tmp);
+	return err;
+}
+
+/*
+ * The cards are restored in parallel, one thread per card, so a slow
+ * card (USB) doesn't delay the others. The cards are locked and
+ * unlocked by the main thread, the lock timeout uses SIGALRM, which is
+ * blocked in the workers so it interrupts the lock wait only. The init
+ * parser and UCM use global state, they run one card at a time. With a
+ * valid cache the text file is parsed only when a card is not restored
+ * from the cache, by the main thread, and such cards get a second worker.
+ */
+struct card_restore {
+	struct card_restore *next;
+	pthread_t thread;
+	bool started;
+	int card;
+	char *cardname;
+	int lock_fd;
+	const char *cfgdir;
+	const char *initfile;
+	int initflags;
+	snd_config_t **config;		/* NULL until parsed */
+	struct state_cache *cache;
+	bool fallback;			/* restore from the text file */
+	int do_init;
+	int err;
+};
+
+static pthread_mutex_t init_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void restore_card(struct card_restore *card)
+{
+	int err;
+
+	if (!card->fallback) {
+		/* error is ignored */
+		pthread_mutex_lock(&init_mutex);
+		init_ucm(card->initflags | FLAG_UCM_FBOOT, card->card);
+		pthread_mutex_unlock(&init_mutex);
+		/* the cache matches the state file, no check is required */
+		if (card->cache &&
+		    state_cache_restore(card->cache, card->card) == 0)
+			return;
+		if (*card->config == NULL) {
+			card->fallback = true;
+			return;
+		}
+	}
+	/* do a check if controls matches state file */
+	if (card->do_init && set_controls(card->card, *card->config, 0)) {
+		pthread_mutex_lock(&init_mutex);
+		err = init(card->cfgdir, card->initfile,
+			   card->initflags | FLAG_UCM_BOOT, card->cardname);
+		pthread_mutex_unlock(&init_mutex);
+		if (err < 0) {
+			initfailed(card->card, "init", err);
+			card->err = err;
+		}
+	}
+	if ((err = set_controls(card->card, *card->config, 1))) {
+		if (!force_restore)
+			card->err = err;
+		initfailed(card->card, "restore", err);
+	}
+}
+
+static void *restore_card_thread(void *arg)
+{
+	restore_card(arg);
+	return NULL;
+}
+
+static void restore_card_start(struct card_restore *card,
+			       const sigset_t *alarm_mask, bool single)
+{
+	sigset_t old_mask;
+
+	card->started = false;
+	if (!single) {
+		/* the worker inherits the mask */
+		pthread_sigmask(SIG_BLOCK, alarm_mask, &old_mask);
+		if (pthread_create(&card->thread, NULL,
+				   restore_card_thread, card) == 0)
+			card->started = true;
+		pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	}
+	if (!card->started)
+		restore_card(card);
+}
+
+static void restore_card_wait(struct card_restore *cards)
+{
+	for (; cards; cards = cards->next) {
+		if (cards->started)
+			pthread_join(cards->thread, NULL);
+		cards->started = false;
+	}
+}
+
 int load_state(const char *cfgdir, const char *file,
 	       const char *initfile, int initflags,
 	       const char *cardname, int do_init)
 {
-	int err, finalerr = 0, open_failed, lock_fd;
+	int err, finalerr = 0, open_failed = 0, lock_fd;
 	struct snd_card_iterator iter;
 	snd_config_t *config;
 	const char *cardname1;
+	struct card_restore *cards = NULL, **last = &cards, *card;
+	struct state_cache *cache = NULL;
+	sigset_t alarm_mask;
+	bool parsed = false;
 
 	config = NULL;
-	err = load_configuration(file, &config, &open_failed);
-	if (err < 0 && !open_failed)
-		return err;
+	err = 0;
+	if (use_cache && state_cache_load(file, &cache) < 0)
+		dbg("no valid cache for %s", file);
+	/* with the cache, the text file is parsed for the cards it misses */
+	if (cache == NULL) {
+		err = load_configuration(file, &config, &open_failed);
+		if (err < 0 && !open_failed)
+			return err;
+		parsed = true;
+	}
 
 	if (open_failed) {
 		error("Cannot open %s for reading: %s", file, snd_strerror(err));
@@ -1718,6 +2165,8 @@ int load_state(const char *cfgdir, const char *file,
 	err = snd_card_iterator_sinit(&iter, cardname);
 	if (err < 0)
 		goto out;
+	sigemptyset(&alarm_mask);
+	sigaddset(&alarm_mask, SIGALRM);
 	while ((cardname1 = snd_card_iterator_next(&iter)) != NULL) {
 		lock_fd = card_lock(iter.card, LOCK_TIMEOUT);
 		if (lock_fd < 0) {
@@ -1725,25 +2174,58 @@ int load_state(const char *cfgdir, const char *file,
 			finalerr = lock_fd;
 			continue;
 		}
-		/* error is ignored */
-		init_ucm(initflags | FLAG_UCM_FBOOT, iter.card);
-		/* do a check if controls matches state file */
-		if (do_init && set_controls(iter.card, config, 0)) {
-			err = init(cfgdir, initfile, initflags | FLAG_UCM_BOOT, cardname1);
-			if (err < 0) {
-				initfailed(iter.card, "init", err);
-				finalerr = err;
-			}
+		/* the running workers keep their card, no array to grow */
+		card = calloc(1, sizeof(*card));
+		if (card == NULL) {
+			card_unlock(lock_fd, iter.card);
+			finalerr = -ENOMEM;
+			break;
 		}
-		if ((err = set_controls(iter.card, config, 1))) {
-			if (!force_restore)
-				finalerr = err;
-			initfailed(iter.card, "restore", err);
+		*last = card;
+		last = &card->next;
+		card->card = iter.card;
+		card->cardname = strdup(cardname1);
+		card->lock_fd = lock_fd;
+		card->cfgdir = cfgdir;
+		card->initfile = initfile;
+		card->initflags = initflags;
+		card->config = &config;
+		card->cache = cache;
+		card->do_init = do_init;
+		/* restore this card while the next one is locked */
+		if (card->cardname == NULL)
+			card->err = -ENOMEM;
+		else
+			restore_card_start(card, &alarm_mask, iter.single);
+	}
+	restore_card_wait(cards);
+	for (card = cards; card; card = card->next) {
+		if (!card->fallback)
+			continue;
+		if (!parsed) {
+			err = load_configuration(file, &config, NULL);
+			parsed = true;
+		}
+		if (config == NULL) {
+			initfailed(card->card, "restore", err);
+			card->err = err;
+			continue;
 		}
-		card_unlock(lock_fd, iter.card);
+		restore_card_start(card, &alarm_mask, iter.single);
+	}
+	restore_card_wait(cards);
+	while (cards) {
+		card = cards;
+		cards = card->next;
+		if (card->err)
+			finalerr = card->err;
+		card_unlock(card->lock_fd, card->card);
+		free(card->cardname);
+		free(card);
 	}
 	err = finalerr ? finalerr : snd_card_iterator_error(&iter);
 out:
+	state_cache_free(cache);
 	if (config)
 		snd_config_delete(config);
 	snd_config_update_free_global();
@@ -81,22 +81,20 @@ size_t line_width(const char *buf, size_t bufsize, size_t pos)
 
 void initfailed(int cardnumber, const char *reason, int exitcode)
 {
-	int fp;
+	int fp, len;
 	char *str;
-	char sexitcode[16];
+	char line[256];
 
 	if (statefile == NULL)
 		return;
 	if (snd_card_get_name(cardnumber, &str) < 0)
 		return;
-	sprintf(sexitcode, "%i", exitcode);
+	/* one write, the cards may be restored in parallel */
+	len = snprintf(line, sizeof(line), "%s:%s:%i\n", str, reason, exitcode);
+	if (len >= (int)sizeof(line))
+		len = sizeof(line) - 1;
 	fp = open(statefile, O_WRONLY|O_CREAT|O_APPEND, 0644);
-	(void)write(fp, str, strlen(str));
-	(void)write(fp, ":", 1);
-	(void)write(fp, reason, strlen(reason));
-	(void)write(fp, ":", 1);
-	(void)write(fp, sexitcode, strlen(sexitcode));
-	(void)write(fp, "\n", 1);
+	(void)write(fp, line, len);
 	close(fp);
 	free(str);
 }
@@ -179,8 +179,10 @@ void help(void)
 "-x,--prateshift playback 'PCM Rate Shift 100000' ascii ctl name\n"
 "-l,--latency   requested latency in frames\n"
 "-t,--tlatency  requested latency in usec (1/1000000sec)\n"
+"-L,--adaptive  adaptive latency, argument is the maximal latency in usec\n"
 "-f,--format    sample format\n"
 "-c,--channels  channels\n"
+"-Q,--pchannels playback channels (when differs from capture, see --matrix)\n"
 "-r,--rate      rate\n"
 "-n,--resample  resample in alsa-lib\n"
 "-A,--samplerate use converter (0=sincbest,1=sincmedium,2=sincfastest,\n"
@@ -197,6 +199,8 @@ void help(void)
 "		    SRC_SLAVE_ID(PLAYBACK)[@DST_SLAVE_ID(CAPTURE)]\n"
 "-O,--ossmixer	rescan and redirect oss mixer, argument is:\n"
 "		    ALSA_ID@OSS_ID  (for example: \"Master@VOLUME\")\n"
+"-M,--matrix    channel routing matrix, comma separated list of\n"
+"                 CAPTURE_CHANNEL:PLAYBACK_CHANNEL[=GAIN] (e.g. 0:0,1:1,0:2=0.5)\n"
 "-e,--effect    apply an effect (bandpass filter sweep)\n"
 "-v,--verbose   verbose mode (more -v means more verbose)\n"
 "-w,--workaround use workaround (serialopen)\n"
@@ -367,8 +371,11 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 		{"prateshift", 1, NULL, 'x'},
 		{"latency", 1, NULL, 'l'},
 		{"tlatency", 1, NULL, 't'},
+		{"adaptive", 1, NULL, 'L'},
 		{"format", 1, NULL, 'f'},
 		{"channels", 1, NULL, 'c'},
+		{"pchannels", 1, NULL, 'Q'},
+		{"matrix", 1, NULL, 'M'},
 		{"rate", 1, NULL, 'r'},
 		{"buffer", 1, NULL, 'B'},
 		{"period", 1, NULL, 'E'},
@@ -397,8 +404,11 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 	char *arg_prateshift = NULL;
 	unsigned int arg_latency_req = 0;
 	unsigned int arg_latency_reqtime = 10000;
+	unsigned int arg_adaptive = 0;
 	snd_pcm_format_t arg_format = SND_PCM_FORMAT_S16_LE;
 	unsigned int arg_channels = 2;
+	unsigned int arg_pchannels = 0;
+	char *arg_matrix = NULL;
 	unsigned int arg_rate = 48000;
 	snd_pcm_uframes_t arg_buffer_size = 0;
 	snd_pcm_uframes_t arg_period_size = 0;
@@ -424,7 +434,7 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 	while (1) {
 		int c;
 		if ((c = getopt_long(argc, argv,
-				"hdg:P:C:X:Y:x:l:t:F:f:c:r:s:benvA:S:a:m:T:O:w:UW:z",
+				"hdg:P:C:X:Y:x:l:t:L:F:f:c:Q:M:r:s:benvA:S:a:m:T:O:w:UW:z",
 				long_option, NULL)) < 0)
 			break;
 		switch (c) {
@@ -461,6 +471,10 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 			err = atoi(optarg);
 			arg_latency_reqtime = err >= 500 ? err : 500;
 			break;
+		case 'L':
+			err = atoi(optarg);
+			arg_adaptive = err >= 500 ? err : 500;
+			break;
 		case 'f':
 			arg_format = snd_pcm_format_value(optarg);
 			if (arg_format == SND_PCM_FORMAT_UNKNOWN) {
@@ -472,6 +486,13 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 			err = atoi(optarg);
 			arg_channels = err >= 1 && err < 1024 ? err : 1;
 			break;
+		case 'Q':
+			err = atoi(optarg);
+			arg_pchannels = err >= 1 && err < 1024 ? err : 0;
+			break;
+		case 'M':
+			arg_matrix = optarg;
+			break;
 		case 'r':
 			err = atoi(optarg);
 			arg_rate = err >= 4000 && err < 200000 ? err : 44100;
@@ -615,12 +636,33 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 		play->format = capt->format = arg_format;
 		play->rate = play->rate_req = capt->rate = capt->rate_req = arg_rate;
 		play->channels = capt->channels = arg_channels;
+		if (arg_matrix) {
+			err = matrix_parse(&loop->matrix, arg_matrix);
+			if (err < 0) {
+				logit(LOG_CRIT, "Unable to parse channel matrix.\n");
+				exit(EXIT_FAILURE);
+			}
+			play->channels = loop->matrix->dst_channels;
+		}
+		if (arg_pchannels > 0)
+			play->channels = arg_pchannels;
+		if (play->channels != capt->channels && loop->matrix == NULL) {
+			logit(LOG_CRIT, "Different playback and capture channels require --matrix.\n");
+			exit(EXIT_FAILURE);
+		}
 		play->buffer_size_req = capt->buffer_size_req = arg_buffer_size;
 		play->period_size_req = capt->period_size_req = arg_period_size;
 		play->resample = capt->resample = arg_resample;
 		play->nblock = capt->nblock = arg_nblock ? 1 : 0;
 		loop->latency_req = arg_latency_req;
 		loop->latency_reqtime = arg_latency_reqtime;
+		if (arg_adaptive > 0) {
+			loop->adaptive = 1;
+			loop->adaptive_max = arg_adaptive;
+			loop->latency_req = 0;
+			loop->latency_reqtime = arg_adaptive < ADAPTIVE_MIN_TIME ?
+					arg_adaptive : ADAPTIVE_MIN_TIME;
+		}
 		loop->sync = arg_sync;
 		loop->slave = arg_slave;
 		loop->thread = arg_thread;
@@ -42,6 +42,10 @@ enum {
 
 #define WORKAROUND_SERIALOPEN	(1<<0)
 
+#define ADAPTIVE_MIN_TIME	1000		/* initial latency in us */
+#define ADAPTIVE_WINDOW		2000000		/* evaluation window in us */
+#define ADAPTIVE_SHRINK_WINDOWS	5		/* clean windows before shrink */
+
 typedef enum _sync_type {
 	SYNC_TYPE_NONE = 0,
 	SYNC_TYPE_SIMPLE,	/* add or remove samples */
@@ -81,6 +85,49 @@ struct loopback_ossmixer {
 	struct loopback_ossmixer *next;
 };
 
+struct loopback_matrix_entry {
+	unsigned int src;		/* capture channel */
+	unsigned int dst;		/* playback channel */
+	float gain;
+};
+
+struct loopback_matrix;
+
+typedef void (*loopback_matrix_kernel_t)(const struct loopback_matrix *m,
+					 const void *src, void *dst,
+					 snd_pcm_uframes_t frames);
+
+struct loopback_matrix {
+	/* parsed entries */
+	unsigned int entries_count;
+	struct loopback_matrix_entry *entries;
+	unsigned int src_channels;	/* minimal capture channels */
+	unsigned int dst_channels;	/* minimal playback channels */
+	/* runtime (see matrix_init) */
+	unsigned int in_channels;
+	unsigned int out_channels;
+	float *gains;			/* out_channels x in_channels */
+	unsigned int taps_count;
+	struct loopback_matrix_entry *taps;	/* non-zero gains */
+	loopback_matrix_kernel_t kernel;
+};
+
+struct loopback_hwcache {
+	/* key */
+	snd_pcm_format_t format;
+	unsigned int rate_req;
+	unsigned int channels;
+	snd_pcm_uframes_t bufsize;
+	/* negotiated parameters */
+	snd_pcm_hw_params_t *hw_params;
+	snd_pcm_sw_params_t *sw_params;
+	unsigned int rate;
+	unsigned int buffer_size;
+	unsigned int period_size;
+	snd_pcm_uframes_t avail_min;
+	struct loopback_hwcache *next;
+};
+
 struct loopback_handle {
 	struct loopback *loopback;
 	char *device;
@@ -128,6 +175,9 @@ struct loopback_handle {
 	snd_ctl_elem_value_t *ctl_rate;
 	snd_ctl_elem_value_t *ctl_channels;
 	char *prateshift_name; /* ascii name for the playback rate shift ctl elem */
+	/* negotiated parameters cache */
+	struct loopback_hwcache *hwcache;
+	struct loopback_hwcache *hwcache_cur;	/* installed parameters */
 };
 
 struct loopback {
@@ -175,9 +225,22 @@ struct loopback {
 	unsigned int xrun_out_frames;
 	long xrun_max_proctime;
 	double xrun_max_missing;
+	/* adaptive latency */
+	unsigned int adaptive:1;	/* adaptive latency mode */
+	unsigned int adaptive_converged:1;
+	unsigned int adaptive_max;	/* maximal latency (in us) */
+	unsigned int adaptive_floor;	/* highest latency with xruns (in us) */
+	unsigned int adaptive_xruns;	/* xruns in the current window */
+	unsigned int adaptive_clean;	/* consecutive windows without xruns */
+	unsigned int adaptive_total_xruns;
+	long adaptive_jitter;		/* max wake-up jitter in window (in us) */
+	snd_timestamp_t adaptive_window;	/* start of the current window */
+	snd_timestamp_t adaptive_last_wake;
 	/* control mixer */
 	struct loopback_mixer *controls;
 	struct loopback_ossmixer *oss_controls;
+	/* channel matrix */
+	struct loopback_matrix *matrix;
 	/* sample rate */
 	unsigned int use_samplerate:1;
 #ifdef USE_SAMPLERATE
@@ -206,6 +269,19 @@ extern int use_syslog;
 		fprintf(stderr, fmt, ##args);		\
 } while (0)
 
+/*
+ * device and clock access of the loopback jobs, the defaults are
+ * snd_pcm_open(), snd_ctl_open() and gettimeofday(); replaced by
+ * the offline test harness (test/alsaloop-sim.c)
+ */
+struct loopback_ops {
+	int (*pcm_open)(snd_pcm_t **pcm, const char *name,
+			snd_pcm_stream_t stream, int mode);
+	int (*ctl_open)(snd_ctl_t **ctl, const char *name, int mode);
+	int (*gettime)(struct timeval *tv);
+};
+
+void pcmjob_set_ops(const struct loopback_ops *ops);
 int pcmjob_init(struct loopback *loop);
 int pcmjob_done(struct loopback *loop);
 int pcmjob_start(struct loopback *loop);
@@ -214,6 +290,11 @@ int pcmjob_pollfds_init(struct loopback *loop, struct pollfd *fds);
 int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds);
 void pcmjob_state(struct loopback *loop);
 
+int matrix_parse(struct loopback_matrix **matrix, const char *str);
+void matrix_free(struct loopback_matrix *matrix);
+int matrix_init(struct loopback *loop);
+void matrix_dump(struct loopback *loop, snd_output_t *out);
+
 int control_parse_id(const char *str, snd_ctl_elem_id_t *id);
 int control_id_match(snd_ctl_elem_id_t *id1, snd_ctl_elem_id_t *id2);
 int control_init(struct loopback *loop);
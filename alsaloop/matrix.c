@@ -0,0 +1,273 @@
+/*
+ *  A simple PCM loopback utility
+ *  Channel routing / mixing matrix
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <syslog.h>
+#include <alsa/asoundlib.h>
+#include "alsaloop.h"
+
+/*
+ * The kernels below are written with fixed inner trip counts (2->8, 8->2)
+ * or flat tap lists (sparse), so the compiler can keep the per-frame work
+ * in vector registers. All accumulation is done in floating point and the
+ * result is saturated to the sample range.
+ */
+
+#define CLIP(v, min, max) ((v) < (min) ? (min) : ((v) > (max) ? (max) : (v)))
+
+#define MATRIX_KERNELS(name, type, acc_t, min, max)			\
+static void matrix_##name##_2to8(const struct loopback_matrix *m,	\
+				 const void *_src, void *_dst,		\
+				 snd_pcm_uframes_t frames)		\
+{									\
+	const type *src = _src;						\
+	type *dst = _dst;						\
+	const float *g = m->gains;					\
+	acc_t l, r, acc[8];						\
+	unsigned int o;							\
+									\
+	while (frames-- > 0) {						\
+		l = src[0];						\
+		r = src[1];						\
+		for (o = 0; o < 8; o++)					\
+			acc[o] = g[o * 2] * l + g[o * 2 + 1] * r;	\
+		for (o = 0; o < 8; o++)					\
+			dst[o] = CLIP(acc[o], min, max);		\
+		src += 2;						\
+		dst += 8;						\
+	}								\
+}									\
+									\
+static void matrix_##name##_8to2(const struct loopback_matrix *m,	\
+				 const void *_src, void *_dst,		\
+				 snd_pcm_uframes_t frames)		\
+{									\
+	const type *src = _src;						\
+	type *dst = _dst;						\
+	const float *g = m->gains;					\
+	acc_t in[8], l, r;						\
+	unsigned int i;							\
+									\
+	while (frames-- > 0) {						\
+		for (i = 0; i < 8; i++)					\
+			in[i] = src[i];					\
+		l = r = 0;						\
+		for (i = 0; i < 8; i++) {				\
+			l += g[i] * in[i];				\
+			r += g[8 + i] * in[i];				\
+		}							\
+		dst[0] = CLIP(l, min, max);				\
+		dst[1] = CLIP(r, min, max);				\
+		src += 8;						\
+		dst += 2;						\
+	}								\
+}									\
+									\
+static void matrix_##name##_sparse(const struct loopback_matrix *m,	\
+				   const void *_src, void *_dst,	\
+				   snd_pcm_uframes_t frames)		\
+{									\
+	const type *src = _src;						\
+	type *dst = _dst;						\
+	const struct loopback_matrix_entry *t, *end;			\
+	unsigned int in = m->in_channels, out = m->out_channels, o;	\
+	acc_t acc[out];							\
+									\
+	end = m->taps + m->taps_count;					\
+	while (frames-- > 0) {						\
+		for (o = 0; o < out; o++)				\
+			acc[o] = 0;					\
+		for (t = m->taps; t < end; t++)				\
+			acc[t->dst] += t->gain * (acc_t)src[t->src];	\
+		for (o = 0; o < out; o++)				\
+			dst[o] = CLIP(acc[o], min, max);		\
+		src += in;						\
+		dst += out;						\
+	}								\
+}
+
+MATRIX_KERNELS(s16, int16_t, float, -32768.0f, 32767.0f)
+MATRIX_KERNELS(s32, int32_t, double, -2147483648.0, 2147483647.0)
+
+/*
+ * parse the matrix specification, comma separated list of
+ * CAPTURE_CHANNEL:PLAYBACK_CHANNEL[=GAIN] entries
+ */
+int matrix_parse(struct loopback_matrix **_matrix, const char *str)
+{
+	struct loopback_matrix *matrix;
+	struct loopback_matrix_entry *e;
+	const char *s;
+	char *end;
+	unsigned int count;
+	long val;
+
+	for (s = str, count = 1; *s; s++)
+		if (*s == ',')
+			count++;
+	matrix = calloc(1, sizeof(*matrix));
+	if (matrix == NULL)
+		return -ENOMEM;
+	matrix->entries = calloc(count, sizeof(*matrix->entries));
+	if (matrix->entries == NULL) {
+		free(matrix);
+		return -ENOMEM;
+	}
+	s = str;
+	while (*s) {
+		e = &matrix->entries[matrix->entries_count];
+		val = strtol(s, &end, 10);
+		if (end == s || *end != ':' || val < 0 || val >= 1024)
+			goto __error;
+		e->src = val;
+		s = end + 1;
+		val = strtol(s, &end, 10);
+		if (end == s || val < 0 || val >= 1024)
+			goto __error;
+		e->dst = val;
+		e->gain = 1.0;
+		s = end;
+		if (*s == '=') {
+			s++;
+			e->gain = strtof(s, &end);
+			if (end == s)
+				goto __error;
+			s = end;
+		}
+		if (*s != ',' && *s != '\0')
+			goto __error;
+		if (*s == ',')
+			s++;
+		if (e->src + 1 > matrix->src_channels)
+			matrix->src_channels = e->src + 1;
+		if (e->dst + 1 > matrix->dst_channels)
+			matrix->dst_channels = e->dst + 1;
+		matrix->entries_count++;
+	}
+	if (matrix->entries_count == 0)
+		goto __error;
+	*_matrix = matrix;
+	return 0;
+      __error:
+	logit(LOG_CRIT, "Wrong channel matrix syntax '%s'\n", str);
+	matrix_free(matrix);
+	return -EINVAL;
+}
+
+void matrix_free(struct loopback_matrix *matrix)
+{
+	if (matrix == NULL)
+		return;
+	free(matrix->gains);
+	free(matrix->taps);
+	free(matrix->entries);
+	free(matrix);
+}
+
+/*
+ * build the runtime tables and select the kernel
+ * for the negotiated stream parameters
+ */
+int matrix_init(struct loopback *loop)
+{
+	struct loopback_matrix *m = loop->matrix;
+	struct loopback_handle *capt = loop->capt;
+	struct loopback_handle *play = loop->play;
+	struct loopback_matrix_entry *e, *t;
+	unsigned int i, in, out;
+	float *g;
+
+	if (m == NULL)
+		return 0;
+	in = capt->channels;
+	out = play->channels;
+	if (m->src_channels > in || m->dst_channels > out) {
+		logit(LOG_CRIT, "%s: channel matrix %ux%u does not fit the streams (capture %u, playback %u channels)\n", loop->id, m->src_channels, m->dst_channels, in, out);
+		return -EINVAL;
+	}
+	if (capt->format != play->format ||
+	    (capt->format != SND_PCM_FORMAT_S16 &&
+	     capt->format != SND_PCM_FORMAT_S32)) {
+		logit(LOG_CRIT, "%s: channel matrix supports only %s or %s formats (play=%s, capt=%s)\n", loop->id, snd_pcm_format_name(SND_PCM_FORMAT_S16), snd_pcm_format_name(SND_PCM_FORMAT_S32), snd_pcm_format_name(play->format), snd_pcm_format_name(capt->format));
+		return -EINVAL;
+	}
+	g = calloc(in * out, sizeof(float));
+	if (g == NULL)
+		return -ENOMEM;
+	free(m->gains);
+	m->gains = g;
+	for (i = 0; i < m->entries_count; i++) {
+		e = &m->entries[i];
+		g[e->dst * in + e->src] += e->gain;
+	}
+	/* compact the non-zero coefficients for the sparse kernel */
+	t = realloc(m->taps, in * out * sizeof(*t));
+	if (t == NULL)
+		return -ENOMEM;
+	m->taps = t;
+	m->taps_count = 0;
+	for (i = 0; i < in * out; i++) {
+		if (g[i] == 0)
+			continue;
+		t->src = i % in;
+		t->dst = i / in;
+		t->gain = g[i];
+		t++;
+		m->taps_count++;
+	}
+	m->in_channels = in;
+	m->out_channels = out;
+	if (capt->format == SND_PCM_FORMAT_S16) {
+		if (in == 2 && out == 8)
+			m->kernel = matrix_s16_2to8;
+		else if (in == 8 && out == 2)
+			m->kernel = matrix_s16_8to2;
+		else
+			m->kernel = matrix_s16_sparse;
+	} else {
+		if (in == 2 && out == 8)
+			m->kernel = matrix_s32_2to8;
+		else if (in == 8 && out == 2)
+			m->kernel = matrix_s32_8to2;
+		else
+			m->kernel = matrix_s32_sparse;
+	}
+	if (verbose > 1)
+		snd_output_printf(loop->output, "%s: channel matrix %u->%u, %u taps\n", loop->id, in, out, m->taps_count);
+	return 0;
+}
+
+void matrix_dump(struct loopback *loop, snd_output_t *out)
+{
+	struct loopback_matrix *m = loop->matrix;
+	unsigned int i;
+
+	if (m == NULL)
+		return;
+	snd_output_printf(out, "  matrix = %u->%u:", m->in_channels, m->out_channels);
+	for (i = 0; i < m->entries_count; i++)
+		snd_output_printf(out, " %u:%u=%.4f", m->entries[i].src,
+				  m->entries[i].dst, m->entries[i].gain);
+	snd_output_printf(out, "\n");
+}
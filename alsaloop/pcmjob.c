@@ -76,6 +76,24 @@ static void pcm_open_init_mutex(void)
 	pthread_mutexattr_destroy(&attr);
 }
 
+static int default_gettime(struct timeval *tv)
+{
+	return gettimeofday(tv, NULL);
+}
+
+static const struct loopback_ops default_ops = {
+	.pcm_open = snd_pcm_open,
+	.ctl_open = snd_ctl_open,
+	.gettime = default_gettime,
+};
+
+static const struct loopback_ops *job_ops = &default_ops;
+
+void pcmjob_set_ops(const struct loopback_ops *ops)
+{
+	job_ops = ops ? ops : &default_ops;
+}
+
 static inline void pcm_open_lock(void)
 {
 	pthread_once(&pcm_open_mutex_once, pcm_open_init_mutex);
@@ -319,12 +337,142 @@ static int increase_playback_avail_min(struct loopback_handle *lhandle)
 	return 0;
 }
 
+static struct loopback_hwcache *hwcache_find(struct loopback_handle *lhandle,
+					     snd_pcm_uframes_t bufsize)
+{
+	struct loopback_hwcache *c;
+
+	for (c = lhandle->hwcache; c; c = c->next) {
+		if (c->format == lhandle->format &&
+		    c->rate_req == lhandle->rate_req &&
+		    c->channels == lhandle->channels &&
+		    c->bufsize == bufsize)
+			return c;
+	}
+	return NULL;
+}
+
+static void hwcache_remove(struct loopback_handle *lhandle,
+			   struct loopback_hwcache *c)
+{
+	struct loopback_hwcache **p;
+
+	for (p = &lhandle->hwcache; *p; p = &(*p)->next) {
+		if (*p == c) {
+			*p = c->next;
+			break;
+		}
+	}
+	if (lhandle->hwcache_cur == c)
+		lhandle->hwcache_cur = NULL;
+	snd_pcm_hw_params_free(c->hw_params);
+	snd_pcm_sw_params_free(c->sw_params);
+	free(c);
+}
+
+static void hwcache_add(struct loopback_handle *lhandle,
+			snd_pcm_uframes_t bufsize,
+			snd_pcm_hw_params_t *params,
+			snd_pcm_sw_params_t *swparams)
+{
+	struct loopback_hwcache *c;
+
+	/* replace an entry for the same request */
+	c = hwcache_find(lhandle, bufsize);
+	if (c)
+		hwcache_remove(lhandle, c);
+	lhandle->hwcache_cur = NULL;
+	c = calloc(1, sizeof(*c));
+	if (c == NULL)
+		return;
+	if (snd_pcm_hw_params_malloc(&c->hw_params) < 0)
+		goto __error;
+	if (snd_pcm_sw_params_malloc(&c->sw_params) < 0)
+		goto __error;
+	snd_pcm_hw_params_copy(c->hw_params, params);
+	snd_pcm_sw_params_copy(c->sw_params, swparams);
+	c->format = lhandle->format;
+	c->rate_req = lhandle->rate_req;
+	c->channels = lhandle->channels;
+	c->bufsize = bufsize;
+	c->rate = lhandle->rate;
+	c->buffer_size = lhandle->buffer_size;
+	c->period_size = lhandle->period_size;
+	c->avail_min = lhandle->avail_min;
+	c->next = lhandle->hwcache;
+	lhandle->hwcache = c;
+	lhandle->hwcache_cur = c;
+	return;
+      __error:
+	if (c->hw_params)
+		snd_pcm_hw_params_free(c->hw_params);
+	free(c);
+}
+
+static void hwcache_free(struct loopback_handle *lhandle)
+{
+	struct loopback_hwcache *c;
+
+	while ((c = lhandle->hwcache) != NULL) {
+		lhandle->hwcache = c->next;
+		snd_pcm_hw_params_free(c->hw_params);
+		snd_pcm_sw_params_free(c->sw_params);
+		free(c);
+	}
+	lhandle->hwcache_cur = NULL;
+}
+
+/*
+ * install previously negotiated parameters, the hw_params call
+ * is skipped when the same parameters are still set up; on error
+ * the caller drops the entry and negotiates the parameters again
+ */
+static int hwcache_apply(struct loopback_handle *lhandle,
+			 struct loopback_hwcache *c)
+{
+	snd_pcm_t *handle = lhandle->handle;
+	int err;
+
+	if (lhandle->hwcache_cur != c ||
+	    snd_pcm_state(handle) == SND_PCM_STATE_OPEN) {
+		lhandle->hwcache_cur = NULL;
+		err = snd_pcm_hw_params(handle, c->hw_params);
+		if (err < 0)
+			goto __error;
+	}
+	err = snd_pcm_sw_params(handle, c->sw_params);
+	if (err < 0)
+		goto __error;
+	lhandle->rate = c->rate;
+	lhandle->pitch = (double)lhandle->rate_req / (double)lhandle->rate;
+	lhandle->buffer_size = c->buffer_size;
+	lhandle->period_size = c->period_size;
+	lhandle->avail_min = c->avail_min;
+	lhandle->hwcache_cur = c;
+	if (verbose > 6)
+		snd_output_printf(lhandle->loopback->output, "%s: using cached parameters\n", lhandle->id);
+	return 0;
+      __error:
+	if (verbose)
+		snd_output_printf(lhandle->loopback->output, "%s: cached parameters no longer apply (%s), negotiating\n", lhandle->id, snd_strerror(err));
+	hwcache_remove(lhandle, c);
+	return err;
+}
+
 static int setparams(struct loopback *loop, snd_pcm_uframes_t bufsize)
 {
 	int err;
 	snd_pcm_hw_params_t *pt_params, *ct_params;	/* templates with rate, format and channels */
 	snd_pcm_hw_params_t *p_params, *c_params;
 	snd_pcm_sw_params_t *p_swparams, *c_swparams;
+	struct loopback_hwcache *p_cache, *c_cache;
+
+	p_cache = hwcache_find(loop->play, bufsize);
+	c_cache = hwcache_find(loop->capt, bufsize);
+	if (p_cache && c_cache &&
+	    hwcache_apply(loop->play, p_cache) >= 0 &&
+	    hwcache_apply(loop->capt, c_cache) >= 0)
+		goto __prepare;
 
 	snd_pcm_hw_params_alloca(&p_params);
 	snd_pcm_hw_params_alloca(&c_params);
@@ -358,12 +506,15 @@ static int setparams(struct loopback *loop, snd_pcm_uframes_t bufsize)
 		logit(LOG_CRIT, "Unable to set sw parameters for %s stream: %s\n", loop->capt->id, snd_strerror(err));
 		return err;
 	}
+	hwcache_add(loop->play, bufsize, p_params, p_swparams);
+	hwcache_add(loop->capt, bufsize, c_params, c_swparams);
 
 #if 0
 	if (!loop->linked)
 		if (snd_pcm_link(loop->capt->handle, loop->play->handle) >= 0)
 			loop->linked = 1;
 #endif
+      __prepare:
 	if ((err = snd_pcm_prepare(loop->play->handle)) < 0) {
 		logit(LOG_CRIT, "Prepare %s error: %s\n", loop->play->id, snd_strerror(err));
 		return err;
@@ -405,7 +556,7 @@ static long timediff(snd_timestamp_t t1, snd_timestamp_t t2)
 static int getcurtimestamp(snd_timestamp_t *ts)
 {
 	struct timeval tv;
-	gettimeofday(&tv, NULL);
+	job_ops->gettime(&tv);
 	ts->tv_sec = tv.tv_sec;
 	ts->tv_usec = tv.tv_usec;
 	return 0;
@@ -484,6 +635,71 @@ static inline void xrun_stats(struct loopback *loop)
 		xrun_stats0(loop);
 }
 
+static void adaptive_set(struct loopback *loop, unsigned int time,
+			 const char *reason)
+{
+	if (time > loop->adaptive_max)
+		time = loop->adaptive_max;
+	if (time == loop->latency_reqtime)
+		return;
+	if (verbose)
+		snd_output_printf(loop->output, "%s: adaptive latency %uus -> %uus (%s)\n", loop->id, loop->latency_reqtime, time, reason);
+	loop->latency_reqtime = time;
+	loop->reinit = 1;
+}
+
+/*
+ * Grow the latency immediately on xruns or when the wake-up jitter eats
+ * more than half of the latency. Shrink it only after several clean
+ * windows and never back to the level where xruns were observed.
+ */
+static void adaptive_check(struct loopback *loop, int woken)
+{
+	snd_timestamp_t t;
+	unsigned int cur = loop->latency_reqtime, next;
+	long diff;
+
+	getcurtimestamp(&t);
+	if (woken) {
+		diff = timediff(t, loop->adaptive_last_wake) -
+		       frames_to_time(loop->capt->rate, loop->capt->avail_min);
+		if (diff > loop->adaptive_jitter)
+			loop->adaptive_jitter = diff;
+		loop->adaptive_last_wake = t;
+	}
+	if (loop->adaptive_xruns > 0) {
+		loop->adaptive_total_xruns += loop->adaptive_xruns;
+		if (loop->adaptive_floor < cur)
+			loop->adaptive_floor = cur;
+		loop->adaptive_converged = 0;
+		loop->adaptive_clean = 0;
+		adaptive_set(loop, cur + cur / 2, "xrun");
+		goto __window;
+	}
+	if (timediff(t, loop->adaptive_window) < ADAPTIVE_WINDOW)
+		return;
+	if (loop->adaptive_jitter > (long)cur / 2) {
+		loop->adaptive_clean = 0;
+		adaptive_set(loop, cur + cur / 4, "jitter");
+	} else if (++loop->adaptive_clean >= ADAPTIVE_SHRINK_WINDOWS) {
+		loop->adaptive_clean = 0;
+		next = cur - cur / 5;
+		if (next < ADAPTIVE_MIN_TIME ||
+		    next <= loop->adaptive_floor + loop->adaptive_floor / 10 ||
+		    loop->adaptive_jitter > (long)next / 4) {
+			if (!loop->adaptive_converged)
+				logit(LOG_INFO, "%s: adaptive latency converged to %li frames (%uus, %u xruns)\n", loop->id, (long)loop->latency, cur, loop->adaptive_total_xruns);
+			loop->adaptive_converged = 1;
+		} else {
+			adaptive_set(loop, next, "shrink");
+		}
+	}
+      __window:
+	loop->adaptive_xruns = 0;
+	loop->adaptive_jitter = 0;
+	loop->adaptive_window = t;
+}
+
 static inline snd_pcm_uframes_t buf_avail(struct loopback_handle *lhandle)
 {
 	return lhandle->buf_size - lhandle->buf_count;
@@ -538,6 +754,42 @@ static void buf_add_copy(struct loopback *loop)
 }
 #endif
 
+static void buf_add_matrix(struct loopback *loop)
+{
+	struct loopback_handle *capt = loop->capt;
+	struct loopback_handle *play = loop->play;
+	struct loopback_matrix *matrix = loop->matrix;
+	snd_pcm_uframes_t count, count1, cpos, ppos;
+
+	count = capt->buf_count;
+	cpos = capt->buf_pos - count;
+	if (cpos > capt->buf_size)
+		cpos += capt->buf_size;
+	ppos = (play->buf_pos + play->buf_count) % play->buf_size;
+	while (count > 0) {
+		count1 = count;
+		if (count1 + cpos > capt->buf_size)
+			count1 = capt->buf_size - cpos;
+		if (count1 > buf_avail(play))
+			count1 = buf_avail(play);
+		if (count1 + ppos > play->buf_size)
+			count1 = play->buf_size - ppos;
+		if (count1 == 0)
+			break;
+		matrix->kernel(matrix,
+			       capt->buf + cpos * capt->frame_size,
+			       play->buf + ppos * play->frame_size,
+			       count1);
+		play->buf_count += count1;
+		capt->buf_count -= count1;
+		ppos += count1;
+		ppos %= play->buf_size;
+		cpos += count1;
+		cpos %= capt->buf_size;
+		count -= count1;
+	}
+}
+
 #ifdef USE_SAMPLERATE
 static void buf_add_src(struct loopback *loop)
 {
@@ -636,6 +888,8 @@ static void buf_add(struct loopback *loop, snd_pcm_uframes_t count)
 		return;
 	if (loop->play->buf == loop->capt->buf) {
 		loop->play->buf_count += count;
+	} else if (loop->matrix) {
+		buf_add_matrix(loop);
 	} else {
 		buf_add_src(loop);
 	}
@@ -645,6 +899,9 @@ static int xrun(struct loopback_handle *lhandle)
 {
 	int err;
 
+	if (lhandle->loopback->adaptive)
+		lhandle->loopback->adaptive_xruns++;
+
 	if (lhandle == lhandle->loopback->play) {
 		logit(LOG_DEBUG, "underrun for %s\n", lhandle->id);
 		xrun_stats(lhandle->loopback);
@@ -1291,7 +1548,7 @@ static int openit(struct loopback_handle *lhandle)
 				SND_PCM_STREAM_CAPTURE;
 	int err, card, device, subdevice;
 	pcm_open_lock();
-	err = snd_pcm_open(&lhandle->handle, lhandle->device, stream, SND_PCM_NONBLOCK);
+	err = job_ops->pcm_open(&lhandle->handle, lhandle->device, stream, SND_PCM_NONBLOCK);
 	pcm_open_unlock();
 	if (err < 0) {
 		logit(LOG_CRIT, "%s open error: %s\n", lhandle->id, snd_strerror(err));
@@ -1316,7 +1573,7 @@ static int openit(struct loopback_handle *lhandle)
 			dev = name;
 		}
 		pcm_open_lock();
-		err = snd_ctl_open(&lhandle->ctl, dev, SND_CTL_NONBLOCK);
+		err = job_ops->ctl_open(&lhandle->ctl, dev, SND_CTL_NONBLOCK);
 		pcm_open_unlock();
 		if (err < 0) {
 			logit(LOG_CRIT, "%s [%s] ctl open error: %s\n", lhandle->id, dev, snd_strerror(err));
@@ -1340,6 +1597,7 @@ static int closeit(struct loopback_handle *lhandle)
 	int err = 0;
 
 	set_rate_shift(lhandle, 1);
+	hwcache_free(lhandle);
 	if (lhandle->ctl_rate_shift)
 		snd_ctl_elem_value_free(lhandle->ctl_rate_shift);
 	lhandle->ctl_rate_shift = NULL;
@@ -1396,7 +1654,8 @@ int pcmjob_init(struct loopback *loop)
 	if (loop->sync == SYNC_TYPE_AUTO && (loop->play->ctl_rate_shift || loop->play->ctl_pitch))
 		loop->sync = SYNC_TYPE_PLAYRATESHIFT;
 #ifdef USE_SAMPLERATE
-	if (loop->sync == SYNC_TYPE_AUTO && loop->src_enable)
+	if (loop->sync == SYNC_TYPE_AUTO && loop->src_enable &&
+	    loop->matrix == NULL)
 		loop->sync = SYNC_TYPE_SAMPLERATE;
 #endif
 	if (loop->sync == SYNC_TYPE_AUTO)
@@ -1453,6 +1712,8 @@ int pcmjob_done(struct loopback *loop)
 	closeit(loop->play);
 	closeit(loop->capt);
 	freeloop(loop);
+	matrix_free(loop->matrix);
+	loop->matrix = NULL;
 	free(loop->id);
 	loop->id = NULL;
 #ifdef FILE_PWRITE
@@ -1528,8 +1789,14 @@ int pcmjob_start(struct loopback *loop)
 		err = get_channels(loop->capt);
 		if (err < 0)
 			goto __error;
-		loop->play->channels = loop->capt->channels = err;
+		if (loop->matrix)
+			loop->capt->channels = err;
+		else
+			loop->play->channels = loop->capt->channels = err;
 	}
+	/* the channel matrix works with S16 or S32 samples only */
+	if (loop->matrix)
+		fix_format(loop, 1);
 	loop->reinit = 0;
 	loop->use_samplerate = 0;
 __again:
@@ -1547,6 +1814,7 @@ __again:
 	    loop->play->format == loop->capt->format &&
 	    loop->play->rate == loop->capt->rate &&
 	    loop->play->channels == loop->capt->channels &&
+	    loop->matrix == NULL &&
 	    loop->sync != SYNC_TYPE_SAMPLERATE) {
 		if (verbose > 1)
 			snd_output_printf(loop->output, "shared buffer!!!\n");
@@ -1594,6 +1862,16 @@ __again:
                                 goto __again;
                         }
                 }
+		if (loop->matrix) {
+			if (loop->use_samplerate ||
+			    loop->sync == SYNC_TYPE_SAMPLERATE) {
+				logit(LOG_CRIT, "%s: channel matrix cannot be combined with samplerate conversion\n", loop->id);
+				err = -EINVAL;
+				goto __error;
+			}
+			if ((err = matrix_init(loop)) < 0)
+				goto __error;
+		}
 	}
 #ifdef USE_SAMPLERATE
 	if (loop->sync == SYNC_TYPE_SAMPLERATE)
@@ -1679,6 +1957,12 @@ __again:
 	}
 	loop->running = 1;
 	loop->stop_pending = 0;
+	if (loop->adaptive) {
+		getcurtimestamp(&loop->adaptive_window);
+		loop->adaptive_last_wake = loop->adaptive_window;
+		loop->adaptive_xruns = 0;
+		loop->adaptive_jitter = 0;
+	}
 	if (loop->xrun) {
 		getcurtimestamp(&loop->xrun_last_update);
 		loop->xrun_last_pdelay = XRUN_PROFILE_UNKNOWN;
@@ -1716,10 +2000,31 @@ int pcmjob_stop(struct loopback *loop)
 			logit(LOG_WARNING, "pcm hw_free %s error: %s\n", loop->play->id, snd_strerror(err));
 		loop->running = 0;
 	}
+	loop->play->hwcache_cur = NULL;
+	loop->capt->hwcache_cur = NULL;
 	freeloop(loop);
 	return 0;
 }
 
+/*
+ * stop the streams but keep the hardware setup, pcmjob_start()
+ * reuses it (or the cached parameters) without renegotiation
+ */
+static int pcmjob_restart(struct loopback *loop)
+{
+	int err;
+
+	if (loop->running) {
+		if ((err = snd_pcm_drop(loop->capt->handle)) < 0)
+			logit(LOG_WARNING, "pcm drop %s error: %s\n", loop->capt->id, snd_strerror(err));
+		if ((err = snd_pcm_drop(loop->play->handle)) < 0)
+			logit(LOG_WARNING, "pcm drop %s error: %s\n", loop->play->id, snd_strerror(err));
+		loop->running = 0;
+	}
+	freeloop(loop);
+	return pcmjob_start(loop);
+}
+
 int pcmjob_pollfds_init(struct loopback *loop, struct pollfd *fds)
 {
 	int err, idx = 0;
@@ -1844,8 +2149,7 @@ static int handle_ctl_events(struct loopback_handle *lhandle,
 			restart = 1;
 	}
 	if (restart) {
-		pcmjob_stop(loop);
-		err = pcmjob_start(loop);
+		err = pcmjob_restart(loop);
 		if (err < 0)
 			return err;
 	}
@@ -1967,6 +2271,8 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 		if ((err = xrun_sync(loop)) < 0)
 			return err;
 	}
+	if (loop->adaptive)
+		adaptive_check(loop, prevents || crevents);
 	if (loop->reinit) {
 		err = pcmjob_stop(loop);
 		if (err < 0)
@@ -2087,6 +2393,9 @@ void pcmjob_state(struct loopback *loop)
 	OUT("  pollfd_count = %i\n", loop->pollfd_count);
 	OUT("  pitch = %.8f, delta = %.8f, diff = %li, min = %li, max = %li\n", loop->pitch, loop->pitch_delta, loop->pitch_diff, loop->pitch_diff_min, loop->pitch_diff_max);
 	OUT("  use_samplerate = %i\n", loop->use_samplerate);
+	if (loop->adaptive)
+		OUT("  adaptive latency = %uus (max %uus, floor %uus, converged %i, xruns %u)\n", loop->latency_reqtime, loop->adaptive_max, loop->adaptive_floor, loop->adaptive_converged, loop->adaptive_total_xruns);
+	matrix_dump(loop, loop->state);
       __skip:
 	show_handle(loop->play, "playback");
 	show_handle(loop->capt, "capture");
@@ -0,0 +1,514 @@
+/*
+ *  Offline alsaloop test harness with simulated clocks
+ *
+ *  Runs one loopback job (pcmjob.c) against simulated capture and
+ *  playback devices (pcm-sim.c) driven by a virtual clock, the devices
+ *  and the clock are installed with pcmjob_set_ops(). The capture
+ *  device produces a frame counter, the playback side decodes it to
+ *  measure the real end-to-end latency and to detect the correction
+ *  artifacts (dropped, repeated or silenced frames).
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <time.h>
+#include <syslog.h>
+#include <alsa/asoundlib.h>
+#include "alsaloop.h"
+#include "pcm-sim.h"
+
+#define MAX_XRUNS	64
+#define MAX_INTERVALS	100000
+
+int verbose = 0;
+int workarounds = 0;
+int use_syslog = 0;
+
+struct sim_xrun {
+	double time;
+	snd_pcm_stream_t stream;
+};
+
+static struct {
+	/* source */
+	unsigned long long produced;
+	/* sink */
+	int32_t prev;
+	unsigned int tolerance;
+	unsigned long jumps;
+	unsigned long dropped;
+	unsigned long repeated;
+	unsigned long gaps;
+	unsigned long silence;
+	/* latency in the current report interval */
+	double lat_sum;
+	unsigned long lat_count;
+	long lat_min;
+	long lat_max;
+} stats;
+
+static double *intervals;	/* mean latency for each report interval */
+static unsigned int intervals_count;
+
+static uint64_t rand_state;
+
+static double sim_random(void)
+{
+	/* xorshift64, reproducible across platforms */
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 7;
+	rand_state ^= rand_state << 17;
+	return (double)(rand_state >> 11) / (double)(1ULL << 53);
+}
+
+static void produce(void *_frame, unsigned int channels)
+{
+	int32_t *frame = _frame;
+	unsigned int ch;
+
+	/* zero is reserved for silence */
+	stats.produced++;
+	for (ch = 0; ch < channels; ch++)
+		frame[ch] = stats.produced;
+}
+
+static void consume(const void *_frame, unsigned int channels)
+{
+	const int32_t *frame = _frame;
+	int32_t v = frame[0];
+	long diff, lat;
+
+	if (v == 0) {
+		if (stats.prev != 0)
+			stats.gaps++;
+		if (stats.prev != 0 || stats.silence > 0)
+			stats.silence++;
+		stats.prev = 0;
+		return;
+	}
+	if (stats.prev != 0) {
+		diff = (long)v - (long)stats.prev - 1;
+		if (labs(diff) > (long)stats.tolerance) {
+			stats.jumps++;
+			if (diff > 0)
+				stats.dropped += diff;
+			else
+				stats.repeated += -diff;
+		}
+	}
+	stats.prev = v;
+	lat = stats.produced - v;
+	stats.lat_sum += lat;
+	if (stats.lat_count == 0 || lat < stats.lat_min)
+		stats.lat_min = lat;
+	if (stats.lat_count == 0 || lat > stats.lat_max)
+		stats.lat_max = lat;
+	stats.lat_count++;
+}
+
+static void report(struct loopback *loop, double mean)
+{
+	printf("%9.2fs latency %10.1f frames (min %6ld max %6ld) pitch %.8f xruns %u/%u jumps %lu gaps %lu\n",
+	       sim.time, mean, stats.lat_min, stats.lat_max, loop->pitch,
+	       sim.capture.xruns, sim.playback.xruns,
+	       stats.jumps, stats.gaps);
+}
+
+static void help(void)
+{
+	printf(
+"Usage: alsaloop-sim [OPTION]...\n\n"
+"-h,--help        help\n"
+"-r,--rate        rate (default 48000)\n"
+"-c,--channels    channels (default 2)\n"
+"-t,--tlatency    requested latency in usec (default 10000)\n"
+"-L,--adaptive    adaptive latency, argument is the maximal latency in usec\n"
+"-S,--sync        sync mode (none, simple, captshift, playshift,\n"
+"                 samplerate, auto)\n"
+"-A,--samplerate  samplerate converter (0-4)\n"
+"-b,--nblock      non-block mode\n"
+"-s,--seconds     simulated duration in seconds (default 10)\n"
+"-i,--interval    report interval in seconds (default 1)\n"
+"   --cdrift      capture clock drift in ppm\n"
+"   --pdrift      playback clock drift in ppm\n"
+"-j,--jitter      maximal wake-up jitter in usec\n"
+"-p,--proctime    processing time per wake-up in usec\n"
+"-g,--granularity hw pointer granularity in frames (default 16)\n"
+"-x,--xrun        inject xrun, argument is c:SECONDS or p:SECONDS\n"
+"   --seed        random seed for the jitter\n"
+"   --tolerance   allowed frame counter deviation (default 0, 2 with\n"
+"                 samplerate sync)\n"
+"   --max-jumps   fail when more jumps are detected (default 0, -1 = off)\n"
+"   --max-xruns   fail when more xruns occur (default 0, -1 = off)\n"
+"   --max-gaps    fail when more silence gaps occur (default 0, -1 = off)\n"
+"   --max-convergence fail when the latency did not settle within\n"
+"                 SECONDS (default off)\n"
+"-v,--verbose     verbose mode (more -v means more verbose)\n"
+);
+}
+
+static int parse_sync(const char *arg)
+{
+	if (strcasecmp(arg, "samplerate") == 0)
+		return SYNC_TYPE_SAMPLERATE;
+	switch (arg[0]) {
+	case 'n': return SYNC_TYPE_NONE;
+	case 's': return SYNC_TYPE_SIMPLE;
+	case 'c': return SYNC_TYPE_CAPTRATESHIFT;
+	case 'p': return SYNC_TYPE_PLAYRATESHIFT;
+	case 'r': return SYNC_TYPE_SAMPLERATE;
+	case 'a': return SYNC_TYPE_AUTO;
+	}
+	return atoi(arg);
+}
+
+/*
+ * time after which all interval means stay within the tolerance
+ * of the final latency
+ */
+static double convergence(double final, double interval)
+{
+	double tol = final * 0.02;
+	int i;
+
+	if (tol < 16)
+		tol = 16;
+	for (i = intervals_count - 1; i >= 0; i--) {
+		if (fabs(intervals[i] - final) > tol)
+			break;
+	}
+	if (i < 0)
+		return 0;
+	if (i + 1 >= (int)intervals_count)
+		return -1;
+	return (i + 1) * interval;
+}
+
+int main(int argc, char *argv[])
+{
+	struct option long_option[] =
+	{
+		{"help", 0, NULL, 'h'},
+		{"rate", 1, NULL, 'r'},
+		{"channels", 1, NULL, 'c'},
+		{"tlatency", 1, NULL, 't'},
+		{"adaptive", 1, NULL, 'L'},
+		{"sync", 1, NULL, 'S'},
+		{"samplerate", 1, NULL, 'A'},
+		{"nblock", 0, NULL, 'b'},
+		{"seconds", 1, NULL, 's'},
+		{"interval", 1, NULL, 'i'},
+		{"cdrift", 1, NULL, 'C'},
+		{"pdrift", 1, NULL, 'P'},
+		{"jitter", 1, NULL, 'j'},
+		{"proctime", 1, NULL, 'p'},
+		{"granularity", 1, NULL, 'g'},
+		{"xrun", 1, NULL, 'x'},
+		{"seed", 1, NULL, 'R'},
+		{"tolerance", 1, NULL, 'T'},
+		{"max-jumps", 1, NULL, 'J'},
+		{"max-xruns", 1, NULL, 'X'},
+		{"max-gaps", 1, NULL, 'G'},
+		{"max-convergence", 1, NULL, 'V'},
+		{"verbose", 0, NULL, 'v'},
+		{NULL, 0, NULL, 0},
+	};
+	struct loopback_handle play_handle, capt_handle;
+	struct loopback loopback, *loop = &loopback;
+	struct sim_xrun xruns[MAX_XRUNS];
+	struct pollfd pfds[16];
+	snd_output_t *output;
+	unsigned int rate = 48000, channels = 2;
+	unsigned int latency = 10000, adaptive = 0, xruns_count = 0, xi = 0;
+	int sync = SYNC_TYPE_AUTO, converter = -1, nblock = 0, tolerance = -1;
+	long max_jumps = 0, max_xruns = 0, max_gaps = 0;
+	double seconds = 10, interval = 1, jitter = 0, proctime = 0;
+	double max_conv = -1;
+	double next, next_report, mean, final, conv, step;
+	unsigned long wakeups = 0;
+	clock_t cpu;
+	int c, err;
+
+	memset(&sim, 0, sizeof(sim));
+	sim.capture.granularity = sim.playback.granularity = 16;
+	rand_state = 0x2545f4914f6cdd1dULL;
+	while ((c = getopt_long(argc, argv, "hr:c:t:L:S:A:bs:i:j:p:g:x:v",
+				long_option, NULL)) >= 0) {
+		switch (c) {
+		case 'h':
+			help();
+			return EXIT_SUCCESS;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 'c':
+			channels = atoi(optarg);
+			break;
+		case 't':
+			latency = atoi(optarg);
+			break;
+		case 'L':
+			adaptive = atoi(optarg);
+			break;
+		case 'S':
+			sync = parse_sync(optarg);
+			break;
+		case 'A':
+			converter = atoi(optarg);
+			break;
+		case 'b':
+			nblock = 1;
+			break;
+		case 's':
+			seconds = atof(optarg);
+			break;
+		case 'i':
+			interval = atof(optarg);
+			break;
+		case 'C':
+			sim.capture.drift = atof(optarg);
+			break;
+		case 'P':
+			sim.playback.drift = atof(optarg);
+			break;
+		case 'j':
+			jitter = atof(optarg) / 1000000;
+			break;
+		case 'p':
+			proctime = atof(optarg) / 1000000;
+			break;
+		case 'g':
+			sim.capture.granularity = atoi(optarg);
+			sim.playback.granularity = sim.capture.granularity;
+			break;
+		case 'x':
+			if (xruns_count >= MAX_XRUNS ||
+			    (optarg[0] != 'c' && optarg[0] != 'p') ||
+			    optarg[1] != ':') {
+				fprintf(stderr, "Wrong xrun specification '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			xruns[xruns_count].stream = optarg[0] == 'c' ?
+				SND_PCM_STREAM_CAPTURE : SND_PCM_STREAM_PLAYBACK;
+			xruns[xruns_count++].time = atof(optarg + 2);
+			break;
+		case 'R':
+			rand_state = strtoull(optarg, NULL, 0) | 1;
+			break;
+		case 'T':
+			tolerance = atoi(optarg);
+			break;
+		case 'J':
+			max_jumps = atol(optarg);
+			break;
+		case 'X':
+			max_xruns = atol(optarg);
+			break;
+		case 'G':
+			max_gaps = atol(optarg);
+			break;
+		case 'V':
+			max_conv = atof(optarg);
+			break;
+		case 'v':
+			verbose++;
+			break;
+		default:
+			help();
+			return EXIT_FAILURE;
+		}
+	}
+	if (rate < 4000 || channels < 1 || channels > 64 || interval <= 0 ||
+	    sync < 0 || sync > SYNC_TYPE_LAST ||
+	    sim.capture.granularity < 1) {
+		fprintf(stderr, "Invalid parameters\n");
+		return EXIT_FAILURE;
+	}
+	/* sort the injected xruns */
+	for (xi = 1; xi < xruns_count; xi++) {
+		struct sim_xrun x = xruns[xi];
+		for (c = xi; c > 0 && xruns[c - 1].time > x.time; c--)
+			xruns[c] = xruns[c - 1];
+		xruns[c] = x;
+	}
+	xi = 0;
+	if (sync == SYNC_TYPE_CAPTRATESHIFT || sync == SYNC_TYPE_AUTO)
+		sim.shift = SIM_SHIFT_CAPTURE;
+	else if (sync == SYNC_TYPE_PLAYRATESHIFT)
+		sim.shift = SIM_SHIFT_PLAYBACK;
+	if (tolerance < 0)
+		tolerance = sync == SYNC_TYPE_SAMPLERATE ? 2 : 0;
+	stats.tolerance = tolerance;
+	sim.produce = produce;
+	sim.consume = consume;
+	intervals = calloc(MAX_INTERVALS, sizeof(*intervals));
+	if (intervals == NULL)
+		return EXIT_FAILURE;
+
+	err = snd_output_stdio_attach(&output, stdout, 0);
+	if (err < 0) {
+		fprintf(stderr, "Output failed: %s\n", snd_strerror(err));
+		return EXIT_FAILURE;
+	}
+	memset(&play_handle, 0, sizeof(play_handle));
+	memset(&capt_handle, 0, sizeof(capt_handle));
+	memset(loop, 0, sizeof(*loop));
+	play_handle.device = play_handle.ctldev = "sim:playback";
+	play_handle.id = "playback sim";
+	capt_handle.device = capt_handle.ctldev = "sim:capture";
+	capt_handle.id = "capture sim";
+	play_handle.loopback = capt_handle.loopback = loop;
+	play_handle.access = capt_handle.access = SND_PCM_ACCESS_RW_INTERLEAVED;
+	/* the frame counter needs 32-bit samples */
+	play_handle.format = capt_handle.format = SND_PCM_FORMAT_S32;
+	play_handle.rate = play_handle.rate_req = rate;
+	capt_handle.rate = capt_handle.rate_req = rate;
+	play_handle.channels = capt_handle.channels = channels;
+	play_handle.nblock = capt_handle.nblock = nblock;
+	loop->play = &play_handle;
+	loop->capt = &capt_handle;
+	loop->latency_reqtime = latency;
+	loop->loop_time = ~0UL;
+	loop->loop_limit = ~0ULL;
+	loop->output = loop->state = output;
+	loop->sync = sync;
+	loop->slave = SLAVE_TYPE_OFF;
+	if (adaptive > 0) {
+		loop->adaptive = 1;
+		loop->adaptive_max = adaptive;
+		loop->latency_reqtime = adaptive < ADAPTIVE_MIN_TIME ?
+					adaptive : ADAPTIVE_MIN_TIME;
+	}
+#ifdef USE_SAMPLERATE
+	loop->src_enable = converter >= 0 || sync == SYNC_TYPE_SAMPLERATE;
+	loop->src_converter_type = converter >= 0 ? converter :
+						    SRC_SINC_FASTEST;
+#else
+	if (converter >= 0 || sync == SYNC_TYPE_SAMPLERATE) {
+		fprintf(stderr, "alsaloop-sim is compiled without libsamplerate support\n");
+		return 77;	/* skipped */
+	}
+#endif
+
+	pcmjob_set_ops(&sim_ops);
+	err = pcmjob_init(loop);
+	if (err < 0) {
+		fprintf(stderr, "Loopback initialization failure.\n");
+		return EXIT_FAILURE;
+	}
+	err = pcmjob_start(loop);
+	if (err < 0) {
+		fprintf(stderr, "Loopback start failure.\n");
+		return EXIT_FAILURE;
+	}
+	if (loop->pollfd_count > (int)(sizeof(pfds) / sizeof(pfds[0]))) {
+		fprintf(stderr, "Too many poll descriptors.\n");
+		return EXIT_FAILURE;
+	}
+	printf("Simulation: rate %u, channels %u, latency %lu frames, sync %i, capture drift %.1fppm, playback drift %.1fppm, jitter %.0fus\n",
+	       rate, channels, (unsigned long)loop->latency, loop->sync,
+	       sim.capture.drift, sim.playback.drift, jitter * 1000000);
+
+	step = (double)sim.capture.granularity / rate;
+	next_report = interval;
+	cpu = clock();
+	while (sim.time < seconds) {
+		next = sim_next_wakeup();
+		if (next < sim.time + step)
+			next = sim.time + step;
+		if (jitter > 0)
+			next += jitter * sim_random();
+		while (xi < xruns_count && xruns[xi].time <= next) {
+			if (xruns[xi].time > sim.time)
+				sim.time = xruns[xi].time;
+			sim_xrun(xruns[xi].stream);
+			xi++;
+		}
+		sim.time = next;
+		sim_update();
+		/* nothing polls the descriptors, revents must stay clear */
+		memset(pfds, 0, sizeof(pfds));
+		err = pcmjob_pollfds_init(loop, pfds);
+		if (err >= 0)
+			err = pcmjob_pollfds_handle(loop, pfds);
+		if (err < 0) {
+			fprintf(stderr, "pcmjob failed: %s\n", snd_strerror(err));
+			return EXIT_FAILURE;
+		}
+		wakeups++;
+		sim.time += proctime;
+		if (sim.time >= next_report) {
+			mean = stats.lat_count ?
+				stats.lat_sum / stats.lat_count : 0;
+			if (intervals_count < MAX_INTERVALS)
+				intervals[intervals_count++] = mean;
+			report(loop, mean);
+			stats.lat_sum = 0;
+			stats.lat_count = 0;
+			next_report += interval;
+		}
+	}
+	cpu = clock() - cpu;
+
+	/* final latency is the mean of the last 10% of the intervals */
+	final = 0;
+	for (c = intervals_count - (intervals_count + 9) / 10;
+	     c < (int)intervals_count; c++)
+		final += intervals[c];
+	if (intervals_count > 0)
+		final /= (intervals_count + 9) / 10;
+	conv = convergence(final, interval);
+	printf("\nSummary:\n");
+	printf("  simulated time: %.2fs, wakeups %lu, cpu time %.3fs\n",
+	       sim.time, wakeups, (double)cpu / CLOCKS_PER_SEC);
+	printf("  requested latency: %lu frames (%.3fms)\n",
+	       (unsigned long)loop->latency,
+	       (double)loop->latency * 1000 / rate);
+	printf("  final latency: %.1f frames (%.3fms)\n",
+	       final, final * 1000 / rate);
+	if (conv >= 0)
+		printf("  convergence: %.2fs\n", conv);
+	else
+		printf("  convergence: not converged\n");
+	printf("  pitch: %.8f\n", loop->pitch);
+	printf("  xruns: capture %u, playback %u\n",
+	       sim.capture.xruns, sim.playback.xruns);
+	printf("  jumps: %lu (dropped %lu, repeated %lu frames)\n",
+	       stats.jumps, stats.dropped, stats.repeated);
+	printf("  silence gaps: %lu (%lu frames)\n", stats.gaps, stats.silence);
+
+	pcmjob_stop(loop);
+	pcmjob_done(loop);
+	snd_output_close(output);
+	free(intervals);
+
+	if (max_jumps >= 0 && stats.jumps > (unsigned long)max_jumps)
+		return EXIT_FAILURE;
+	if (max_xruns >= 0 &&
+	    sim.capture.xruns + sim.playback.xruns > (unsigned long)max_xruns)
+		return EXIT_FAILURE;
+	if (max_gaps >= 0 && stats.gaps > (unsigned long)max_gaps)
+		return EXIT_FAILURE;
+	if (max_conv >= 0 && (conv < 0 || conv > max_conv))
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,575 @@
+/*
+ *  Simulated PCM devices for the offline alsaloop test harness
+ *
+ *  The devices are alsa-lib external plugins (ioplug and ctl_ext) which
+ *  pcmjob.c opens through the sim_ops hooks. The hardware pointers are
+ *  driven by a virtual clock (sim.time) with a configurable drift, so the
+ *  loopback job can run without any sound hardware and much faster than
+ *  realtime. Everything else goes through the unmodified alsa-lib.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/eventfd.h>
+#include <alsa/asoundlib.h>
+#include <alsa/pcm_ioplug.h>
+#include <alsa/control_external.h>
+#include "alsaloop.h"
+#include "pcm-sim.h"
+
+#define SIM_RATE_MIN		4000
+#define SIM_RATE_MAX		384000
+#define SIM_CHANNELS_MAX	64
+#define SIM_PERIOD_BYTES_MIN	64
+#define SIM_BUFFER_BYTES_MAX	(16 * 1024 * 1024)
+
+struct sim_config sim;
+
+struct sim_pcm {
+	snd_pcm_ioplug_t io;
+	struct sim_stream *clock;
+	unsigned int running:1;
+	unsigned int xrun:1;
+	snd_pcm_uframes_t avail_min;
+	unsigned long long hw_ptr;	/* frames since prepare */
+	unsigned long long hw_start;	/* hw_ptr at start */
+	double pos;			/* frames elapsed since start */
+	double last_time;
+};
+
+struct sim_ctl {
+	snd_ctl_ext_t ext;
+	struct sim_stream *clock;
+	const char *elem;		/* emulated element or NULL */
+};
+
+static double sim_rate(struct sim_pcm *pcm)
+{
+	return pcm->io.rate * (1.0 + pcm->clock->drift / 1000000.0) *
+	       pcm->clock->speed;
+}
+
+static void *sim_frame(struct sim_pcm *pcm,
+		       const snd_pcm_channel_area_t *areas,
+		       unsigned long long ptr)
+{
+	return (char *)areas->addr + (areas->first +
+		(ptr % pcm->io.buffer_size) * areas->step) / 8;
+}
+
+/*
+ * the appl_ptr of the plugin is reset by prepare and it is not
+ * expected to wrap at the boundary within a simulation run
+ */
+static unsigned long long sim_appl_ptr(struct sim_pcm *pcm)
+{
+	return pcm->io.appl_ptr;
+}
+
+static snd_pcm_uframes_t sim_avail(struct sim_pcm *pcm)
+{
+	if (pcm->io.stream == SND_PCM_STREAM_CAPTURE)
+		return pcm->hw_ptr - sim_appl_ptr(pcm);
+	return pcm->io.buffer_size - (sim_appl_ptr(pcm) - pcm->hw_ptr);
+}
+
+static void sim_xrun_pcm(struct sim_pcm *pcm)
+{
+	pcm->xrun = 1;
+	pcm->clock->xruns++;
+}
+
+static void sim_update_pcm(struct sim_pcm *pcm)
+{
+	const snd_pcm_channel_area_t *areas;
+	unsigned long long target, appl;
+	unsigned int gran = pcm->clock->granularity;
+
+	if (!pcm->running || pcm->xrun)
+		return;
+	areas = snd_pcm_ioplug_mmap_areas(&pcm->io);
+	if (areas == NULL)
+		return;
+	pcm->pos += (sim.time - pcm->last_time) * sim_rate(pcm);
+	pcm->last_time = sim.time;
+	target = pcm->hw_start + (unsigned long long)(pcm->pos / gran) * gran;
+	appl = sim_appl_ptr(pcm);
+	while (pcm->hw_ptr < target) {
+		if (pcm->io.stream == SND_PCM_STREAM_CAPTURE) {
+			if (pcm->hw_ptr - appl >= pcm->io.buffer_size)
+				break;
+			if (sim.produce)
+				sim.produce(sim_frame(pcm, areas, pcm->hw_ptr),
+					    pcm->io.channels);
+		} else {
+			if (pcm->hw_ptr >= appl)
+				break;
+			if (sim.consume)
+				sim.consume(sim_frame(pcm, areas, pcm->hw_ptr),
+					    pcm->io.channels);
+		}
+		pcm->hw_ptr++;
+	}
+	/* the stop threshold is the buffer size */
+	if (sim_avail(pcm) >= pcm->io.buffer_size)
+		sim_xrun_pcm(pcm);
+}
+
+void sim_update(void)
+{
+	if (sim.capture.pcm)
+		sim_update_pcm(sim.capture.pcm);
+	if (sim.playback.pcm)
+		sim_update_pcm(sim.playback.pcm);
+}
+
+void sim_xrun(snd_pcm_stream_t stream)
+{
+	struct sim_pcm *pcm = stream == SND_PCM_STREAM_CAPTURE ?
+				sim.capture.pcm : sim.playback.pcm;
+
+	sim_update();
+	if (pcm && pcm->running && !pcm->xrun)
+		sim_xrun_pcm(pcm);
+}
+
+static double sim_wakeup_pcm(struct sim_pcm *pcm)
+{
+	long long need;
+	unsigned int gran = pcm->clock->granularity;
+	double t;
+
+	if (pcm->xrun)
+		return sim.time;
+	if (!pcm->running)
+		return -1;
+	if (pcm->io.stream == SND_PCM_STREAM_CAPTURE)
+		need = sim_appl_ptr(pcm) + pcm->avail_min;
+	else
+		need = sim_appl_ptr(pcm) + pcm->avail_min - pcm->io.buffer_size;
+	need -= pcm->hw_start;
+	need = ((need + gran - 1) / gran) * gran;
+	t = sim.time + (need - pcm->pos) / sim_rate(pcm);
+	return t < sim.time ? sim.time : t;
+}
+
+double sim_next_wakeup(void)
+{
+	double t, next = -1;
+
+	if (sim.capture.pcm)
+		next = sim_wakeup_pcm(sim.capture.pcm);
+	if (sim.playback.pcm) {
+		t = sim_wakeup_pcm(sim.playback.pcm);
+		if (next < 0 || (t >= 0 && t < next))
+			next = t;
+	}
+	return next < 0 ? sim.time + 0.001 : next;
+}
+
+/*
+ * PCM plugin
+ */
+
+static int sim_pcm_start(snd_pcm_ioplug_t *io)
+{
+	struct sim_pcm *pcm = io->private_data;
+
+	pcm->running = 1;
+	pcm->xrun = 0;
+	pcm->hw_start = pcm->hw_ptr;
+	pcm->pos = 0;
+	pcm->last_time = sim.time;
+	return 0;
+}
+
+static int sim_pcm_stop(snd_pcm_ioplug_t *io)
+{
+	struct sim_pcm *pcm = io->private_data;
+
+	pcm->running = 0;
+	return 0;
+}
+
+static snd_pcm_sframes_t sim_pcm_pointer(snd_pcm_ioplug_t *io)
+{
+	struct sim_pcm *pcm = io->private_data;
+
+	sim_update_pcm(pcm);
+	if (pcm->xrun)
+		return -EPIPE;
+	return pcm->hw_ptr % io->buffer_size;
+}
+
+static int sim_pcm_prepare(snd_pcm_ioplug_t *io)
+{
+	struct sim_pcm *pcm = io->private_data;
+
+	pcm->running = 0;
+	pcm->xrun = 0;
+	pcm->hw_ptr = 0;
+	return 0;
+}
+
+static int sim_pcm_hw_params(snd_pcm_ioplug_t *io,
+			     snd_pcm_hw_params_t *params)
+{
+	struct sim_pcm *pcm = io->private_data;
+
+	pcm->avail_min = io->period_size;
+	return 0;
+}
+
+static int sim_pcm_sw_params(snd_pcm_ioplug_t *io,
+			     snd_pcm_sw_params_t *params)
+{
+	struct sim_pcm *pcm = io->private_data;
+
+	return snd_pcm_sw_params_get_avail_min(params, &pcm->avail_min);
+}
+
+static int sim_pcm_poll_revents(snd_pcm_ioplug_t *io, struct pollfd *pfds,
+				unsigned int nfds, unsigned short *revents)
+{
+	struct sim_pcm *pcm = io->private_data;
+
+	sim_update_pcm(pcm);
+	*revents = 0;
+	if (pcm->xrun)
+		*revents = POLLERR;
+	else if (pcm->running && sim_avail(pcm) >= pcm->avail_min)
+		*revents = io->poll_events;
+	return 0;
+}
+
+static void sim_pcm_dump(snd_pcm_ioplug_t *io, snd_output_t *out)
+{
+	struct sim_pcm *pcm = io->private_data;
+
+	snd_output_printf(out, "Simulated %s PCM '%s': %s, %uHz, %u channels, buffer %lu, period %lu, drift %.1fppm\n",
+			  io->stream == SND_PCM_STREAM_CAPTURE ? "capture" : "playback",
+			  io->name, snd_pcm_format_name(io->format),
+			  io->rate, io->channels,
+			  (unsigned long)io->buffer_size,
+			  (unsigned long)io->period_size,
+			  pcm->clock->drift);
+}
+
+static int sim_pcm_close(snd_pcm_ioplug_t *io)
+{
+	struct sim_pcm *pcm = io->private_data;
+
+	if (pcm->clock->pcm == pcm)
+		pcm->clock->pcm = NULL;
+	close(io->poll_fd);
+	free(pcm);
+	return 0;
+}
+
+static const snd_pcm_ioplug_callback_t sim_pcm_callback = {
+	.start = sim_pcm_start,
+	.stop = sim_pcm_stop,
+	.pointer = sim_pcm_pointer,
+	.prepare = sim_pcm_prepare,
+	.hw_params = sim_pcm_hw_params,
+	.sw_params = sim_pcm_sw_params,
+	.poll_revents = sim_pcm_poll_revents,
+	.dump = sim_pcm_dump,
+	.close = sim_pcm_close,
+};
+
+static int sim_pcm_constraints(snd_pcm_ioplug_t *io)
+{
+	static const unsigned int accesses[] = {
+		SND_PCM_ACCESS_RW_INTERLEAVED,
+		SND_PCM_ACCESS_MMAP_INTERLEAVED,
+	};
+	static const unsigned int formats[] = {
+		SND_PCM_FORMAT_S16,
+		SND_PCM_FORMAT_S32,
+	};
+	int err;
+
+	err = snd_pcm_ioplug_set_param_list(io, SND_PCM_IOPLUG_HW_ACCESS,
+					    sizeof(accesses) / sizeof(accesses[0]), accesses);
+	if (err < 0)
+		return err;
+	err = snd_pcm_ioplug_set_param_list(io, SND_PCM_IOPLUG_HW_FORMAT,
+					    sizeof(formats) / sizeof(formats[0]), formats);
+	if (err < 0)
+		return err;
+	err = snd_pcm_ioplug_set_param_minmax(io, SND_PCM_IOPLUG_HW_CHANNELS,
+					      1, SIM_CHANNELS_MAX);
+	if (err < 0)
+		return err;
+	err = snd_pcm_ioplug_set_param_minmax(io, SND_PCM_IOPLUG_HW_RATE,
+					      SIM_RATE_MIN, SIM_RATE_MAX);
+	if (err < 0)
+		return err;
+	err = snd_pcm_ioplug_set_param_minmax(io, SND_PCM_IOPLUG_HW_PERIOD_BYTES,
+					      SIM_PERIOD_BYTES_MIN,
+					      SIM_BUFFER_BYTES_MAX / 2);
+	if (err < 0)
+		return err;
+	err = snd_pcm_ioplug_set_param_minmax(io, SND_PCM_IOPLUG_HW_BUFFER_BYTES,
+					      SIM_PERIOD_BYTES_MIN * 2,
+					      SIM_BUFFER_BYTES_MAX);
+	if (err < 0)
+		return err;
+	return snd_pcm_ioplug_set_param_minmax(io, SND_PCM_IOPLUG_HW_PERIODS,
+					       2, 1024);
+}
+
+static int sim_pcm_open(snd_pcm_t **pcmp, const char *name,
+			snd_pcm_stream_t stream, int mode)
+{
+	struct sim_pcm *pcm;
+	int err;
+
+	pcm = calloc(1, sizeof(*pcm));
+	if (pcm == NULL)
+		return -ENOMEM;
+	pcm->clock = stream == SND_PCM_STREAM_CAPTURE ?
+				&sim.capture : &sim.playback;
+	if (pcm->clock->speed == 0)
+		pcm->clock->speed = 1.0;
+	if (pcm->clock->granularity == 0)
+		pcm->clock->granularity = 1;
+	pcm->io.poll_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (pcm->io.poll_fd < 0) {
+		err = -errno;
+		free(pcm);
+		return err;
+	}
+	pcm->io.version = SND_PCM_IOPLUG_VERSION;
+	pcm->io.name = "alsaloop simulated PCM";
+	pcm->io.poll_events = stream == SND_PCM_STREAM_CAPTURE ?
+				POLLIN : POLLOUT;
+	/* the data is transferred through the mmap buffer of the plugin */
+	pcm->io.mmap_rw = 1;
+	pcm->io.callback = &sim_pcm_callback;
+	pcm->io.private_data = pcm;
+	err = snd_pcm_ioplug_create(&pcm->io, name, stream, mode);
+	if (err < 0) {
+		close(pcm->io.poll_fd);
+		free(pcm);
+		return err;
+	}
+	err = sim_pcm_constraints(&pcm->io);
+	if (err < 0) {
+		/* the close callback frees pcm */
+		snd_pcm_ioplug_delete(&pcm->io);
+		return err;
+	}
+	pcm->clock->pcm = pcm;
+	*pcmp = pcm->io.pcm;
+	return 0;
+}
+
+/*
+ * CTL plugin, only the rate shift element is emulated
+ */
+
+static int sim_ctl_elem_count(snd_ctl_ext_t *ext)
+{
+	struct sim_ctl *ctl = ext->private_data;
+
+	return ctl->elem ? 1 : 0;
+}
+
+static int sim_ctl_elem_list(snd_ctl_ext_t *ext, unsigned int offset,
+			     snd_ctl_elem_id_t *id)
+{
+	struct sim_ctl *ctl = ext->private_data;
+
+	if (ctl->elem == NULL || offset > 0)
+		return -EINVAL;
+	snd_ctl_elem_id_set_interface(id, SND_CTL_ELEM_IFACE_PCM);
+	snd_ctl_elem_id_set_name(id, ctl->elem);
+	return 0;
+}
+
+static snd_ctl_ext_key_t sim_ctl_find_elem(snd_ctl_ext_t *ext,
+					   const snd_ctl_elem_id_t *id)
+{
+	struct sim_ctl *ctl = ext->private_data;
+
+	if (ctl->elem == NULL ||
+	    snd_ctl_elem_id_get_interface(id) != SND_CTL_ELEM_IFACE_PCM ||
+	    strcmp(snd_ctl_elem_id_get_name(id), ctl->elem))
+		return SND_CTL_EXT_KEY_NOT_FOUND;
+	return 0;
+}
+
+static int sim_ctl_get_attribute(snd_ctl_ext_t *ext, snd_ctl_ext_key_t key,
+				 int *type, unsigned int *acc,
+				 unsigned int *count)
+{
+	*type = SND_CTL_ELEM_TYPE_INTEGER;
+	*acc = SND_CTL_EXT_ACCESS_READWRITE;
+	*count = 1;
+	return 0;
+}
+
+/* the nominal value of the element */
+static long sim_ctl_nominal(struct sim_ctl *ctl)
+{
+	return ctl->clock == &sim.capture ? 100000 : 1000000;
+}
+
+static int sim_ctl_get_integer_info(snd_ctl_ext_t *ext,
+				    snd_ctl_ext_key_t key,
+				    long *imin, long *imax, long *istep)
+{
+	struct sim_ctl *ctl = ext->private_data;
+
+	*imin = sim_ctl_nominal(ctl) / 2;
+	*imax = sim_ctl_nominal(ctl) * 2;
+	*istep = 1;
+	return 0;
+}
+
+static int sim_ctl_read_integer(snd_ctl_ext_t *ext, snd_ctl_ext_key_t key,
+				long *value)
+{
+	struct sim_ctl *ctl = ext->private_data;
+	struct sim_stream *s = ctl->clock;
+
+	/* rate shift slows down the stream, pitch speeds it up */
+	if (s == &sim.capture)
+		*value = sim_ctl_nominal(ctl) / s->speed;
+	else
+		*value = sim_ctl_nominal(ctl) * s->speed;
+	return 0;
+}
+
+static int sim_ctl_write_integer(snd_ctl_ext_t *ext, snd_ctl_ext_key_t key,
+				 long *value)
+{
+	struct sim_ctl *ctl = ext->private_data;
+	struct sim_stream *s = ctl->clock;
+	double speed;
+
+	if (*value <= 0)
+		return -EINVAL;
+	if (s == &sim.capture)
+		speed = (double)sim_ctl_nominal(ctl) / *value;
+	else
+		speed = (double)*value / sim_ctl_nominal(ctl);
+	if (speed == s->speed)
+		return 0;
+	/* keep the already elapsed frames at the old speed */
+	sim_update();
+	s->speed = speed;
+	return 1;
+}
+
+static void sim_ctl_subscribe_events(snd_ctl_ext_t *ext, int subscribe)
+{
+}
+
+static int sim_ctl_read_event(snd_ctl_ext_t *ext, snd_ctl_elem_id_t *id,
+			      unsigned int *event_mask)
+{
+	return -EAGAIN;
+}
+
+static void sim_ctl_close(snd_ctl_ext_t *ext)
+{
+	struct sim_ctl *ctl = ext->private_data;
+
+	close(ext->poll_fd);
+	free(ctl);
+}
+
+static const snd_ctl_ext_callback_t sim_ctl_callback = {
+	.elem_count = sim_ctl_elem_count,
+	.elem_list = sim_ctl_elem_list,
+	.find_elem = sim_ctl_find_elem,
+	.get_attribute = sim_ctl_get_attribute,
+	.get_integer_info = sim_ctl_get_integer_info,
+	.read_integer = sim_ctl_read_integer,
+	.write_integer = sim_ctl_write_integer,
+	.subscribe_events = sim_ctl_subscribe_events,
+	.read_event = sim_ctl_read_event,
+	.close = sim_ctl_close,
+};
+
+/* "sim:capture" or "sim:playback", see alsaloop-sim.c */
+static int sim_ctl_open(snd_ctl_t **ctlp, const char *name, int mode)
+{
+	struct sim_ctl *ctl;
+	int err;
+
+	ctl = calloc(1, sizeof(*ctl));
+	if (ctl == NULL)
+		return -ENOMEM;
+	if (strcmp(name, "sim:capture") == 0) {
+		ctl->clock = &sim.capture;
+		if (sim.shift == SIM_SHIFT_CAPTURE)
+			ctl->elem = "PCM Rate Shift 100000";
+	} else {
+		ctl->clock = &sim.playback;
+		if (sim.shift == SIM_SHIFT_PLAYBACK)
+			ctl->elem = "Playback Pitch 1000000";
+	}
+	if (ctl->clock->speed == 0)
+		ctl->clock->speed = 1.0;
+	ctl->ext.poll_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ctl->ext.poll_fd < 0) {
+		err = -errno;
+		free(ctl);
+		return err;
+	}
+	ctl->ext.version = SND_CTL_EXT_VERSION;
+	ctl->ext.card_idx = -1;
+	snprintf(ctl->ext.id, sizeof(ctl->ext.id), "sim");
+	snprintf(ctl->ext.driver, sizeof(ctl->ext.driver), "alsaloop-sim");
+	snprintf(ctl->ext.name, sizeof(ctl->ext.name), "%s", name);
+	snprintf(ctl->ext.longname, sizeof(ctl->ext.longname),
+		 "alsaloop simulated %s", name);
+	snprintf(ctl->ext.mixername, sizeof(ctl->ext.mixername), "%s", name);
+	ctl->ext.callback = &sim_ctl_callback;
+	ctl->ext.private_data = ctl;
+	err = snd_ctl_ext_create(&ctl->ext, name, mode);
+	if (err < 0) {
+		close(ctl->ext.poll_fd);
+		free(ctl);
+		return err;
+	}
+	*ctlp = ctl->ext.handle;
+	return 0;
+}
+
+static int sim_gettime(struct timeval *tv)
+{
+	tv->tv_sec = sim.time;
+	tv->tv_usec = (sim.time - tv->tv_sec) * 1000000;
+	return 0;
+}
+
+const struct loopback_ops sim_ops = {
+	.pcm_open = sim_pcm_open,
+	.ctl_open = sim_ctl_open,
+	.gettime = sim_gettime,
+};
@@ -0,0 +1,61 @@
+/*
+ *  Simulated PCM devices for the offline alsaloop test harness
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdint.h>
+
+struct loopback_ops;
+struct sim_pcm;
+
+/* rate shift control emulation */
+enum {
+	SIM_SHIFT_NONE = 0,
+	SIM_SHIFT_CAPTURE,	/* "PCM Rate Shift 100000" on capture */
+	SIM_SHIFT_PLAYBACK,	/* "Playback Pitch 1000000" on playback */
+};
+
+struct sim_stream {
+	double drift;			/* clock drift in ppm */
+	double speed;			/* rate shift set by alsaloop */
+	unsigned int granularity;	/* hw pointer granularity in frames */
+	struct sim_pcm *pcm;
+	unsigned int xruns;
+};
+
+struct sim_config {
+	double time;			/* virtual time in seconds */
+	int shift;			/* SIM_SHIFT_* */
+	struct sim_stream capture;
+	struct sim_stream playback;
+	/* capture source, called for each produced frame */
+	void (*produce)(void *frame, unsigned int channels);
+	/* playback sink, called for each consumed frame */
+	void (*consume)(const void *frame, unsigned int channels);
+};
+
+extern struct sim_config sim;
+
+/* device and clock access for pcmjob.c, see pcmjob_set_ops() */
+extern const struct loopback_ops sim_ops;
+
+/* virtual time of the next poll wake-up */
+double sim_next_wakeup(void);
+/* advance the hardware pointers to the current virtual time */
+void sim_update(void);
+/* force an xrun on the given stream */
+void sim_xrun(snd_pcm_stream_t stream);
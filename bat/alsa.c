@@ -317,6 +317,7 @@ static int write_to_pcm(const struct pcm_container *sndpcm,
 		} else if (err == -EPIPE) {
 			fprintf(bat->err, _("Underrun: %s(%d)\n"),
 					snd_strerror(err), err);
+			bat->underruns++;
 			if (bat->roundtriplatency)
 				bat->latency.xrun_error = true;
 			snd_pcm_prepare(sndpcm->handle);
@@ -419,6 +420,10 @@ static int write_to_pcm_loop(struct pcm_container *sndpcm, struct bat *bat)
 				&& bat->periods_played >= bat->periods_total)
 			break;
 
+		/* live analysis is done or failed */
+		if (bat->ring && ring_stopped(bat->ring))
+			break;
+
 		err = write_to_pcm(sndpcm, frames, bat);
 		if (err != 0)
 			break;
@@ -522,6 +527,7 @@ static int read_from_pcm(struct pcm_container *sndpcm,
 			snd_pcm_prepare(sndpcm->handle);
 			fprintf(bat->err, _("Overrun: %s(%d)\n"),
 					snd_strerror(err), err);
+			bat->overruns++;
 			if (bat->roundtriplatency)
 				bat->latency.xrun_error = true;
 		} else if (err == -ESTRPIPE) {
@@ -584,6 +590,10 @@ static int read_from_pcm_loop(struct pcm_container *sndpcm, struct bat *bat)
 			break;
 		}
 
+		/* hand the chunk to the live analysis */
+		if (bat->ring)
+			ring_write(bat->ring, sndpcm->buffer, size);
+
 		bytes_read += size;
 		remain -= size;
 		bat->periods_played++;
@@ -593,6 +603,9 @@ static int read_from_pcm_loop(struct pcm_container *sndpcm, struct bat *bat)
 			break;
 	}
 
+	if (bat->ring)
+		ring_close(bat->ring);
+
 	update_wav_header(bat, fp, bytes_read);
 
 	fclose(fp);
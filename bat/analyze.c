@@ -13,13 +13,18 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include <math.h>
+#include <float.h>
 #include <fftw3.h>
 
 #include "aconfig.h"
@@ -27,33 +32,186 @@
 
 #include "common.h"
 #include "bat-signal.h"
+#include "results.h"
 
-static void check_amplitude(struct bat *bat, float *buf)
+/* lowest frequency of the test signal, 0 for the MLS noise */
+static float lowest_frequency(struct bat *bat, int channel)
 {
-	float sum, average, amplitude;
-	int i, percent;
+	switch (bat->signal) {
+	case BAT_SIGNAL_MULTITONE:
+		return bat->tone_freq[0];
+	case BAT_SIGNAL_SWEEP:
+		return SWEEP_LOW;
+	case BAT_SIGNAL_MLS:
+		return 0.0;
+	default:
+		return bat->target_freq[channel];
+	}
+}
+
+/* a run of one repeated value, long enough to be a dropout */
+struct held_run {
+	int length;
+	bool zero;
+};
+
+/*
+ * One pass over the channel for the time domain statistics. Samples at
+ * the format limits are clipped.
+ *
+ * A run of one repeated value is a dropout: the stale data an xrun
+ * leaves in the stream, or a zero run for the silence. A sine of
+ * amplitude A (in steps) and frequency f holds one value for up to
+ * sqrt(2 / A) / (pi * f) seconds around its peaks, so the shortest
+ * dropout is twice that, and at least DROPOUT_MS. The amplitude is known
+ * at the end only, so the runs of at least DROPOUT_MS are kept and
+ * judged then. The runs at the start and the end are the latency and the
+ * end of the playback, not dropouts, and a run held at full scale is
+ * counted as clipping.
+ */
+static int signal_statistics(struct bat *bat, const float *buf, int n,
+		int channel, struct signal_stats *s)
+{
+	float full = ldexpf(1.0, (bat->sample_size << 3) - 1);
+	float zero = bat->format == BAT_PCM_FORMAT_U8 ? full : 0.0;
+	float lo = zero - full, hi = zero + full - 1.0;
+	float min = FLT_MAX, max = -FLT_MAX, x, freq;
+	double sum = 0.0, sumsq = 0.0, mean, var;
+	int dropout = bat->rate * DROPOUT_MS / 1000;
+	int i, held, clip = 0, hold = 0, hold_start = 0;
+	struct held_run *runs = NULL, *r;
+	int nruns = 0, maxruns = 0;
+
+	memset(s, 0, sizeof(*s));
+
+	for (i = 0; i < n; i++) {
+		x = buf[i];
+		sum += x;
+		sumsq += (double) x * x;
+		if (x < min)
+			min = x;
+		if (x > max)
+			max = x;
+
+		if (x <= lo || x >= hi) {
+			s->clipped++;
+			clip++;
+		} else {
+			if (clip >= CLIP_RUN_MIN) {
+				s->clip_runs++;
+				if (clip > s->clip_longest)
+					s->clip_longest = clip;
+			}
+			clip = 0;
+		}
+
+		if (i > 0 && x == buf[i - 1]) {
+			hold++;
+			continue;
+		}
+		if (hold_start > 0 && hold >= dropout && buf[hold_start] > lo
+				&& buf[hold_start] < hi) {
+			if (nruns == maxruns) {
+				maxruns = maxruns ? maxruns * 2 : 64;
+				r = realloc(runs, maxruns * sizeof(*runs));
+				if (r == NULL) {
+					free(runs);
+					return -ENOMEM;
+				}
+				runs = r;
+			}
+			runs[nruns].length = hold;
+			runs[nruns++].zero = buf[hold_start] == zero;
+		}
+		hold = 1;
+		hold_start = i;
+	}
+	if (clip >= CLIP_RUN_MIN) {
+		s->clip_runs++;
+		if (clip > s->clip_longest)
+			s->clip_longest = clip;
+	}
 
-	/* calculate average value */
-	for (i = 0, sum = 0.0, average = 0.0; i < bat->frames; i++)
-		sum += buf[i];
-	average = sum / bat->frames;
+	if (n == 0)
+		goto out;
+	mean = sum / n;
+	var = sumsq / n - mean * mean;
+	s->rms = var > 0.0 ? sqrt(var) : 0.0;
+	s->peak = fmaxf(max - mean, mean - min);
+	s->crest_db = s->rms > 0.0 ? 20.0 * log10f(s->peak / s->rms) : 0.0;
+	s->dc = mean - zero;
+
+	/* a signal below one step holds its value all the time */
+	if (s->peak < 1.0)
+		goto out;
+	freq = lowest_frequency(bat, channel);
+	if (freq > 0.0) {
+		held = 2.0 * bat->rate * sqrtf(2.0 / s->peak) / (M_PI * freq);
+		if (held > dropout)
+			dropout = held;
+	}
+	for (r = runs; r < runs + nruns; r++) {
+		if (r->length < dropout)
+			continue;
+		if (r->zero) {
+			s->zero_runs++;
+			if (r->length > s->zero_longest)
+				s->zero_longest = r->length;
+		} else {
+			s->dropouts++;
+			if (r->length > s->dropout_longest)
+				s->dropout_longest = r->length;
+		}
+	}
+out:
+	free(runs);
+	return 0;
+}
 
-	/* calculate peak-to-average amplitude */
-	for (i = 0, sum = 0.0; i < bat->frames; i++)
-		sum += fabsf(buf[i] - average);
-	amplitude = sum / bat->frames * M_PI / 2.0;
+static int check_amplitude(struct bat *bat, float *buf, int channel)
+{
+	struct signal_stats s;
+	float amplitude;
+	int percent, err;
+
+	err = signal_statistics(bat, buf, bat->frames, channel, &s);
+	if (err < 0)
+		return err;
+	results_stats(bat, channel, &s);
+
+	/* amplitude of the sine of the same rms */
+	amplitude = s.rms * M_SQRT2;
 
 	/* calculate amplitude percentage against full range */
-	percent = amplitude * 100 / ((1 << ((bat->sample_size << 3) - 1)) - 1);
+	percent = amplitude * 100 / (ldexpf(1.0, (bat->sample_size << 3) - 1)
+			- 1.0);
 
 	fprintf(bat->log, _("Amplitude: %.1f; Percentage: [%d]\n"),
 			amplitude, percent);
+	fprintf(bat->log, _("Peak: %.1f; RMS: %.1f; Crest factor: %.2f dB; DC offset: %.1f\n"),
+			s.peak, s.rms, s.crest_db, s.dc);
 	if (percent < 0)
 		fprintf(bat->err, _("ERROR: Amplitude can't be negative!\n"));
 	else if (percent < 1)
 		fprintf(bat->err, _("WARNING: Signal too weak!\n"));
 	else if (percent > 100)
 		fprintf(bat->err, _("WARNING: Signal overflow!\n"));
+
+	if (s.clip_runs > 0)
+		fprintf(bat->err, _("WARNING: %d clipped samples in %d runs, longest %d frames\n"),
+				s.clipped, s.clip_runs, s.clip_longest);
+	if (s.dropouts > 0)
+		fprintf(bat->err, _(" FAIL: %d dropouts, longest %.1f ms\n"),
+				s.dropouts, s.dropout_longest * 1000.0
+				/ bat->rate);
+	if (s.zero_runs > 0)
+		fprintf(bat->err, _(" FAIL: %d zero runs, longest %.1f ms\n"),
+				s.zero_runs, s.zero_longest * 1000.0
+				/ bat->rate);
+	if (s.dropouts > 0 || s.zero_runs > 0)
+		return -EDROPOUT;
+
+	return 0;
 }
 
 /**
@@ -73,6 +231,8 @@ int check_peak(struct bat *bat, struct analyze *a, int end, int peak, float hz,
 
 	fprintf(bat->log, _("Detected peak at %2.2f Hz of %2.2f dB\n"), hz_peak,
 			10.0 * log10f(a->mag[peak] / mean));
+	results_peak(bat, channel, hz_peak,
+			10.0 * log10f(a->mag[peak] / mean));
 	fprintf(bat->log, _(" Total %3.1f dB from %2.2f to %2.2f Hz\n"),
 			10.0 * log10f(p / mean), start * hz, end * hz);
 
@@ -101,12 +261,12 @@ int check_peak(struct bat *bat, struct analyze *a, int end, int peak, float hz,
 /**
  * Search for main frequencies in fft results and compare it to target
  */
-static int check(struct bat *bat, struct analyze *a, int channel)
+static int check(struct bat *bat, struct analyze *a, int channel, int frames)
 {
-	float hz = 1.0 / ((float) bat->frames / (float) bat->rate);
+	float hz = 1.0 / ((float) frames / (float) bat->rate);
 	float mean = 0.0, t, sigma = 0.0, p = 0.0;
 	int i, start = -1, end = -1, peak = 0, signals = 0;
-	int err = 0, N = bat->frames / 2;
+	int err = 0, N = frames / 2;
 
 	/* calculate mean */
 	for (i = 0; i < N; i++)
@@ -174,56 +334,236 @@ static void calc_magnitude(struct bat *bat, struct analyze *a, int N)
 	a->mag[0] = 0.0;
 }
 
-static int find_and_check_harmonics(struct bat *bat, struct analyze *a,
-		int channel)
+/*
+ * FFT plans are cached for the lifetime of the process and shared by all
+ * channels: planning with FFTW_MEASURE costs much more than the transform.
+ */
+struct fft_plan {
+	int n;
+	fftwf_r2r_kind kind;
+	fftwf_plan plan;
+	struct fft_plan *next;
+};
+
+static struct fft_plan *fft_plans;
+static bool fft_wisdom_loaded;
+
+static fftwf_plan get_fft_plan_kind(struct bat *bat, struct analyze *a,
+		int N, fftwf_r2r_kind kind)
 {
-	fftwf_plan p;
-	int err = -ENOMEM, N = bat->frames;
+	struct fft_plan *fp;
+
+	for (fp = fft_plans; fp != NULL; fp = fp->next)
+		if (fp->n == N && fp->kind == kind)
+			return fp->plan;
+
+	/* load previously measured plans, so FFTW_MEASURE is cheap */
+	if (bat->wisdom && !fft_wisdom_loaded) {
+		fft_wisdom_loaded = true;
+		if (fftwf_import_wisdom_from_filename(bat->wisdom))
+			fprintf(bat->log, _("Loaded FFTW wisdom from %s\n"),
+					bat->wisdom);
+	}
 
-	/* Allocate FFT buffers */
-	a->in = (float *) fftwf_malloc(sizeof(float) * bat->frames);
-	if (a->in == NULL)
-		goto out1;
+	fp = malloc(sizeof(*fp));
+	if (fp == NULL)
+		return NULL;
 
-	a->out = (float *) fftwf_malloc(sizeof(float) * bat->frames);
-	if (a->out == NULL)
-		goto out2;
+	/* measuring overwrites the buffers, so this must run before
+	 * any data is put into them */
+	fp->plan = fftwf_plan_r2r_1d(N, a->in, a->out, kind,
+			FFTW_MEASURE | FFTW_PRESERVE_INPUT);
+	if (fp->plan == NULL) {
+		free(fp);
+		return NULL;
+	}
+	fp->n = N;
+	fp->kind = kind;
+	fp->next = fft_plans;
+	fft_plans = fp;
 
-	a->mag = (float *) fftwf_malloc(sizeof(float) * bat->frames);
-	if (a->mag == NULL)
-		goto out3;
+	if (bat->wisdom && !fftwf_export_wisdom_to_filename(bat->wisdom))
+		fprintf(bat->err, _("Cannot save FFTW wisdom to %s\n"),
+				bat->wisdom);
 
-	/* create FFT plan */
-	p = fftwf_plan_r2r_1d(N, a->in, a->out, FFTW_R2HC,
-			FFTW_MEASURE | FFTW_PRESERVE_INPUT);
+	return fp->plan;
+}
+
+static fftwf_plan get_fft_plan(struct bat *bat, struct analyze *a, int N)
+{
+	return get_fft_plan_kind(bat, a, N, FFTW_R2HC);
+}
+
+void analyze_cleanup(void)
+{
+	struct fft_plan *fp;
+
+	while (fft_plans) {
+		fp = fft_plans;
+		fft_plans = fp->next;
+		fftwf_destroy_plan(fp->plan);
+		free(fp);
+	}
+	fftwf_cleanup();
+	fft_wisdom_loaded = false;
+}
+
+static void free_fft_buffers(struct analyze *a)
+{
+	fftwf_free(a->mag);
+	fftwf_free(a->out);
+	fftwf_free(a->in);
+	a->in = a->out = a->mag = NULL;
+}
+
+static int alloc_fft_buffers(struct analyze *a, int N)
+{
+	a->in = (float *) fftwf_malloc(sizeof(float) * N);
+	a->out = (float *) fftwf_malloc(sizeof(float) * N);
+	a->mag = (float *) fftwf_malloc(sizeof(float) * N);
+	if (a->in == NULL || a->out == NULL || a->mag == NULL) {
+		free_fft_buffers(a);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/* FFT size for the correlation of nx samples with a reference of nref */
+static int xcorr_size(int nx, int nref)
+{
+	int n = 1;
+
+	while (n < nx + nref)
+		n <<= 1;
+
+	return n;
+}
+
+/* create the correlation plans before the measurement, planning is slow */
+int xcorr_prepare(struct bat *bat, int nx, int nref)
+{
+	struct analyze a;
+	int err, n = xcorr_size(nx, nref);
+
+	err = alloc_fft_buffers(&a, n);
+	if (err < 0)
+		return err;
+
+	if (get_fft_plan_kind(bat, &a, n, FFTW_R2HC) == NULL
+			|| get_fft_plan_kind(bat, &a, n, FFTW_HC2R) == NULL)
+		err = -ENOMEM;
+
+	free_fft_buffers(&a);
+	return err;
+}
+
+/**
+ * Find the delay of ref in x by FFT cross-correlation, refined to a
+ * fraction of a frame by a parabola through the peak and its neighbours.
+ * The peak ratio is the correlation peak over its rms, in dB.
+ *
+ * @return 0 on success, -ENOPEAK if no correlation peak was found
+ */
+int xcorr_delay(struct bat *bat, float *x, int nx, float *ref, int nref,
+		float *delay, float *peak_db)
+{
+	struct analyze a;
+	fftwf_plan fwd, inv;
+	float re, im, y0, y1, y2, d;
+	double sum = 0.0;
+	int i, peak = 0, lags = nx - nref + 1;
+	int n = xcorr_size(nx, nref);
+	int err;
+
+	if (lags < 3)
+		return -EINVAL;
+
+	err = alloc_fft_buffers(&a, n);
+	if (err < 0)
+		return err;
+
+	fwd = get_fft_plan_kind(bat, &a, n, FFTW_R2HC);
+	inv = get_fft_plan_kind(bat, &a, n, FFTW_HC2R);
+	if (fwd == NULL || inv == NULL) {
+		err = -ENOMEM;
+		goto exit;
+	}
+
+	/* spectrum of the reference, kept in mag */
+	memset(a.in, 0, sizeof(float) * n);
+	memcpy(a.in, ref, sizeof(float) * nref);
+	fftwf_execute_r2r(fwd, a.in, a.mag);
+
+	memset(a.in, 0, sizeof(float) * n);
+	memcpy(a.in, x, sizeof(float) * nx);
+	fftwf_execute_r2r(fwd, a.in, a.out);
+
+	/* X * conj(REF), in the half complex layout */
+	a.in[0] = a.out[0] * a.mag[0];
+	a.in[n / 2] = a.out[n / 2] * a.mag[n / 2];
+	for (i = 1; i < n / 2; i++) {
+		re = a.out[i] * a.mag[i] + a.out[n - i] * a.mag[n - i];
+		im = a.out[n - i] * a.mag[i] - a.out[i] * a.mag[n - i];
+		a.in[i] = re;
+		a.in[n - i] = im;
+	}
+	fftwf_execute_r2r(inv, a.in, a.out);
+
+	/* only the lags where the whole reference is inside x */
+	for (i = 0; i < lags; i++) {
+		a.out[i] = fabsf(a.out[i]);
+		sum += a.out[i] * a.out[i];
+		if (a.out[i] > a.out[peak])
+			peak = i;
+	}
+	*peak_db = 10.0 * log10f(a.out[peak] * a.out[peak]
+			/ (sum / lags + FLT_MIN) + FLT_MIN);
+
+	if (peak == 0 || peak == lags - 1 || *peak_db < XCORR_MIN_PEAK_DB) {
+		err = -ENOPEAK;
+		goto exit;
+	}
+
+	y0 = a.out[peak - 1];
+	y1 = a.out[peak];
+	y2 = a.out[peak + 1];
+	d = y0 - 2.0 * y1 + y2;
+	*delay = peak + (d != 0.0 ? 0.5 * (y0 - y2) / d : 0.0);
+
+exit:
+	free_fft_buffers(&a);
+	return err;
+}
+
+static int find_and_check_harmonics(struct bat *bat, struct analyze *a,
+		int channel)
+{
+	fftwf_plan p;
+	int N = bat->frames;
+	int err, dropout;
+
+	/* get (or create) the FFT plan */
+	p = get_fft_plan(bat, a, N);
 	if (p == NULL)
-		goto out4;
+		return -ENOMEM;
 
 	/* convert source PCM to floats */
 	bat->convert_sample_to_float(a->buf, a->in, bat->frames);
 
-	/* check amplitude */
-	check_amplitude(bat, a->in);
+	/* check amplitude, clipping and dropouts */
+	dropout = check_amplitude(bat, a->in, channel);
 
 	/* run FFT */
-	fftwf_execute(p);
+	fftwf_execute_r2r(p, a->in, a->out);
 
 	/* FFT out is real and imaginary numbers - calc magnitude for each */
 	calc_magnitude(bat, a, N);
 
 	/* check data */
-	err = check(bat, a, channel);
-
-	fftwf_destroy_plan(p);
+	err = check(bat, a, channel, N);
 
-out4:
-	fftwf_free(a->mag);
-out3:
-	fftwf_free(a->out);
-out2:
-	fftwf_free(a->in);
-out1:
-	return err;
+	return err != 0 ? err : dropout;
 }
 
 static int calculate_noise_one_period(struct bat *bat,
@@ -361,6 +701,7 @@ static int calculate_noise(struct bat *bat, float *src, int channel)
 	avg_snr_db = 20.0 * log10f(100.0 / avg_snr_pc);
 	fprintf(bat->log, _("Average SNR is %.2f dB (%.2f %%) at %d points.\n"),
 			avg_snr_db, avg_snr_pc, cnt_clean);
+	results_snr(bat, channel, avg_snr_db);
 
 out3:
 	free(na.target);
@@ -434,12 +775,959 @@ static int truncate_frames(struct bat *bat)
 	return -EINVAL;
 }
 
-int analyze_capture(struct bat *bat)
+/* peak tolerance, the same as for the single sine wave */
+static float peak_tolerance(float freq)
 {
+	float delta_rate = DELTA_RATE * freq;
+
+	return delta_rate > DELTA_HZ ? delta_rate : DELTA_HZ;
+}
+
+/*
+ * Measure each tone of a multi-tone signal: level relative to the
+ * strongest tone, and THD+N as the power found in the band between the
+ * neighbouring tones, outside the tone itself.
+ */
+static int check_tones(struct bat *bat, struct analyze *a, int channel,
+		int N)
+{
+	float hz = (float) bat->rate / N;
+	float level[MAX_TONES], thdn[MAX_TONES], found[MAX_TONES];
+	float max_level = -INFINITY, tone, noise;
+	int k, i, bin, peak, low, high;
 	int err = 0;
-	size_t items;
+
+	for (k = 0; k < bat->tones; k++) {
+		/* strongest bin next to the nominal frequency */
+		bin = lrintf(bat->tone_freq[k] / hz);
+		low = bin - TONE_BINS > 1 ? bin - TONE_BINS : 1;
+		high = bin + TONE_BINS < N / 2 ? bin + TONE_BINS : N / 2 - 1;
+		for (i = peak = low; i <= high; i++)
+			if (a->mag[i] > a->mag[peak])
+				peak = i;
+
+		/* the band reaches half way to the neighbouring tones */
+		low = k == 0 ? ceilf(DC_THRESHOLD / hz) : lrintf(
+				(bat->tone_freq[k - 1] + bat->tone_freq[k])
+				/ 2.0 / hz);
+		high = k == bat->tones - 1 ? N / 2 - 1 : lrintf(
+				(bat->tone_freq[k] + bat->tone_freq[k + 1])
+				/ 2.0 / hz);
+
+		for (i = low, tone = noise = 0.0; i < high; i++) {
+			if (i >= peak - TONE_BINS && i <= peak + TONE_BINS)
+				tone += a->mag[i] * a->mag[i];
+			else
+				noise += a->mag[i] * a->mag[i];
+		}
+
+		found[k] = peak * hz;
+		level[k] = 10.0 * log10f(tone + FLT_MIN);
+		thdn[k] = 10.0 * log10f((noise + FLT_MIN) / (tone + FLT_MIN));
+		if (level[k] > max_level)
+			max_level = level[k];
+	}
+
+	for (k = 0; k < bat->tones; k++) {
+		fprintf(bat->log, _("Tone %2d: %8.2f Hz, peak at %8.2f Hz,"),
+				k + 1, bat->tone_freq[k], found[k]);
+		fprintf(bat->log, _(" level %6.2f dB, THD+N %7.2f dB\n"),
+				level[k] - max_level, thdn[k]);
+		results_tone(bat, channel, k, level[k] - max_level, thdn[k]);
+
+		if (thdn[k] >= 0.0) {
+			fprintf(bat->err, _(" FAIL: Tone %2.2f Hz not found\n"),
+					bat->tone_freq[k]);
+			err = err ? err : -ENOPEAK;
+		} else if (fabsf(found[k] - bat->tone_freq[k])
+				> peak_tolerance(bat->tone_freq[k]) + hz) {
+			fprintf(bat->err, _(" FAIL: Tone %2.2f Hz found at %2.2f Hz\n"),
+					bat->tone_freq[k], found[k]);
+			err = err ? err : -EBADPEAK;
+		} else if (snr_is_valid(bat->snr_thd_db)
+				&& -thdn[k] < bat->snr_thd_db) {
+			fprintf(bat->err, _(" FAIL: THD+N of tone %2.2f Hz above threshold\n"),
+					bat->tone_freq[k]);
+			err = err ? err : -ELOWSNR;
+		}
+	}
+
+	if (err == 0)
+		fprintf(bat->log, _(" PASS: All %d tones detected\n"),
+				bat->tones);
+
+	return err;
+}
+
+static int analyze_multitone(struct bat *bat, struct analyze *a,
+		int channel)
+{
+	fftwf_plan p;
+	double w;
+	int i, err, dropout, N = bat->frames;
+
+	p = get_fft_plan(bat, a, N);
+	if (p == NULL)
+		return -ENOMEM;
+
+	bat->convert_sample_to_float(a->buf, a->in, N);
+	dropout = check_amplitude(bat, a->in, channel);
+
+	/* the tones are not periodic in the FFT size, use a 4 term
+	 * Blackman-Harris window to keep the leakage out of the THD+N bands */
+	for (i = 0; i < N; i++) {
+		w = 2.0 * M_PI * i / N;
+		a->in[i] *= 0.35875 - 0.48829 * cos(w) + 0.14128 * cos(2 * w)
+				- 0.01168 * cos(3 * w);
+	}
+
+	fftwf_execute_r2r(p, a->in, a->out);
+	calc_magnitude(bat, a, N);
+
+	err = check_tones(bat, a, channel, N);
+
+	return err != 0 ? err : dropout;
+}
+
+/*
+ * The periodic signals are analyzed over two periods at the end of the
+ * capture: the difference between the two periods is the noise, and
+ * the spectrum of one period against the reference period is the
+ * frequency response. Any period long cut of a periodic signal is a
+ * circular shift of it, so the latency doesn't matter.
+ */
+static float periodic_snr(struct bat *bat, float *x, int period)
+{
+	double mean = 0.0, power = 0.0, noise = 0.0, d;
+	int i;
+
+	for (i = 0; i < 2 * period; i++)
+		mean += x[i];
+	mean /= 2 * period;
+
+	for (i = 0; i < period; i++) {
+		power += (x[i] - mean) * (x[i] - mean);
+		power += (x[i + period] - mean) * (x[i + period] - mean);
+		d = x[i + period] - x[i];
+		noise += d * d;
+	}
+	/* the difference holds the noise of both periods */
+	power /= 2.0;
+	noise /= 2.0;
+	power -= noise;
+
+	if (power <= 0.0)
+		return 0.0;
+	if (noise <= 0.0)
+		return SNR_DB_MAX;
+	return 10.0 * log10(power / noise);
+}
+
+static int check_response(struct bat *bat, float *ref, float *mag,
+		int period)
+{
+	float hz = (float) bat->rate / period;
+	float f_low = SWEEP_LOW, f_high = bat->rate * RATE_FACTOR;
+	float fc, gain, ref_gain = NAN;
+	float full_scale = (ldexpf(1.0, (bat->sample_size << 3) - 1) - 1.0)
+			* RANGE_FACTOR;
+	double sx, sr;
+	int i, pass, low, high, err = 0;
+
+	/* octave bands from 31.25 Hz, relative to the 1 kHz band */
+	for (pass = 0; pass < 2; pass++) {
+		for (fc = 1000.0 / 32; fc * M_SQRT2 <= f_high; fc *= 2.0) {
+			if (fc / M_SQRT2 < f_low)
+				continue;
+			low = ceilf(fc / M_SQRT2 / hz);
+			high = floorf(fc * M_SQRT2 / hz);
+			for (i = low, sx = sr = 0.0; i <= high && i < period / 2;
+					i++) {
+				sx += mag[i] * mag[i];
+				sr += ref[i] * ref[i];
+			}
+			gain = 10.0 * log10((sx + FLT_MIN) / (sr + FLT_MIN));
+
+			if (pass == 0) {
+				if (isnan(ref_gain) || fc == 1000.0)
+					ref_gain = gain;
+				continue;
+			}
+
+			fprintf(bat->log, _("Band %7.1f Hz: %6.2f dB\n"), fc,
+					gain - ref_gain);
+			if (fabsf(gain - ref_gain) > RESPONSE_TOLERANCE_DB) {
+				fprintf(bat->err, _(" FAIL: Band %2.1f Hz out of range\n"),
+						fc);
+				err = -EBADRESPONSE;
+			}
+		}
+		/* the reference has the full scale peak magnitude */
+		if (pass == 0)
+			fprintf(bat->log, _("Gain at 1 kHz: %.2f dB\n"),
+					ref_gain - 20.0 * log10f(full_scale));
+	}
+
+	return err;
+}
+
+static int analyze_periodic(struct bat *bat, struct analyze *a,
+		int channel)
+{
+	fftwf_plan p;
+	float *x, *ref;
+	float snr;
+	int period = signal_period(bat);
+	int offset = bat->frames - 2 * period;
+	int err, dropout;
+
+	if (offset < 0) {
+		fprintf(bat->err, _("Need at least %d frames for analysis\n"),
+				2 * period);
+		return -EINVAL;
+	}
+
+	p = get_fft_plan(bat, a, period);
+	if (p == NULL)
+		return -ENOMEM;
+
+	x = malloc(sizeof(float) * bat->frames);
+	ref = malloc(sizeof(float) * period);
+	if (x == NULL || ref == NULL) {
+		err = -ENOMEM;
+		goto exit;
+	}
+
+	bat->convert_sample_to_float(a->buf, x, bat->frames);
+	dropout = check_amplitude(bat, x, channel);
+
+	snr = periodic_snr(bat, x + offset, period);
+	fprintf(bat->log, _("Period of %d frames, SNR %.2f dB\n"), period,
+			snr);
+	results_snr(bat, channel, snr);
+	if (snr < PERIODIC_SNR_MIN_DB) {
+		fprintf(bat->err, _(" FAIL: No periodic signal detected\n"));
+		err = -ENOPEAK;
+		goto exit;
+	}
+	if (snr_is_valid(bat->snr_thd_db) && snr < bat->snr_thd_db) {
+		fprintf(bat->err, _(" FAIL: SNR below threshold\n"));
+		err = -ELOWSNR;
+		goto exit;
+	}
+
+	/* spectrum of the reference period */
+	err = generate_signal_period(bat, a->in);
+	if (err != 0)
+		goto exit;
+	fftwf_execute_r2r(p, a->in, a->out);
+	calc_magnitude(bat, a, period);
+	memcpy(ref, a->mag, sizeof(float) * (period / 2));
+
+	/* spectrum of the last captured period */
+	memcpy(a->in, x + offset + period, sizeof(float) * period);
+	fftwf_execute_r2r(p, a->in, a->out);
+	calc_magnitude(bat, a, period);
+
+	err = check_response(bat, ref, a->mag, period);
+	if (err == 0)
+		fprintf(bat->log, _(" PASS: Frequency response in range\n"));
+	if (err == 0)
+		err = dropout;
+
+exit:
+	free(ref);
+	free(x);
+	return err;
+}
+
+/* analyze one channel of a multi-tone, sweep or MLS capture */
+static int analyze_test_signal(struct bat *bat, struct analyze *a, int c)
+{
+	static const char *const names[] = {
+		[BAT_SIGNAL_MULTITONE] = "multi-tone",
+		[BAT_SIGNAL_SWEEP] = "sweep",
+		[BAT_SIGNAL_MLS] = "MLS",
+	};
+
+	fprintf(bat->log, _("\nChannel %i - "), c + 1);
+	fprintf(bat->log, _("Checking %s signal\n"), names[bat->signal]);
+
+	if (bat->signal == BAT_SIGNAL_MULTITONE)
+		return analyze_multitone(bat, a, c);
+
+	return analyze_periodic(bat, a, c);
+}
+
+/* create the plans up front, planning is not thread safe */
+static int prepare_fft_plans(struct bat *bat, struct analyze *a)
+{
+	if (get_fft_plan(bat, a, bat->frames) == NULL)
+		return -ENOMEM;
+	if ((bat->signal == BAT_SIGNAL_SWEEP || bat->signal == BAT_SIGNAL_MLS)
+			&& signal_period(bat) <= bat->frames
+			&& get_fft_plan(bat, a, signal_period(bat)) == NULL)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static int check_channel(struct bat *bat, struct analyze *a, int c)
+{
+	int err;
+
+	a->buf = bat->buf +
+			c * bat->frames * bat->frame_size
+			/ bat->channels;
+	if (bat->signal != BAT_SIGNAL_SINE)
+		return bat->standalone ? 0 : analyze_test_signal(bat, a, c);
+
+	fprintf(bat->log, _("\nChannel %i - "), c + 1);
+	fprintf(bat->log, _("Checking for target frequency %2.2f Hz\n"),
+			bat->target_freq[c]);
+	if (!bat->standalone) {
+		err = find_and_check_harmonics(bat, a, c);
+		if (err != 0)
+			return err;
+	}
+
+	if (snr_is_valid(bat->snr_thd_db)) {
+		fprintf(bat->log, _("\nChecking for SNR: "));
+		fprintf(bat->log, _("Threshold is %.2f dB (%.2f%%)\n"),
+				bat->snr_thd_db, 100.0
+				/ powf(10.0, bat->snr_thd_db / 20.0));
+		err = find_and_check_noise(bat, a->buf, c);
+		if (err != 0)
+			return err;
+	}
+
+	return 0;
+}
+
+/* analyze one channel, the FFT buffers are provided by the caller */
+static int analyze_channel(struct bat *bat, struct analyze *a, int c)
+{
+	int err = check_channel(bat, a, c);
+
+	results_channel(bat, c, err);
+	return err;
+}
+
+static int analyze_channels(struct bat *bat)
+{
+	struct analyze a = { NULL };
+	int c, err = 0;
+
+	/* FFT buffers are shared by all channels */
+	if (!bat->standalone) {
+		err = alloc_fft_buffers(&a, bat->frames);
+		if (err != 0)
+			return err;
+	}
+
+	for (c = 0; c < bat->channels; c++) {
+		err = analyze_channel(bat, &a, c);
+		if (err != 0)
+			break;
+	}
+
+	free_fft_buffers(&a);
+	return err;
+}
+
+/*
+ * Parallel analysis: the channels are handed out to a pool of worker
+ * threads. Every channel records its log and error writes in order,
+ * they are replayed in channel order once all workers are done, so the
+ * output and the results are the same as for the sequential analysis.
+ */
+struct job_record {
+	struct job_record *next;
+	bool err;			/* written to the error stream */
+	size_t size;
+	char data[];
+};
+
+struct analyze_job;
+
+struct job_stream {
+	struct analyze_job *job;
+	bool err;
+};
+
+struct analyze_job {
+	struct bat bat;			/* copy with private log streams */
+	int err;
+	bool done;
+	struct job_stream log;
+	struct job_stream error;
+	struct job_record *records;
+	struct job_record **tail;
+};
+
+struct analyze_worker {
+	pthread_t id;
+	struct analyze a;		/* FFT buffers of this worker */
+	struct analyze_pool *pool;
+};
+
+struct analyze_pool {
+	struct analyze_job *jobs;
+	int channels;
+	int next;
+	int failed;			/* first failed channel */
+	pthread_mutex_t lock;
+};
+
+static void *analyze_thread(void *arg)
+{
+	struct analyze_worker *w = arg;
+	struct analyze_pool *pool = w->pool;
+	struct analyze_job *job;
+	bool stop;
 	int c;
+
+	while (1) {
+		pthread_mutex_lock(&pool->lock);
+		c = pool->next++;
+		/* the channels after a failure are not analyzed */
+		stop = c >= pool->channels || c > pool->failed;
+		pthread_mutex_unlock(&pool->lock);
+		if (stop)
+			break;
+		job = &pool->jobs[c];
+		job->err = check_channel(&job->bat, &w->a, c);
+		job->done = true;
+		if (job->err != 0) {
+			pthread_mutex_lock(&pool->lock);
+			if (c < pool->failed)
+				pool->failed = c;
+			pthread_mutex_unlock(&pool->lock);
+		}
+	}
+
+	return NULL;
+}
+
+static ssize_t job_stream_write(void *cookie, const char *buf, size_t size)
+{
+	struct job_stream *s = cookie;
+	struct job_record *r;
+
+	r = malloc(sizeof(*r) + size);
+	if (r == NULL)
+		return -1;
+	r->next = NULL;
+	r->err = s->err;
+	r->size = size;
+	memcpy(r->data, buf, size);
+	*s->job->tail = r;
+	s->job->tail = &r->next;
+
+	return size;
+}
+
+static FILE *open_job_stream(struct analyze_job *job, struct job_stream *s,
+		bool err)
+{
+	cookie_io_functions_t io = { .write = job_stream_write };
+	FILE *fp;
+
+	s->job = job;
+	s->err = err;
+	fp = fopencookie(s, "w", io);
+	/* unbuffered, so the log and error writes keep their order */
+	if (fp != NULL)
+		setvbuf(fp, NULL, _IONBF, 0);
+
+	return fp;
+}
+
+static int open_job_streams(struct bat *bat, struct analyze_job *job)
+{
+	job->bat = *bat;
+	job->tail = &job->records;
+	job->bat.log = open_job_stream(job, &job->log, false);
+	if (job->bat.log == NULL)
+		return -errno;
+	if (bat->err == bat->log) {
+		job->bat.err = job->bat.log;
+		return 0;
+	}
+	job->bat.err = open_job_stream(job, &job->error, true);
+	if (job->bat.err == NULL) {
+		fclose(job->bat.log);
+		job->bat.log = NULL;
+		return -errno;
+	}
+
+	return 0;
+}
+
+static void close_job_streams(struct analyze_job *job)
+{
+	if (job->bat.err != NULL && job->bat.err != job->bat.log)
+		fclose(job->bat.err);
+	if (job->bat.log != NULL)
+		fclose(job->bat.log);
+	job->bat.log = job->bat.err = NULL;
+}
+
+static void flush_job(struct bat *bat, struct analyze_job *job)
+{
+	struct job_record *r;
+
+	for (r = job->records; r != NULL; r = r->next)
+		fwrite(r->data, 1, r->size, r->err ? bat->err : bat->log);
+}
+
+static void free_job(struct analyze_job *job)
+{
+	struct job_record *r;
+
+	close_job_streams(job);
+	while ((r = job->records) != NULL) {
+		job->records = r->next;
+		free(r);
+	}
+}
+
+static int analyze_channels_parallel(struct bat *bat, int threads)
+{
+	struct analyze_pool pool;
+	struct analyze_job *jobs;
+	struct analyze_worker *workers;
+	int c, i, started = 0, err = 0;
+	bool failed = false;
+
+	jobs = calloc(bat->channels, sizeof(*jobs));
+	workers = calloc(threads, sizeof(*workers));
+	if (jobs == NULL || workers == NULL) {
+		err = -ENOMEM;
+		goto exit1;
+	}
+
+	for (c = 0; c < bat->channels; c++) {
+		err = open_job_streams(bat, &jobs[c]);
+		if (err < 0)
+			goto exit2;
+	}
+
+	for (i = 0; i < threads; i++) {
+		workers[i].pool = &pool;
+		if (!bat->standalone) {
+			err = alloc_fft_buffers(&workers[i].a, bat->frames);
+			if (err < 0)
+				goto exit3;
+		}
+	}
+
+	/* FFTW planning is not thread safe, create the plan up front;
+	 * the workers only execute it on their own buffers */
+	if (!bat->standalone) {
+		err = prepare_fft_plans(bat, &workers[0].a);
+		if (err < 0)
+			goto exit3;
+	}
+
+	pool.jobs = jobs;
+	pool.channels = bat->channels;
+	pool.next = 0;
+	pool.failed = bat->channels;
+	pthread_mutex_init(&pool.lock, NULL);
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&workers[i].id, NULL, analyze_thread,
+				&workers[i]) != 0)
+			break;
+		started++;
+	}
+	/* the calling thread picks up the work if no worker started */
+	if (started == 0)
+		analyze_thread(&workers[0]);
+	for (i = 0; i < started; i++)
+		pthread_join(workers[i].id, NULL);
+	pthread_mutex_destroy(&pool.lock);
+
+	/* replay the output and record the results in channel order, up
+	 * to the first failing channel like the sequential analysis; the
+	 * measurements of the channels analyzed beyond it are dropped */
+	for (c = 0; c < bat->channels; c++) {
+		close_job_streams(&jobs[c]);
+		if (failed || !jobs[c].done) {
+			results_channel_clear(bat, c);
+			continue;
+		}
+		flush_job(bat, &jobs[c]);
+		results_channel(bat, c, jobs[c].err);
+		if (jobs[c].err != 0) {
+			err = jobs[c].err;
+			failed = true;
+		}
+	}
+
+exit3:
+	for (i = 0; i < threads; i++)
+		free_fft_buffers(&workers[i].a);
+exit2:
+	for (c = 0; c < bat->channels; c++)
+		free_job(&jobs[c]);
+exit1:
+	free(workers);
+	free(jobs);
+	return err;
+}
+
+static int get_analysis_threads(struct bat *bat)
+{
+	long threads = bat->threads;
+
+	if (threads == 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > bat->channels)
+		threads = bat->channels;
+
+	return threads > 1 ? threads : 1;
+}
+
+/*
+ * Streaming analysis: the capture is fed in hops of bat->segment / 2
+ * frames. Every Hann windowed segment (50% overlap) is checked for the
+ * target frequency on its own, so failures can be located in time, and
+ * its power spectrum is averaged (Welch method) for the final check of the
+ * whole capture. Memory use depends only on the segment size.
+ */
+struct stream_analyzer {
+	int N;				/* segment size */
+	int hop;			/* new frames per segment */
+	long long frames;		/* frames fed so far */
+	char *raw;			/* hop interleaved frames */
+	float *samples;			/* hop converted interleaved samples */
+	float *history;			/* last N samples of each channel */
+	float *window;
+	double *psd;			/* accumulated power per channel */
 	struct analyze a;
+	fftwf_plan plan;
+	int segments;
+	int *failures;			/* failed segments per channel */
+	int *first_err;			/* error of the first failed segment */
+	float *peak;			/* peak of the last segment (Hz) */
+	float *snr;			/* SNR of the last segment (dB) */
+};
+
+static void stream_free(struct stream_analyzer *sa)
+{
+	free(sa->raw);
+	free(sa->samples);
+	free(sa->history);
+	free(sa->window);
+	free(sa->psd);
+	free(sa->failures);
+	free(sa->first_err);
+	free(sa->peak);
+	free(sa->snr);
+	free_fft_buffers(&sa->a);
+}
+
+static int stream_init(struct bat *bat, struct stream_analyzer *sa)
+{
+	int i;
+
+	memset(sa, 0, sizeof(*sa));
+	sa->N = bat->segment;
+	sa->hop = sa->N / 2;
+	sa->raw = malloc(sa->hop * bat->frame_size);
+	sa->samples = malloc(sizeof(float) * sa->hop * bat->channels);
+	sa->history = calloc(sa->N * bat->channels, sizeof(float));
+	sa->window = malloc(sizeof(float) * sa->N);
+	sa->psd = calloc(sa->N / 2 * bat->channels, sizeof(double));
+	sa->failures = calloc(bat->channels, sizeof(int));
+	sa->first_err = calloc(bat->channels, sizeof(int));
+	sa->peak = calloc(bat->channels, sizeof(float));
+	sa->snr = calloc(bat->channels, sizeof(float));
+	if (!sa->raw || !sa->samples || !sa->history || !sa->window ||
+			!sa->psd || !sa->failures || !sa->first_err ||
+			!sa->peak || !sa->snr ||
+			alloc_fft_buffers(&sa->a, sa->N) < 0) {
+		stream_free(sa);
+		return -ENOMEM;
+	}
+
+	sa->plan = get_fft_plan(bat, &sa->a, sa->N);
+	if (sa->plan == NULL) {
+		stream_free(sa);
+		return -ENOMEM;
+	}
+
+	/* Hann window */
+	for (i = 0; i < sa->N; i++)
+		sa->window[i] = 0.5 - 0.5 * cosf(2.0 * M_PI * i / sa->N);
+
+	return 0;
+}
+
+/*
+ * check the strongest bin of one segment against the target frequency,
+ * and estimate the SNR from the power around the peak against the rest
+ * of the spectrum
+ */
+static int stream_check_segment(struct bat *bat, struct stream_analyzer *sa,
+		int channel, double offset)
+{
+	float *mag = sa->a.mag;
+	float hz = (float) bat->rate / sa->N;
+	float target = bat->target_freq[channel];
+	float tolerance = DELTA_RATE * target;
+	double signal = 0.0, noise = 0.0;
+	int i, peak = 2;
+
+	if (tolerance < DELTA_HZ)
+		tolerance = DELTA_HZ;
+	/* the window spreads the peak, allow one bin of error */
+	if (tolerance < hz)
+		tolerance = hz;
+
+	/* skip the DC bins widened by the window */
+	for (i = 3; i < sa->N / 2; i++)
+		if (mag[i] > mag[peak])
+			peak = i;
+	for (i = 2; i < sa->N / 2; i++) {
+		if (abs(i - peak) <= 3)
+			signal += (double) mag[i] * mag[i];
+		else
+			noise += (double) mag[i] * mag[i];
+	}
+	sa->peak[channel] = peak * hz;
+	sa->snr[channel] = noise > 0.0 ?
+			10.0 * log10(signal / noise) : SNR_DB_MAX;
+
+	if (mag[peak] == 0.0) {
+		fprintf(bat->err, _("FAIL: Channel %i at %.3f s: no signal\n"),
+				channel + 1, offset);
+		return -ENOPEAK;
+	}
+	if (fabsf(sa->peak[channel] - target) > tolerance) {
+		fprintf(bat->err, _("FAIL: Channel %i at %.3f s: "),
+				channel + 1, offset);
+		fprintf(bat->err, _("peak at %2.2f Hz\n"), sa->peak[channel]);
+		return -EBADPEAK;
+	}
+	if (snr_is_valid(bat->snr_thd_db)
+			&& sa->snr[channel] < bat->snr_thd_db) {
+		fprintf(bat->err, _("FAIL: Channel %i at %.3f s: "),
+				channel + 1, offset);
+		fprintf(bat->err, _("SNR %.2f dB\n"), sa->snr[channel]);
+		return -ELOWSNR;
+	}
+
+	return 0;
+}
+
+static int stream_segment(struct bat *bat, struct stream_analyzer *sa)
+{
+	double offset = (double) (sa->frames - sa->N) / bat->rate;
+	struct analyze *a = &sa->a;
+	float *h;
+	int c, i, err, ret = 0;
+
+	for (c = 0; c < bat->channels; c++) {
+		h = sa->history + c * sa->N;
+		for (i = 0; i < sa->N; i++)
+			a->in[i] = h[i] * sa->window[i];
+
+		fftwf_execute_r2r(sa->plan, a->in, a->out);
+		calc_magnitude(bat, a, sa->N);
+
+		for (i = 0; i < sa->N / 2; i++)
+			sa->psd[c * sa->N / 2 + i] +=
+					(double) a->mag[i] * a->mag[i];
+
+		err = stream_check_segment(bat, sa, c, offset);
+		if (err != 0) {
+			if (sa->failures[c]++ == 0)
+				sa->first_err[c] = err;
+			if (ret == 0)
+				ret = err;
+		}
+	}
+	sa->segments++;
+
+	return ret;
+}
+
+/*
+ * feed sa->hop frames from sa->raw
+ * @return 1 if no segment is complete yet, otherwise the segment result
+ */
+static int stream_feed(struct bat *bat, struct stream_analyzer *sa)
+{
+	float *h;
+	int c, i;
+
+	bat->convert_sample_to_float(sa->raw, sa->samples,
+			sa->hop * bat->channels);
+
+	/* slide the history of each channel by one hop */
+	for (c = 0; c < bat->channels; c++) {
+		h = sa->history + c * sa->N;
+		memmove(h, h + sa->hop, sizeof(float) * sa->hop);
+		for (i = 0; i < sa->hop; i++)
+			h[sa->hop + i] = sa->samples[i * bat->channels + c];
+	}
+	sa->frames += sa->hop;
+
+	if (sa->frames < sa->N)
+		return 1;
+	return stream_segment(bat, sa);
+}
+
+static int stream_report(struct bat *bat, struct stream_analyzer *sa)
+{
+	struct analyze *a = &sa->a;
+	int c, i, err, ret = 0;
+
+	if (sa->segments == 0) {
+		fprintf(bat->err, _("Not enough frames for analysis: %lld\n"),
+				sa->frames);
+		return -EINVAL;
+	}
+	fprintf(bat->log, _("Analyzed %lld frames in %d segments\n"),
+			sa->frames, sa->segments);
+
+	for (c = 0; c < bat->channels; c++) {
+		fprintf(bat->log, _("\nChannel %i - "), c + 1);
+		fprintf(bat->log, _("Checking for target frequency %2.2f Hz\n"),
+				bat->target_freq[c]);
+		fprintf(bat->log, _("%d of %d segments failed\n"),
+				sa->failures[c], sa->segments);
+
+		/* averaged magnitude spectrum of all segments */
+		for (i = 0; i < sa->N / 2; i++)
+			a->mag[i] = sqrt(sa->psd[c * sa->N / 2 + i]
+					/ sa->segments);
+		a->mag[0] = 0.0;
+
+		err = check(bat, a, c, sa->N);
+		if (err == 0 && sa->failures[c] > 0)
+			err = sa->first_err[c];
+		if (err != 0 && ret == 0)
+			ret = err;
+	}
+
+	return ret;
+}
+
+static int analyze_capture_stream(struct bat *bat)
+{
+	struct stream_analyzer sa;
+	size_t items;
+	int err;
+
+	fprintf(bat->log, _("\nBAT streaming analysis: %d frames at %d Hz,"),
+			bat->frames, bat->rate);
+	fprintf(bat->log, _(" %d channels, segments of %d frames.\n"),
+			bat->channels, bat->segment);
+
+	err = stream_init(bat, &sa);
+	if (err < 0)
+		return err;
+
+	bat->fp = fopen(bat->capture.file, "rb");
+	err = -errno;
+	if (bat->fp == NULL) {
+		fprintf(bat->err, _("Cannot open file: %s %d\n"),
+				bat->capture.file, err);
+		goto exit1;
+	}
+
+	/* Skip header */
+	err = read_wav_header(bat, bat->capture.file, bat->fp, true);
+	if (err != 0)
+		goto exit2;
+
+	while (sa.frames + sa.hop <= bat->frames) {
+		items = fread(sa.raw, bat->frame_size, sa.hop, bat->fp);
+		if (items != sa.hop)
+			break;
+		stream_feed(bat, &sa);
+	}
+
+	err = stream_report(bat, &sa);
+
+exit2:
+	fclose(bat->fp);
+exit1:
+	stream_free(&sa);
+	return err;
+}
+
+/*
+ * Live analysis in loopback mode: the capture thread pushes every period
+ * into bat->ring, this thread analyzes the segments as they arrive and
+ * reports the status about once per second.
+ */
+static int live_analysis(struct bat *bat)
+{
+	struct stream_analyzer sa;
+	int reported[MAX_CHANNELS] = { 0 };
+	int c, err, next_report;
+
+	err = stream_init(bat, &sa);
+	if (err < 0)
+		return err;
+
+	fprintf(bat->log, _("\nBAT live analysis: segments of %d frames\n"),
+			sa.N);
+	next_report = bat->rate;
+	while (sa.frames + sa.hop <= bat->frames) {
+		if (ring_read(bat->ring, sa.raw, sa.hop * bat->frame_size) <= 0)
+			break;
+		err = stream_feed(bat, &sa);
+		if (err < 0) {
+			if (bat->stop_on_fail) {
+				fprintf(bat->err, _("Stopping test on failure\n"));
+				break;
+			}
+		}
+		if (sa.segments == 0 || sa.frames < next_report)
+			continue;
+		next_report += bat->rate;
+		for (c = 0; c < bat->channels; c++) {
+			fprintf(bat->log, _("%8.2f s: Channel %i %s, peak %2.2f Hz, SNR %.2f dB\n"),
+					(double) sa.frames / bat->rate, c + 1,
+					sa.failures[c] > reported[c] ?
+					_("FAIL") : _("PASS"),
+					sa.peak[c], sa.snr[c]);
+			reported[c] = sa.failures[c];
+		}
+	}
+	/* stop the playback (and so the test) */
+	ring_stop(bat->ring);
+
+	if (ring_dropped(bat->ring) > 0)
+		fprintf(bat->err, _("Live analysis overrun: %zu bytes lost\n"),
+				ring_dropped(bat->ring));
+	err = stream_report(bat, &sa);
+	stream_free(&sa);
+
+	return err;
+}
+
+void *analyze_live(struct bat *bat)
+{
+	static int retval_live;
+
+	retval_live = live_analysis(bat);
+	pthread_exit(&retval_live);
+}
+
+int analyze_capture(struct bat *bat)
+{
+	int err = 0;
+	size_t items;
+	int threads;
+
+	if (bat->segment > 0)
+		return analyze_capture_stream(bat);
 
 	err = truncate_frames(bat);
 	if (err < 0) {
@@ -480,29 +1768,11 @@ int analyze_capture(struct bat *bat)
 	if (err != 0)
 		goto exit2;
 
-	for (c = 0; c < bat->channels; c++) {
-		fprintf(bat->log, _("\nChannel %i - "), c + 1);
-		fprintf(bat->log, _("Checking for target frequency %2.2f Hz\n"),
-				bat->target_freq[c]);
-		a.buf = bat->buf +
-				c * bat->frames * bat->frame_size
-				/ bat->channels;
-		if (!bat->standalone) {
-			err = find_and_check_harmonics(bat, &a, c);
-			if (err != 0)
-				goto exit2;
-		}
-
-		if (snr_is_valid(bat->snr_thd_db)) {
-			fprintf(bat->log, _("\nChecking for SNR: "));
-			fprintf(bat->log, _("Threshold is %.2f dB (%.2f%%)\n"),
-					bat->snr_thd_db, 100.0
-					/ powf(10.0, bat->snr_thd_db / 20.0));
-			err = find_and_check_noise(bat, a.buf, c);
-			if (err != 0)
-				goto exit2;
-		}
-	}
+	threads = get_analysis_threads(bat);
+	if (threads > 1)
+		err = analyze_channels_parallel(bat, threads);
+	else
+		err = analyze_channels(bat);
 
 exit2:
 	fclose(bat->fp);
@@ -14,3 +14,7 @@
  */
 
 int analyze_capture(struct bat *);
+void analyze_cleanup(void);
+void *analyze_live(struct bat *);
+int xcorr_prepare(struct bat *, int, int);
+int xcorr_delay(struct bat *, float *, int, float *, int, float *, float *);
@@ -27,5 +27,12 @@
 int sin_generator_init(struct sin_generator *, float, float, float);
 float sin_generator_next_sample(struct sin_generator *);
 void sin_generator_vfill(struct sin_generator *, float *, int);
+int sin_lanes_init(struct sin_lanes *, float, float, float);
+void sin_lanes_fill(struct sin_lanes *, float *, int, int, float);
 int generate_sine_wave(struct bat *, int, void *);
 int generate_sine_wave_raw_mono(struct bat *, float *, float, int);
+int signal_period(struct bat *);
+int generate_signal_period(struct bat *, float *);
+int generate_test_signal(struct bat *, int, void *);
+int generate_mono_waveform(struct bat *, const float *, int, void *);
+void generate_chirp(struct bat *, float *, int);
@@ -24,6 +24,7 @@
 #include <math.h>
 #include <limits.h>
 #include <locale.h>
+#include <time.h>
 #include <math.h>
 
 #include "aconfig.h"
@@ -42,9 +43,10 @@
 #include "analyze.h"
 #endif
 #include "latencytest.h"
+#include "results.h"
 
 /* get snr threshold in dB */
-static void get_snr_thd_db(struct bat *bat, char *thd)
+static int get_snr_thd_db(struct bat *bat, char *thd)
 {
 	int err;
 	float thd_db;
@@ -54,13 +56,15 @@ static void get_snr_thd_db(struct bat *bat, char *thd)
 	err = -errno;
 	if (!snr_is_valid(thd_db)) {
 		fprintf(bat->err, _("Invalid threshold '%s':%d\n"), thd, err);
-		exit(EXIT_FAILURE);
+		return -EINVAL;
 	}
 	bat->snr_thd_db = thd_db;
+
+	return 0;
 }
 
 /* get snr threshold in %, and convert to dB */
-static void get_snr_thd_pc(struct bat *bat, char *thd)
+static int get_snr_thd_pc(struct bat *bat, char *thd)
 {
 	int err;
 	float thd_pc;
@@ -70,14 +74,16 @@ static void get_snr_thd_pc(struct bat *bat, char *thd)
 	err = -errno;
 	if (thd_pc <= 0.0 || thd_pc >= 100.0) {
 		fprintf(bat->err, _("Invalid threshold '%s':%d\n"), thd, err);
-		exit(EXIT_FAILURE);
+		return -EINVAL;
 	}
 	bat->snr_thd_db = 20.0 * log10f(100.0 / thd_pc);
+
+	return 0;
 }
 
 static int get_duration(struct bat *bat)
 {
-	int err;
+	int err, max_frames;
 	float duration_f;
 	long duration_i;
 	char *ptrf, *ptri;
@@ -99,9 +105,12 @@ static int get_duration(struct bat *bat)
 	else
 		bat->frames = -1;
 
-	if (bat->frames <= 0 || bat->frames > MAX_FRAMES) {
+	/* the segment size of the live analysis is set later */
+	max_frames = bat->segment > 0 || bat->realtime ?
+			MAX_STREAM_FRAMES : MAX_FRAMES;
+	if (bat->frames <= 0 || bat->frames > max_frames) {
 		fprintf(bat->err, _("Invalid duration. Range: (0, %d(%fs))\n"),
-				MAX_FRAMES, (float)MAX_FRAMES / bat->rate);
+				max_frames, (float)max_frames / bat->rate);
 		return -EINVAL;
 	}
 
@@ -116,18 +125,77 @@ err_exit:
 static void get_sine_frequencies(struct bat *bat, char *freq)
 {
 	char *tmp1;
+	float other;
+	int c;
 
+	/* the second frequency is for all the other channels */
 	tmp1 = strchr(freq, ':');
 	if (tmp1 == NULL) {
-		bat->target_freq[1] = bat->target_freq[0] = atof(optarg);
+		other = bat->target_freq[0] = atof(optarg);
 	} else {
 		*tmp1 = '\0';
 		bat->target_freq[0] = atof(optarg);
-		bat->target_freq[1] = atof(tmp1 + 1);
+		other = atof(tmp1 + 1);
+	}
+	for (c = 1; c < MAX_CHANNELS; c++)
+		bat->target_freq[c] = other;
+}
+
+static int get_signal(struct bat *bat, char *optarg)
+{
+	if (strcasecmp(optarg, "sine") == 0) {
+		bat->signal = BAT_SIGNAL_SINE;
+	} else if (strcasecmp(optarg, "multitone") == 0) {
+		bat->signal = BAT_SIGNAL_MULTITONE;
+	} else if (strcasecmp(optarg, "sweep") == 0) {
+		bat->signal = BAT_SIGNAL_SWEEP;
+	} else if (strcasecmp(optarg, "mls") == 0) {
+		bat->signal = BAT_SIGNAL_MLS;
+	} else {
+		fprintf(bat->err, _("wrong signal '%s'\n"), optarg);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int get_tone_frequencies(struct bat *bat, char *freq)
+{
+	char *tmp;
+
+	bat->signal = BAT_SIGNAL_MULTITONE;
+	for (bat->tones = 0; bat->tones < MAX_TONES; ) {
+		bat->tone_freq[bat->tones++] = atof(freq);
+		tmp = strchr(freq, ',');
+		if (tmp == NULL)
+			return 0;
+		freq = tmp + 1;
 	}
+
+	fprintf(bat->err, _("too many tones, at most %d\n"), MAX_TONES);
+	return -EINVAL;
+}
+
+static int compare_freq(const void *a, const void *b)
+{
+	float fa = *(const float *) a, fb = *(const float *) b;
+
+	return (fa > fb) - (fa < fb);
+}
+
+/* default multi-tone: tones spread evenly over a log frequency scale */
+static void set_default_tones(struct bat *bat, float freq_high)
+{
+	float ratio = powf(freq_high / TONE_LOW, 1.0 / (DEFAULT_TONES - 1));
+	int k;
+
+	bat->tones = DEFAULT_TONES;
+	bat->tone_freq[0] = TONE_LOW;
+	for (k = 1; k < DEFAULT_TONES; k++)
+		bat->tone_freq[k] = bat->tone_freq[k - 1] * ratio;
 }
 
-static void get_format(struct bat *bat, char *optarg)
+static int get_format(struct bat *bat, char *optarg)
 {
 	if (strcasecmp(optarg, "cd") == 0) {
 		bat->format = BAT_PCM_FORMAT_S16_LE;
@@ -154,8 +222,10 @@ static void get_format(struct bat *bat, char *optarg)
 	} else {
 		bat->format = BAT_PCM_FORMAT_UNKNOWN;
 		fprintf(bat->err, _("wrong extended format '%s'\n"), optarg);
-		exit(EXIT_FAILURE);
+		return -EINVAL;
 	}
+
+	return 0;
 }
 
 static inline int thread_wait_completion(struct bat *bat,
@@ -171,7 +241,7 @@ static inline int thread_wait_completion(struct bat *bat,
 }
 
 /* loopback test where we play sine wave and capture the same sine wave */
-static void test_loopback(struct bat *bat)
+static int test_loopback(struct bat *bat)
 {
 	pthread_t capture_id, playback_id;
 	int err;
@@ -183,7 +253,7 @@ static void test_loopback(struct bat *bat)
 	if (err != 0) {
 		fprintf(bat->err, _("Cannot create playback thread: %d\n"),
 				err);
-		exit(EXIT_FAILURE);
+		return -err;
 	}
 
 	/* TODO: use a pipe to signal stream start etc - i.e. to sync threads */
@@ -195,16 +265,17 @@ static void test_loopback(struct bat *bat)
 	if (err != 0) {
 		fprintf(bat->err, _("Cannot create capture thread: %d\n"), err);
 		pthread_cancel(playback_id);
-		exit(EXIT_FAILURE);
+		pthread_join(playback_id, NULL);
+		return -err;
 	}
 
 	/* wait for playback to complete */
 	err = thread_wait_completion(bat, playback_id, &thread_result_playback);
 	if (err != 0) {
 		fprintf(bat->err, _("Cannot join playback thread: %d\n"), err);
-		free(thread_result_playback);
 		pthread_cancel(capture_id);
-		exit(EXIT_FAILURE);
+		pthread_join(capture_id, NULL);
+		return -err;
 	}
 
 	/* check playback status */
@@ -212,7 +283,8 @@ static void test_loopback(struct bat *bat)
 		fprintf(bat->err, _("Exit playback thread fail: %d\n"),
 				*thread_result_playback);
 		pthread_cancel(capture_id);
-		exit(EXIT_FAILURE);
+		pthread_join(capture_id, NULL);
+		return *thread_result_playback;
 	} else {
 		fprintf(bat->log, _("Playback completed.\n"));
 	}
@@ -222,28 +294,74 @@ static void test_loopback(struct bat *bat)
 	err = thread_wait_completion(bat, capture_id, &thread_result_capture);
 	if (err != 0) {
 		fprintf(bat->err, _("Cannot join capture thread: %d\n"), err);
-		free(thread_result_capture);
-		exit(EXIT_FAILURE);
+		return -err;
 	}
 
 	/* check if capture thread is canceled or not */
 	if (thread_result_capture == PTHREAD_CANCELED) {
 		fprintf(bat->log, _("Capture canceled.\n"));
-		return;
+		return 0;
 	}
 
 	/* check capture status */
 	if (*thread_result_capture != 0) {
 		fprintf(bat->err, _("Exit capture thread fail: %d\n"),
 				*thread_result_capture);
-		exit(EXIT_FAILURE);
+		return *thread_result_capture;
 	} else {
 		fprintf(bat->log, _("Capture completed.\n"));
 	}
+
+	return 0;
 }
 
+#ifdef HAVE_LIBFFTW3F
+/* loopback test with the analysis running while capturing */
+static int test_loopback_live(struct bat *bat)
+{
+	pthread_t live_id;
+	int err, ret;
+	int *thread_result;
+
+	bat->ring = ring_create(LIVE_RING_SECONDS * bat->rate *
+			bat->frame_size);
+	if (bat->ring == NULL) {
+		fprintf(bat->err, _("Not enough memory.\n"));
+		return -ENOMEM;
+	}
+
+	err = pthread_create(&live_id, NULL, (void *) analyze_live, bat);
+	if (err != 0) {
+		fprintf(bat->err, _("Cannot create analysis thread: %d\n"),
+				err);
+		ring_free(bat->ring);
+		bat->ring = NULL;
+		return -err;
+	}
+
+	ret = test_loopback(bat);
+
+	/* the capture thread may have been canceled before the end */
+	ring_close(bat->ring);
+
+	err = thread_wait_completion(bat, live_id, &thread_result);
+	if (err != 0) {
+		fprintf(bat->err, _("Cannot join analysis thread: %d\n"),
+				err);
+		err = -err;
+	} else {
+		err = *thread_result;
+	}
+
+	ring_free(bat->ring);
+	bat->ring = NULL;
+
+	return ret < 0 ? ret : err;
+}
+#endif
+
 /* single ended playback only test */
-static void test_playback(struct bat *bat)
+static int test_playback(struct bat *bat)
 {
 	pthread_t playback_id;
 	int err;
@@ -255,29 +373,30 @@ static void test_playback(struct bat *bat)
 	if (err != 0) {
 		fprintf(bat->err, _("Cannot create playback thread: %d\n"),
 				err);
-		exit(EXIT_FAILURE);
+		return -err;
 	}
 
 	/* wait for playback to complete */
 	err = thread_wait_completion(bat, playback_id, &thread_result);
 	if (err != 0) {
 		fprintf(bat->err, _("Cannot join playback thread: %d\n"), err);
-		free(thread_result);
-		exit(EXIT_FAILURE);
+		return -err;
 	}
 
 	/* check playback status */
 	if (*thread_result != 0) {
 		fprintf(bat->err, _("Exit playback thread fail: %d\n"),
 				*thread_result);
-		exit(EXIT_FAILURE);
+		return *thread_result;
 	} else {
 		fprintf(bat->log, _("Playback completed.\n"));
 	}
+
+	return 0;
 }
 
 /* single ended capture only test */
-static void test_capture(struct bat *bat)
+static int test_capture(struct bat *bat)
 {
 	pthread_t capture_id;
 	int err;
@@ -287,7 +406,7 @@ static void test_capture(struct bat *bat)
 	err = pthread_create(&capture_id, NULL, (void *) bat->capture.fct, bat);
 	if (err != 0) {
 		fprintf(bat->err, _("Cannot create capture thread: %d\n"), err);
-		exit(EXIT_FAILURE);
+		return -err;
 	}
 
 	/* TODO: stop capture */
@@ -296,18 +415,19 @@ static void test_capture(struct bat *bat)
 	err = thread_wait_completion(bat, capture_id, &thread_result);
 	if (err != 0) {
 		fprintf(bat->err, _("Cannot join capture thread: %d\n"), err);
-		free(thread_result);
-		exit(EXIT_FAILURE);
+		return -err;
 	}
 
 	/* check playback status */
 	if (*thread_result != 0) {
 		fprintf(bat->err, _("Exit capture thread fail: %d\n"),
 				*thread_result);
-		exit(EXIT_FAILURE);
+		return *thread_result;
 	} else {
 		fprintf(bat->log, _("Capture completed.\n"));
 	}
+
+	return 0;
 }
 
 static void usage(struct bat *bat)
@@ -336,8 +456,19 @@ _("Usage: alsabat [-options]...\n"
 "      --local            internal loop, set to bypass pcm hardware devices\n"
 "      --standalone       standalone mode, to bypass analysis\n"
 "      --roundtriplatency round trip latency mode\n"
+"      --latency-xcorr    measure the latency by cross-correlation\n"
+"      --latency-runs=#   number of cross-correlation measurements\n"
+"      --json=#           file for JSON results, - for stdout (log to stderr)\n"
+"      --batch=#          file with the options of one test per line\n"
 "      --snr-db=#         noise detect threshold, in SNR(dB)\n"
 "      --snr-pc=#         noise detect threshold, in noise percentage(%%)\n"
+"      --wisdom=#         file caching FFTW plans between runs\n"
+"      --threads=#        number of analysis threads, 0 = one per CPU\n"
+"      --segment=#        streaming analysis in segments of # frames\n"
+"      --realtime         analyze while capturing in loopback mode\n"
+"      --stop-on-fail     stop the realtime test at the first failure\n"
+"      --signal=#         test signal: sine, multitone, sweep or mls\n"
+"      --tones=#          multi-tone frequencies, comma separated\n"
 ));
 	fprintf(bat->log, _("Recognized sample formats are: "));
 	fprintf(bat->log, _("U8 S16_LE S24_3LE S32_LE\n"));
@@ -348,6 +479,8 @@ _("Usage: alsabat [-options]...\n"
 
 static void set_defaults(struct bat *bat)
 {
+	int c;
+
 	memset(bat, 0, sizeof(struct bat));
 
 	/* Set default values */
@@ -358,8 +491,8 @@ static void set_defaults(struct bat *bat)
 	bat->convert_float_to_sample = convert_float_to_int16;
 	bat->convert_sample_to_float = convert_int16_to_float;
 	bat->frames = bat->rate * 2;
-	bat->target_freq[0] = 997.0;
-	bat->target_freq[1] = 997.0;
+	for (c = 0; c < MAX_CHANNELS; c++)
+		bat->target_freq[c] = 997.0;
 	bat->sigma_k = 3.0;
 	bat->snr_thd_db = SNR_DB_INVALID;
 	bat->playback.device = NULL;
@@ -369,6 +502,7 @@ static void set_defaults(struct bat *bat)
 	bat->buffer_size = 0;
 	bat->period_size = 0;
 	bat->roundtriplatency = false;
+	bat->latency.runs = LATENCY_TEST_NUMBER;
 #ifdef HAVE_LIBTINYALSA
 	bat->channels = 2;
 	bat->playback.fct = &playback_tinyalsa;
@@ -385,9 +519,13 @@ static void set_defaults(struct bat *bat)
 	bat->err = stderr;
 }
 
-static void parse_arguments(struct bat *bat, int argc, char *argv[])
+/*
+ * Parse the options into bat. Returns 1 for the help or an unknown option,
+ * so the caller can print the usage, and a negative error for a bad value.
+ */
+static int parse_arguments(struct bat *bat, int argc, char *argv[])
 {
-	int c, option_index, err;
+	int c, option_index, val, err = 0;
 	static const char short_options[] = "D:P:C:f:n:F:c:r:s:k:p:B:E:lth";
 	static const struct option long_options[] = {
 		{"help",     0, 0, 'h'},
@@ -397,9 +535,20 @@ static void parse_arguments(struct bat *bat, int argc, char *argv[])
 		{"local",    0, 0, OPT_LOCAL},
 		{"standalone", 0, 0, OPT_STANDALONE},
 		{"roundtriplatency", 0, 0, OPT_ROUNDTRIPLATENCY},
+		{"latency-xcorr", 0, 0, OPT_LATENCY_XCORR},
+		{"latency-runs", 1, 0, OPT_LATENCY_RUNS},
+		{"json",     1, 0, OPT_JSON},
+		{"batch",    1, 0, OPT_BATCH},
 		{"snr-db",   1, 0, OPT_SNRTHD_DB},
 		{"snr-pc",   1, 0, OPT_SNRTHD_PC},
 		{"readcapture", 1, 0, OPT_READCAPTURE},
+		{"wisdom",   1, 0, OPT_WISDOM},
+		{"threads",  1, 0, OPT_THREADS},
+		{"segment",  1, 0, OPT_SEGMENT},
+		{"realtime", 0, 0, OPT_REALTIME},
+		{"stop-on-fail", 0, 0, OPT_STOPONFAIL},
+		{"signal",   1, 0, OPT_SIGNAL},
+		{"tones",    1, 0, OPT_TONES},
 		{0, 0, 0, 0}
 	};
 
@@ -420,6 +569,27 @@ static void parse_arguments(struct bat *bat, int argc, char *argv[])
 			bat->capture.mode = MODE_ANALYZE_ONLY;
 			bat->playback.mode = MODE_ANALYZE_ONLY;
 			break;
+		case OPT_WISDOM:
+			bat->wisdom = optarg;
+			break;
+		case OPT_THREADS:
+			bat->threads = atoi(optarg);
+			break;
+		case OPT_SEGMENT:
+			bat->segment = atoi(optarg);
+			break;
+		case OPT_REALTIME:
+			bat->realtime = true;
+			break;
+		case OPT_STOPONFAIL:
+			bat->stop_on_fail = true;
+			break;
+		case OPT_SIGNAL:
+			err = get_signal(bat, optarg);
+			break;
+		case OPT_TONES:
+			err = get_tone_frequencies(bat, optarg);
+			break;
 		case OPT_LOCAL:
 			bat->local = true;
 			break;
@@ -429,11 +599,24 @@ static void parse_arguments(struct bat *bat, int argc, char *argv[])
 		case OPT_ROUNDTRIPLATENCY:
 			bat->roundtriplatency = true;
 			break;
+		case OPT_LATENCY_XCORR:
+			bat->roundtriplatency = true;
+			bat->latency.xcorr = true;
+			break;
+		case OPT_LATENCY_RUNS:
+			bat->latency.runs = atoi(optarg);
+			break;
+		case OPT_JSON:
+			bat->json = optarg;
+			break;
+		case OPT_BATCH:
+			bat->batch = optarg;
+			break;
 		case OPT_SNRTHD_DB:
-			get_snr_thd_db(bat, optarg);
+			err = get_snr_thd_db(bat, optarg);
 			break;
 		case OPT_SNRTHD_PC:
-			get_snr_thd_pc(bat, optarg);
+			err = get_snr_thd_pc(bat, optarg);
 			break;
 		case 'D':
 			if (bat->playback.device == NULL)
@@ -468,7 +651,7 @@ static void parse_arguments(struct bat *bat, int argc, char *argv[])
 			bat->rate = atoi(optarg);
 			break;
 		case 'f':
-			get_format(bat, optarg);
+			err = get_format(bat, optarg);
 			break;
 		case 'k':
 			bat->sigma_k = atof(optarg);
@@ -478,21 +661,24 @@ static void parse_arguments(struct bat *bat, int argc, char *argv[])
 			bat->period_is_limited = true;
 			break;
 		case 'B':
-			err = atoi(optarg);
-			bat->buffer_size = err >= MIN_BUFFERSIZE
-					&& err < MAX_BUFFERSIZE ? err : 0;
+			val = atoi(optarg);
+			bat->buffer_size = val >= MIN_BUFFERSIZE
+					&& val < MAX_BUFFERSIZE ? val : 0;
 			break;
 		case 'E':
-			err = atoi(optarg);
-			bat->period_size = err >= MIN_PERIODSIZE
-					&& err < MAX_PERIODSIZE ? err : 0;
+			val = atoi(optarg);
+			bat->period_size = val >= MIN_PERIODSIZE
+					&& val < MAX_PERIODSIZE ? val : 0;
 			break;
 		case 'h':
 		default:
-			usage(bat);
-			exit(EXIT_SUCCESS);
+			return 1;
 		}
+		if (err < 0)
+			return err;
 	}
+
+	return 0;
 }
 
 static int validate_options(struct bat *bat)
@@ -513,6 +699,54 @@ static int validate_options(struct bat *bat)
 		return -EINVAL;
 	}
 
+	/* check number of analysis threads */
+	if (bat->threads < 0) {
+		fprintf(bat->err, _("Invalid number of threads: %d\n"),
+				bat->threads);
+		return -EINVAL;
+	}
+
+	/* check streaming analysis segment size, a power of two */
+	if (bat->segment != 0 && (bat->segment < (1 << SHIFT_MIN)
+			|| bat->segment > (1 << 20)
+			|| (bat->segment & (bat->segment - 1)) != 0)) {
+		fprintf(bat->err, _("Invalid segment size: %d\n"),
+				bat->segment);
+		return -EINVAL;
+	}
+
+	/* check cross-correlation latency test */
+	if (bat->latency.runs < 1 || bat->latency.runs > LATENCY_RUNS_MAX) {
+		fprintf(bat->err, _("Invalid number of latency runs: %d\n"),
+				bat->latency.runs);
+		return -EINVAL;
+	}
+#ifndef HAVE_LIBFFTW3F
+	if (bat->latency.xcorr) {
+		fprintf(bat->err, _("No libfftw3 library for --latency-xcorr\n"));
+		return -EINVAL;
+	}
+#endif
+
+	/* streaming analysis only knows the sine wave */
+	if (bat->signal != BAT_SIGNAL_SINE
+			&& (bat->segment > 0 || bat->realtime)) {
+		fprintf(bat->err, _("streaming analysis needs the sine signal\n"));
+		return -EINVAL;
+	}
+
+	/* live analysis only in loopback mode */
+	if (bat->realtime) {
+		if (bat->local || bat->roundtriplatency || bat->standalone
+				|| bat->playback.mode != MODE_LOOPBACK
+				|| bat->capture.mode != MODE_LOOPBACK) {
+			fprintf(bat->err, _("realtime analysis needs the loopback mode\n"));
+			return -EINVAL;
+		}
+		if (bat->segment == 0)
+			bat->segment = LIVE_SEGMENT;
+	}
+
 	/* check single ended is in either playback or capture - not both */
 	if ((bat->playback.mode == MODE_SINGLE)
 			&& (bat->capture.mode == MODE_SINGLE)) {
@@ -533,6 +767,20 @@ static int validate_options(struct bat *bat)
 		}
 	}
 
+	/* check multi-tone frequencies */
+	if (bat->signal == BAT_SIGNAL_MULTITONE && bat->tones == 0)
+		set_default_tones(bat, freq_high * 0.9);
+	qsort(bat->tone_freq, bat->tones, sizeof(float), compare_freq);
+	for (c = 0; c < bat->tones; c++) {
+		if (bat->tone_freq[c] < freq_low
+				|| bat->tone_freq[c] > freq_high) {
+			fprintf(bat->err, _("tone frequency out of"));
+			fprintf(bat->err, _(" range: (%.1f, %.1f)\n"),
+				freq_low, freq_high);
+			return -EINVAL;
+		}
+	}
+
 	return 0;
 }
 
@@ -624,6 +872,15 @@ static int bat_init(struct bat *bat)
 
 	bat->frame_size = bat->sample_size * bat->channels;
 
+	if ((bat->segment > 0 || bat->realtime) &&
+			bat->frames > MAX_STREAM_BYTES / bat->frame_size) {
+		fprintf(bat->err, _("Invalid duration. Range: (0, %d(%fs))\n"),
+				MAX_STREAM_BYTES / bat->frame_size,
+				(float)(MAX_STREAM_BYTES / bat->frame_size)
+				/ bat->rate);
+		return -EINVAL;
+	}
+
 	/* Set conversion functions */
 	switch (bat->sample_size) {
 	case 1:
@@ -651,98 +908,317 @@ static int bat_init(struct bat *bat)
 	return err;
 }
 
-int main(int argc, char *argv[])
+static double now_seconds(void)
 {
-	struct bat bat;
-	int err = 0;
-
-	set_defaults(&bat);
-
-#ifdef ENABLE_NLS
-	setlocale(LC_ALL, "");
-	textdomain(PACKAGE);
-#endif
-
-	fprintf(bat.log, _("%s version %s\n\n"), PACKAGE_NAME, PACKAGE_VERSION);
-
-	parse_arguments(&bat, argc, argv);
+	struct timespec ts;
 
-	err = bat_init(&bat);
-	if (err < 0)
-		goto out;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-	err = validate_options(&bat);
-	if (err < 0)
-		goto out;
+/* run the test of one configuration */
+static int bat_run(struct bat *bat)
+{
+	int err = 0;
+	double start = now_seconds();
 
 	/* round trip latency test thread */
-	if (bat.roundtriplatency) {
+	if (bat->roundtriplatency) {
 		while (1) {
-			fprintf(bat.log,
+			fprintf(bat->log,
 				_("\nStart round trip latency\n"));
-			roundtrip_latency_init(&bat);
-			test_loopback(&bat);
+			err = roundtrip_latency_init(bat);
+			if (err < 0) {
+				fprintf(bat->err, _("Cannot prepare latency test: %d\n"),
+						err);
+				break;
+			}
+			err = test_loopback(bat);
+			if (err < 0)
+				break;
 
-			if (bat.latency.xrun_error == false)
+			if (bat->latency.xrun_error == false)
 				break;
 			else {
 				/* Xrun error in playback or capture,
 				increase period size and try again */
-				bat.period_size += bat.rate / 1000;
-				bat.buffer_size =
-					bat.period_size * DIV_BUFFERSIZE;
+				bat->period_size += bat->rate / 1000;
+				bat->buffer_size =
+					bat->period_size * DIV_BUFFERSIZE;
 
 				/* terminate the test if period_size is
 				large enough */
-				if (bat.period_size > bat.rate * 0.2)
+				if (bat->period_size > bat->rate * 0.2)
 					break;
 			}
 
 			/* Waiting 500ms and start the next round */
 			usleep(CAPTURE_DELAY * 1000);
 		}
+		roundtrip_latency_free(bat);
 		goto out;
 	}
 
 	/* single line playback thread: playback only, no capture */
-	if (bat.playback.mode == MODE_SINGLE) {
-		test_playback(&bat);
+	if (bat->playback.mode == MODE_SINGLE) {
+		err = test_playback(bat);
 		goto out;
 	}
 
 	/* single line capture thread: capture only, no playback */
-	if (bat.capture.mode == MODE_SINGLE) {
-		test_capture(&bat);
+	if (bat->capture.mode == MODE_SINGLE) {
+		err = test_capture(bat);
+		if (err < 0)
+			goto out;
 		goto analyze;
 	}
 
-	if (bat.capture.mode == MODE_ANALYZE_ONLY && bat.capturefile) {
-		bat.capture.file = strdup(bat.capturefile);
-		fprintf(bat.log,
+	if (bat->capture.mode == MODE_ANALYZE_ONLY && bat->capturefile) {
+		bat->capture.file = strdup(bat->capturefile);
+		fprintf(bat->log,
 			_("Using data from file %s for analysis\n"),
-			bat.capture.file);
-		fprintf(bat.log, _("Skipping playback and capture\n"));
+			bat->capture.file);
+		fprintf(bat->log, _("Skipping playback and capture\n"));
 		goto analyze;
 	}
 
+#ifdef HAVE_LIBFFTW3F
+	/* loopback with analysis on the fly */
+	if (bat->realtime) {
+		err = test_loopback_live(bat);
+		goto out;
+	}
+#endif
+
 	/* loopback thread: playback and capture in a loop */
-	if (bat.local == false)
-		test_loopback(&bat);
+	if (bat->local == false) {
+		err = test_loopback(bat);
+		if (err < 0)
+			goto out;
+	}
 
 analyze:
+	if (bat->results)
+		bat->results->test_seconds = now_seconds() - start;
+	start = now_seconds();
 #ifdef HAVE_LIBFFTW3F
-	if (!bat.standalone || snr_is_valid(bat.snr_thd_db))
-		err = analyze_capture(&bat);
+	if (!bat->standalone || snr_is_valid(bat->snr_thd_db))
+		err = analyze_capture(bat);
 #else
-	fprintf(bat.log, _("No libfftw3 library. Exit without analysis.\n"));
+	fprintf(bat->log, _("No libfftw3 library. Exit without analysis.\n"));
 #endif
+	if (bat->results)
+		bat->results->analysis_seconds = now_seconds() - start;
+	return err;
+
 out:
-	fprintf(bat.log, _("\nReturn value is %d\n"), err);
+	if (bat->results)
+		bat->results->test_seconds = now_seconds() - start;
+	return err;
+}
+
+/* log the return value and append the JSON results of one test */
+static void bat_report(struct bat *bat, FILE *json, bool *written, int err)
+{
+	fprintf(bat->log, _("\nReturn value is %d\n"), err);
+
+	if (json && bat->results) {
+		bat->results->err = err;
+		results_write(bat, json, !*written);
+		*written = true;
+	}
+}
+
+/* initialize, run and report the test of one configuration */
+static int bat_test(struct bat *bat, FILE *json, bool *written)
+{
+	int err;
+
+	err = bat_init(bat);
+	if (err < 0)
+		goto out;
+
+	err = validate_options(bat);
+	if (err < 0)
+		goto out;
+
+	err = bat_run(bat);
+
+out:
+	bat_report(bat, json, written, err);
+
+	if (bat->logarg)
+		fclose(bat->log);
+	if (!bat->local)
+		free(bat->capture.file);
+
+	return err;
+}
+
+/* split a batch line into arguments, after the program name */
+static int split_batch_line(char *line, char **argv)
+{
+	int argc = 1;
+	char *arg, *save;
+
+	argv[0] = PACKAGE_NAME;
+	for (arg = strtok_r(line, " \t", &save); arg != NULL;
+			arg = strtok_r(NULL, " \t", &save)) {
+		if (argc == BATCH_MAX_ARGS - 1)
+			return -E2BIG;
+		argv[argc++] = arg;
+	}
+	argv[argc] = NULL;
+
+	return argc;
+}
+
+/*
+ * Run every configuration of the batch file, one line of options each,
+ * in this process. The command line options are the defaults of every
+ * line, and the FFT plans are kept for all tests.
+ */
+static int bat_batch(struct bat *base, FILE *json)
+{
+	struct bat bat;
+	FILE *fp;
+	char *line = NULL, *config;
+	char *argv[BATCH_MAX_ARGS];
+	size_t size = 0;
+	bool own_log = false, written = false;
+	int argc, ret, err = 0, tests = 0, failed = 0;
+
+	fp = fopen(base->batch, "r");
+	if (fp == NULL) {
+		err = -errno;
+		fprintf(base->err, _("Cannot open file: %s %d\n"),
+				base->batch, err);
+		return err;
+	}
+
+	/* one log for the whole batch */
+	if (base->logarg) {
+		base->log = fopen(base->logarg, "wb");
+		if (base->log == NULL) {
+			err = -errno;
+			fprintf(base->err, _("Cannot open file: %s %d\n"),
+					base->logarg, err);
+			fclose(fp);
+			return err;
+		}
+		base->err = base->log;
+		base->logarg = NULL;
+		own_log = true;
+	}
+
+	while (getline(&line, &size, fp) != -1) {
+		line[strcspn(line, "\r\n")] = '\0';
+		config = line + strspn(line, " \t");
+		if (*config == '\0' || *config == '#')
+			continue;
+
+		bat = *base;
+		bat.batch = NULL;
+		fprintf(bat.log, _("\nBatch test %d: %s\n"), tests + 1, config);
+		if (json) {
+			bat.results = results_new(config);
+			if (bat.results == NULL) {
+				err = -ENOMEM;
+				break;
+			}
+		}
 
-	if (bat.logarg)
-		fclose(bat.log);
-	if (!bat.local)
-		free(bat.capture.file);
+		/* a line with bad options fails alone, the batch goes on */
+		argc = split_batch_line(config, argv);
+		if (argc < 0) {
+			fprintf(bat.err, _("Too many options\n"));
+			ret = argc;
+		} else {
+			/* zero makes getopt start over */
+			optind = 0;
+			ret = parse_arguments(&bat, argc, argv);
+			if (ret > 0) {
+				fprintf(bat.err, _("Invalid options\n"));
+				ret = -EINVAL;
+			}
+		}
+		if (ret < 0)
+			bat_report(&bat, json, &written, ret);
+		else
+			ret = bat_test(&bat, json, &written);
+		results_free(bat.results);
+
+		tests++;
+		if (ret != 0) {
+			failed++;
+			if (err == 0)
+				err = ret;
+		}
+	}
+
+	fprintf(base->log, _("\nBatch: %d tests, %d failed\n"), tests, failed);
+
+	if (own_log)
+		fclose(base->log);
+	free(line);
+	fclose(fp);
+
+	return err;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bat bat;
+	FILE *json = NULL;
+	bool written = false;
+	int err = 0;
+
+	set_defaults(&bat);
+
+#ifdef ENABLE_NLS
+	setlocale(LC_ALL, "");
+	textdomain(PACKAGE);
+#endif
+
+	err = parse_arguments(&bat, argc, argv);
+	if (err > 0) {
+		fprintf(bat.log, _("%s version %s\n\n"), PACKAGE_NAME,
+				PACKAGE_VERSION);
+		usage(&bat);
+		exit(EXIT_SUCCESS);
+	}
+	if (err < 0)
+		exit(EXIT_FAILURE);
+
+	/* keep the log out of the JSON results on stdout */
+	if (bat.json && strcmp(bat.json, "-") == 0)
+		bat.log = stderr;
+
+	fprintf(bat.log, _("%s version %s\n\n"), PACKAGE_NAME, PACKAGE_VERSION);
+
+	if (bat.json) {
+		json = results_open(&bat, bat.json, bat.batch != NULL);
+		if (json == NULL)
+			return -EIO;
+	}
+
+	if (bat.batch) {
+		err = bat_batch(&bat, json);
+	} else {
+		if (json) {
+			bat.results = results_new(NULL);
+			if (bat.results == NULL)
+				return -ENOMEM;
+		}
+		err = bat_test(&bat, json, &written);
+		results_free(bat.results);
+	}
+
+	if (json)
+		results_close(json, bat.batch != NULL);
+#ifdef HAVE_LIBFFTW3F
+	analyze_cleanup();
+#endif
 
 	return err;
 }
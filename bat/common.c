@@ -17,7 +17,9 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "aconfig.h"
 #include "gettext.h"
@@ -224,7 +226,7 @@ int update_wav_header(struct bat *bat, FILE *fp, int bytes)
 int generate_input_data(struct bat *bat, void *buffer, int bytes, int frames)
 {
 	int err;
-	static int load;
+	int load;
 
 	if (bat->playback.file != NULL) {
 		/* From input file */
@@ -250,16 +252,160 @@ int generate_input_data(struct bat *bat, void *buffer, int bytes, int frames)
 			}
 		}
 	} else {
-		/* Generate sine wave */
-		if ((bat->sinus_duration) && (load > bat->sinus_duration))
+		/* Generate test signal */
+		if ((bat->sinus_duration)
+				&& (bat->frames_generated > bat->sinus_duration))
 			return 1;
 
-		err = generate_sine_wave(bat, frames, buffer);
+		err = generate_test_signal(bat, frames, buffer);
 		if (err != 0)
 			return err;
 
-		load += frames;
+		bat->frames_generated += frames;
 	}
 
 	return 0;
 }
+
+/*
+ * Single producer / single consumer byte ring, used to hand the captured
+ * periods to the live analysis thread. The producer (capture thread) never
+ * blocks: data which does not fit is dropped and counted.
+ */
+struct bat_ring {
+	char *buf;
+	size_t size;
+	size_t head;			/* total bytes written */
+	size_t tail;			/* total bytes read */
+	size_t dropped;			/* bytes lost on overflow */
+	bool eof;			/* no more data will be written */
+	bool stop;			/* consumer asks to stop the test */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+struct bat_ring *ring_create(size_t size)
+{
+	struct bat_ring *ring;
+
+	ring = calloc(1, sizeof(*ring));
+	if (ring == NULL)
+		return NULL;
+	ring->buf = malloc(size);
+	if (ring->buf == NULL) {
+		free(ring);
+		return NULL;
+	}
+	ring->size = size;
+	pthread_mutex_init(&ring->lock, NULL);
+	pthread_cond_init(&ring->cond, NULL);
+
+	return ring;
+}
+
+void ring_free(struct bat_ring *ring)
+{
+	if (ring == NULL)
+		return;
+	pthread_cond_destroy(&ring->cond);
+	pthread_mutex_destroy(&ring->lock);
+	free(ring->buf);
+	free(ring);
+}
+
+void ring_write(struct bat_ring *ring, const void *data, size_t bytes)
+{
+	size_t pos, len;
+
+	pthread_mutex_lock(&ring->lock);
+	if (ring->eof || ring->stop) {
+		pthread_mutex_unlock(&ring->lock);
+		return;
+	}
+	if (ring->head - ring->tail + bytes > ring->size) {
+		ring->dropped += bytes;
+		pthread_mutex_unlock(&ring->lock);
+		return;
+	}
+	pthread_mutex_unlock(&ring->lock);
+
+	/* only the consumer moves the tail, so the free space can only grow */
+	pos = ring->head % ring->size;
+	len = ring->size - pos < bytes ? ring->size - pos : bytes;
+	memcpy(ring->buf + pos, data, len);
+	memcpy(ring->buf, (const char *) data + len, bytes - len);
+
+	pthread_mutex_lock(&ring->lock);
+	ring->head += bytes;
+	pthread_cond_signal(&ring->cond);
+	pthread_mutex_unlock(&ring->lock);
+}
+
+/*
+ * read exactly bytes from the ring, wait for data if necessary
+ * @return bytes, or 0 if the ring was closed or stopped before
+ */
+int ring_read(struct bat_ring *ring, void *data, size_t bytes)
+{
+	size_t pos, len;
+
+	pthread_mutex_lock(&ring->lock);
+	while (ring->head - ring->tail < bytes && !ring->eof && !ring->stop)
+		pthread_cond_wait(&ring->cond, &ring->lock);
+	if (ring->head - ring->tail < bytes || ring->stop) {
+		pthread_mutex_unlock(&ring->lock);
+		return 0;
+	}
+	pthread_mutex_unlock(&ring->lock);
+
+	pos = ring->tail % ring->size;
+	len = ring->size - pos < bytes ? ring->size - pos : bytes;
+	memcpy(data, ring->buf + pos, len);
+	memcpy((char *) data + len, ring->buf, bytes - len);
+
+	pthread_mutex_lock(&ring->lock);
+	ring->tail += bytes;
+	pthread_mutex_unlock(&ring->lock);
+
+	return bytes;
+}
+
+/* producer side: no more data */
+void ring_close(struct bat_ring *ring)
+{
+	pthread_mutex_lock(&ring->lock);
+	ring->eof = true;
+	pthread_cond_broadcast(&ring->cond);
+	pthread_mutex_unlock(&ring->lock);
+}
+
+/* consumer side: the test can be stopped */
+void ring_stop(struct bat_ring *ring)
+{
+	pthread_mutex_lock(&ring->lock);
+	ring->stop = true;
+	pthread_cond_broadcast(&ring->cond);
+	pthread_mutex_unlock(&ring->lock);
+}
+
+bool ring_stopped(struct bat_ring *ring)
+{
+	bool stop;
+
+	pthread_mutex_lock(&ring->lock);
+	stop = ring->stop;
+	pthread_mutex_unlock(&ring->lock);
+
+	return stop;
+}
+
+size_t ring_dropped(struct bat_ring *ring)
+{
+	size_t dropped;
+
+	pthread_mutex_lock(&ring->lock);
+	dropped = ring->dropped;
+	pthread_mutex_unlock(&ring->lock);
+
+	return dropped;
+}
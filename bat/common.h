@@ -26,6 +26,17 @@
 #define OPT_SNRTHD_DB			(OPT_BASE + 7)
 #define OPT_SNRTHD_PC			(OPT_BASE + 8)
 #define OPT_READCAPTURE			(OPT_BASE + 9)
+#define OPT_WISDOM			(OPT_BASE + 10)
+#define OPT_THREADS			(OPT_BASE + 11)
+#define OPT_SEGMENT			(OPT_BASE + 12)
+#define OPT_REALTIME			(OPT_BASE + 13)
+#define OPT_STOPONFAIL			(OPT_BASE + 14)
+#define OPT_SIGNAL			(OPT_BASE + 15)
+#define OPT_TONES			(OPT_BASE + 16)
+#define OPT_LATENCY_XCORR		(OPT_BASE + 17)
+#define OPT_LATENCY_RUNS		(OPT_BASE + 18)
+#define OPT_JSON			(OPT_BASE + 19)
+#define OPT_BATCH			(OPT_BASE + 20)
 
 #define COMPOSE(a, b, c, d)		((a) | ((b)<<8) | ((c)<<16) | ((d)<<24))
 #define WAV_RIFF			COMPOSE('R', 'I', 'F', 'F')
@@ -34,12 +45,19 @@
 #define WAV_DATA			COMPOSE('d', 'a', 't', 'a')
 #define WAV_FORMAT_PCM			1	/* PCM WAVE file encoding */
 
-#define MAX_CHANNELS			2
+#define MAX_CHANNELS			16
 #define MIN_CHANNELS			1
 #define MAX_PEAKS			10
 #define MAX_FRAMES			(10 * 1024 * 1024)
+/* streaming analysis does not keep the capture in memory, but the capture
+ * is still counted in int bytes and stored with 32-bit RIFF sizes */
+#define MAX_STREAM_FRAMES		(INT_MAX / 2)
+#define MAX_STREAM_BYTES		(INT_MAX - (int)sizeof(struct wav_container))
 /* Given in ms */
 #define CAPTURE_DELAY			500
+/* default segment size and ring buffer length for the live analysis */
+#define LIVE_SEGMENT			4096
+#define LIVE_RING_SECONDS		4
 /* signal frequency should be less than samplerate * RATE_FACTOR */
 #define RATE_FACTOR			0.4
 /* valid range of samplerate: (1 - RATE_RANGE, 1 + RATE_RANGE) * samplerate */
@@ -60,11 +78,23 @@
 #define LATENCY_TEST_NUMBER			5
 #define LATENCY_TEST_TIME_LIMIT			25
 #define DIV_BUFFERSIZE			2
+/* cross-correlation latency test: chirp and capture window lengths,
+ * minimum correlation peak over its rms, and maximum repetitions */
+#define XCORR_CHIRP_MS			100
+#define XCORR_WINDOW_MS			1000
+#define XCORR_MIN_PEAK_DB		20.0
+#define LATENCY_RUNS_MAX		100
+
+/* most options on one line of a batch file */
+#define BATCH_MAX_ARGS			64
 
 #define EBATBASE			1000
 #define ENOPEAK				(EBATBASE + 1)
 #define EONLYDC				(EBATBASE + 2)
 #define EBADPEAK			(EBATBASE + 3)
+#define EBADRESPONSE			(EBATBASE + 4)
+#define ELOWSNR				(EBATBASE + 5)
+#define EDROPOUT			(EBATBASE + 6)
 
 #define DC_THRESHOLD			7.01
 
@@ -74,6 +104,27 @@
 #define DELTA_RATE			0.005
 #define DELTA_HZ			1
 
+/* multi-tone signal: default number of tones and lowest default tone */
+#define MAX_TONES			32
+#define DEFAULT_TONES			8
+#define TONE_LOW			100.0
+/* half width of a windowed tone in FFT bins */
+#define TONE_BINS			5
+/* lowest frequency of the log sweep */
+#define SWEEP_LOW			20.0
+/* MLS orders supported by the generator */
+#define MLS_ORDER_MIN			10
+#define MLS_ORDER_MAX			20
+/* allowed deviation of an octave band from the 1 kHz band */
+#define RESPONSE_TOLERANCE_DB		12.0
+/* period to period SNR below which no sweep or MLS was captured */
+#define PERIODIC_SNR_MIN_DB		10.0
+/* shortest run of full scale samples counted as clipping, and shortest
+ * run of repeated samples counted as a dropout, longer for slow or weak
+ * signals */
+#define CLIP_RUN_MIN			3
+#define DROPOUT_MS			5
+
 #define FOUND_DC			(1<<1)
 #define FOUND_WRONG_PEAK		(1<<0)
 
@@ -138,6 +189,8 @@ struct wav_container {
 };
 
 struct bat;
+struct bat_ring;
+struct bat_results;
 
 enum _bat_pcm_format {
 	BAT_PCM_FORMAT_UNKNOWN = -1,
@@ -173,6 +226,13 @@ struct pcm {
 	void *(*fct)(struct bat *);
 };
 
+enum _bat_signal {
+	BAT_SIGNAL_SINE = 0,		/* one sine per channel */
+	BAT_SIGNAL_MULTITONE,		/* sum of sines per channel */
+	BAT_SIGNAL_SWEEP,		/* periodic logarithmic sweep */
+	BAT_SIGNAL_MLS,			/* periodic maximum length sequence */
+};
+
 struct sin_generator;
 
 struct sin_generator {
@@ -185,6 +245,26 @@ struct sin_generator {
 	float magnitude;
 };
 
+/* sine samples generated at once by struct sin_lanes */
+#define SIN_LANES			8
+/* frames generated per block before the conversion to samples */
+#define SIN_BLOCK_FRAMES		1024
+
+/*
+ * Sine generator for long signals: the lanes hold the next SIN_LANES
+ * samples as phasors and all of them step SIN_LANES samples at once, so
+ * the loops vectorize. The state is renormalized after every fill.
+ */
+struct sin_lanes {
+	double real[SIN_LANES];
+	double imag[SIN_LANES];
+	double step_real;
+	double step_imag;
+	float frequency;
+	float sample_rate;
+	float magnitude;
+};
+
 struct roundtrip_latency {
 	int number;
 	enum latency_state state;
@@ -197,6 +277,18 @@ struct roundtrip_latency {
 	bool is_capturing;
 	bool is_playing;
 	bool xrun_error;
+
+	/* cross-correlation measurement */
+	bool xcorr;
+	int runs;			/* number of measurements */
+	float *chirp;			/* excitation, mono */
+	int chirp_frames;
+	int chirp_pos;			/* next chirp frame to play */
+	float *capture;			/* captured window, mono */
+	int capture_size;		/* allocated floats in capture */
+	int window;			/* frames to capture */
+	int captured;
+	float delay[LATENCY_RUNS_MAX];	/* results in frames */
 };
 
 struct noise_analyzer {
@@ -220,12 +312,27 @@ struct bat {
 	float sigma_k;			/* threshold for peak detection */
 	float snr_thd_db;		/* threshold for noise detection (dB) */
 	float target_freq[MAX_CHANNELS];
+	enum _bat_signal signal;	/* test signal type */
+	int tones;			/* number of multi-tone frequencies */
+	float tone_freq[MAX_TONES];	/* multi-tone frequencies, ascending */
 
 	int sinus_duration;		/* number of frames for playback */
 	char *narg;			/* argument string of duration */
 	char *logarg;			/* path name of log file */
 	char *debugplay;		/* path name to store playback signal */
 	char *capturefile;		/* path name for previously saved recording */
+	char *wisdom;			/* path name of FFTW wisdom cache */
+	int threads;			/* analysis threads, 0 = one per CPU */
+	int segment;			/* streaming analysis segment in frames */
+	bool realtime;			/* analyze while capturing */
+	bool stop_on_fail;		/* stop live test at first failure */
+	struct bat_ring *ring;		/* capture data for live analysis */
+	char *json;			/* path name of JSON results, - for stdout */
+	char *batch;			/* path name of batch configurations */
+	struct bat_results *results;	/* measurements for the JSON results */
+	unsigned int underruns;		/* playback xruns */
+	unsigned int overruns;		/* capture xruns */
+	int frames_generated;		/* frames of generated signal played */
 	bool standalone;		/* enable to bypass analysis */
 	bool roundtriplatency;		/* enable round trip latency */
 
@@ -262,3 +369,12 @@ int read_wav_header(struct bat *, char *, FILE *, bool);
 int write_wav_header(FILE *, struct wav_container *, struct bat *);
 int update_wav_header(struct bat *, FILE *, int);
 int generate_input_data(struct bat *, void *, int, int);
+
+struct bat_ring *ring_create(size_t);
+void ring_free(struct bat_ring *);
+void ring_write(struct bat_ring *, const void *, size_t);
+int ring_read(struct bat_ring *, void *, size_t);
+void ring_close(struct bat_ring *);
+void ring_stop(struct bat_ring *);
+bool ring_stopped(struct bat_ring *);
+size_t ring_dropped(struct bat_ring *);
@@ -0,0 +1,147 @@
+/*
+ * Benchmark of the alsabat sample conversions: the vector versions are
+ * checked against the scalar ones and both are timed.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "convert.h"
+
+/* odd number of samples, so the scalar tails are exercised too */
+#define BENCH_SAMPLES		((1 << 20) + 7)
+#define BENCH_ROUNDS		50
+
+struct format {
+	const char *name;
+	int width;			/* bytes per sample */
+	float max;			/* largest value of the format */
+	float offset;			/* zero level */
+	void (*to_float)(void *, float *, int);
+	void (*from_float)(float *, void *, int, int);
+};
+
+static const struct format formats[] = {
+	{ "U8", 1, 127, 128,
+		convert_uint8_to_float, convert_float_to_uint8 },
+	{ "S16_LE", 2, INT16_MAX, 0,
+		convert_int16_to_float, convert_float_to_int16 },
+	{ "S24_3LE", 3, (1 << 23) - 1, 0,
+		convert_int24_to_float, convert_float_to_int24 },
+	{ "S32_LE", 4, INT32_MAX, 0,
+		convert_int32_to_float, convert_float_to_int32 },
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* nanoseconds per sample of the to_float (dir 0) or from_float (dir 1) */
+static double run(const struct format *f, int dir, void *pcm, float *val)
+{
+	double start;
+	int i;
+
+	start = now();
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		if (dir == 0)
+			f->to_float(pcm, val, BENCH_SAMPLES);
+		else
+			f->from_float(val, pcm, BENCH_SAMPLES, 1);
+	}
+
+	return (now() - start) * 1e9 / BENCH_ROUNDS / BENCH_SAMPLES;
+}
+
+static int bench_format(const struct format *f)
+{
+	size_t bytes = (size_t) BENCH_SAMPLES * f->width;
+	uint8_t *pcm, *pcm_ref;
+	float *val, *val_ref, *src;
+	double t_scalar, t_simd;
+	int i, dir, err = 0;
+
+	pcm = malloc(bytes);
+	pcm_ref = malloc(bytes);
+	val = malloc(BENCH_SAMPLES * sizeof(float));
+	val_ref = malloc(BENCH_SAMPLES * sizeof(float));
+	src = malloc(BENCH_SAMPLES * sizeof(float));
+	if (!pcm || !pcm_ref || !val || !val_ref || !src) {
+		fprintf(stderr, "Not enough memory.\n");
+		err = -1;
+		goto exit;
+	}
+
+	/* full range input in both directions, with fractional floats */
+	for (i = 0; i < bytes; i++)
+		pcm[i] = rand();
+	for (i = 0; i < BENCH_SAMPLES; i++)
+		src[i] = f->offset + f->max * (2.0 * rand() / RAND_MAX - 1.0)
+				* 0.95;
+
+	for (dir = 0; dir < 2; dir++) {
+		if (dir == 1)
+			memcpy(val, src, BENCH_SAMPLES * sizeof(float));
+
+		convert_use_simd(false);
+		t_scalar = run(f, dir, pcm, val);
+		if (dir == 0)
+			memcpy(val_ref, val, BENCH_SAMPLES * sizeof(float));
+		else
+			memcpy(pcm_ref, pcm, bytes);
+
+		convert_use_simd(true);
+		t_simd = run(f, dir, pcm, val);
+
+		printf("%-8s %-10s scalar %6.3f ns  simd %6.3f ns  x%.2f\n",
+				f->name, dir == 0 ? "to float" : "from float",
+				t_scalar, t_simd, t_scalar / t_simd);
+
+		if ((dir == 0 && memcmp(val, val_ref,
+				BENCH_SAMPLES * sizeof(float)) != 0) ||
+		    (dir == 1 && memcmp(pcm, pcm_ref, bytes) != 0)) {
+			fprintf(stderr, "%s: %s results differ\n", f->name,
+					dir == 0 ? "to float" : "from float");
+			err = -1;
+		}
+	}
+
+exit:
+	free(src);
+	free(val_ref);
+	free(val);
+	free(pcm_ref);
+	free(pcm);
+	return err;
+}
+
+int main(void)
+{
+	int i, err = 0;
+
+	printf("%d samples, %d rounds\n", BENCH_SAMPLES, BENCH_ROUNDS);
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+		if (bench_format(&formats[i]) < 0)
+			err = 1;
+
+	return err;
+}
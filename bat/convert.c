@@ -17,29 +17,232 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
 
-void convert_uint8_to_float(void *buf, float *val, int samples)
+#include "convert.h"
+
+/*
+ * The conversions run over every generated and captured sample, so on
+ * x86 they have AVX2 versions, picked at run time when the CPU has it.
+ * The vector helpers return the number of samples they converted and
+ * the scalar loops do the rest, which keeps the results identical.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CONVERT_AVX2
+#include <immintrin.h>
+#endif
+
+static bool simd_enabled = true;
+
+/* turn the vector versions off, to compare them with the scalar ones */
+void convert_use_simd(bool enable)
+{
+	simd_enabled = enable;
+}
+
+#ifdef CONVERT_AVX2
+static inline bool use_avx2(void)
+{
+	return simd_enabled && __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static int uint8_to_float_avx2(const uint8_t *buf, float *val, int samples)
+{
+	int i;
+
+	for (i = 0; i + 8 <= samples; i += 8) {
+		__m128i b = _mm_loadl_epi64((const __m128i *) (buf + i));
+
+		_mm256_storeu_ps(val + i,
+				_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b)));
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static int int16_to_float_avx2(const int16_t *buf, float *val, int samples)
+{
+	int i;
+
+	for (i = 0; i + 8 <= samples; i += 8) {
+		__m128i b = _mm_loadu_si128((const __m128i *) (buf + i));
+
+		_mm256_storeu_ps(val + i,
+				_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(b)));
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static int int24_to_float_avx2(const uint8_t *buf, float *val, int samples)
+{
+	/* move the 3 bytes of a sample to the top of a 32 bit lane */
+	const __m128i spread = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5,
+			-1, 6, 7, 8, -1, 9, 10, 11);
+	__m128i lo, hi;
+	int i;
+
+	/* each load reads 4 bytes beyond its 12 bytes of samples */
+	for (i = 0; i + 10 <= samples; i += 8) {
+		lo = _mm_loadu_si128((const __m128i *) (buf + i * 3));
+		hi = _mm_loadu_si128((const __m128i *) (buf + i * 3 + 12));
+		lo = _mm_srai_epi32(_mm_shuffle_epi8(lo, spread), 8);
+		hi = _mm_srai_epi32(_mm_shuffle_epi8(hi, spread), 8);
+		_mm256_storeu_ps(val + i, _mm256_cvtepi32_ps(
+				_mm256_inserti128_si256(
+				_mm256_castsi128_si256(lo), hi, 1)));
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static int int32_to_float_avx2(const int32_t *buf, float *val, int samples)
+{
+	int i;
+
+	for (i = 0; i + 8 <= samples; i += 8) {
+		__m256i b = _mm256_loadu_si256((const __m256i *) (buf + i));
+
+		_mm256_storeu_ps(val + i, _mm256_cvtepi32_ps(b));
+	}
+
+	return i;
+}
+
+/* float to int32 with truncation, like the C cast */
+__attribute__((target("avx2")))
+static inline __m256i load_trunc(const float *val)
+{
+	return _mm256_cvttps_epi32(_mm256_loadu_ps(val));
+}
+
+/*
+ * The samples are wrapped to the low bits first, as the scalar casts do
+ * on x86, so the packs never saturate and out of range samples convert
+ * the same way on both paths.
+ */
+__attribute__((target("avx2")))
+static int float_to_uint8_avx2(const float *val, uint8_t *buf, int samples)
+{
+	const __m256i low = _mm256_set1_epi32(0xff);
+	__m256i a, b, w;
+	int i;
+
+	for (i = 0; i + 16 <= samples; i += 16) {
+		a = _mm256_and_si256(load_trunc(val + i), low);
+		b = _mm256_and_si256(load_trunc(val + i + 8), low);
+		/* the packs work per 128 bit lane, restore the order */
+		w = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xd8);
+		w = _mm256_packus_epi16(w, w);
+		w = _mm256_permute4x64_epi64(w, 0xd8);
+		_mm_storeu_si128((__m128i *) (buf + i),
+				_mm256_castsi256_si128(w));
+	}
+
+	return i;
+}
+
+/* sign extend the low 16 bits of each 32 bit lane */
+__attribute__((target("avx2")))
+static inline __m256i wrap16(__m256i a)
+{
+	return _mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16);
+}
+
+__attribute__((target("avx2")))
+static int float_to_int16_avx2(const float *val, int16_t *buf, int samples)
+{
+	__m256i a, b;
+	int i;
+
+	for (i = 0; i + 16 <= samples; i += 16) {
+		a = wrap16(load_trunc(val + i));
+		b = wrap16(load_trunc(val + i + 8));
+		a = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8);
+		_mm256_storeu_si256((__m256i *) (buf + i), a);
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static int float_to_int24_avx2(const float *val, uint8_t *buf, int samples)
 {
+	/* drop the top byte of each 32 bit lane */
+	const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9,
+			10, 12, 13, 14, -1, -1, -1, -1);
+	__m256i a;
+	__m128i lo, hi;
+	uint32_t tail;
 	int i;
 
-	for (i = 0; i < samples; i++)
+	for (i = 0; i + 8 <= samples; i += 8) {
+		a = load_trunc(val + i);
+		lo = _mm_shuffle_epi8(_mm256_castsi256_si128(a), pack);
+		hi = _mm_shuffle_epi8(_mm256_extracti128_si256(a, 1), pack);
+		/* store exactly 24 bytes */
+		_mm_storel_epi64((__m128i *) (buf + i * 3), lo);
+		tail = _mm_extract_epi32(lo, 2);
+		memcpy(buf + i * 3 + 8, &tail, 4);
+		_mm_storel_epi64((__m128i *) (buf + i * 3 + 12), hi);
+		tail = _mm_extract_epi32(hi, 2);
+		memcpy(buf + i * 3 + 20, &tail, 4);
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static int float_to_int32_avx2(const float *val, int32_t *buf, int samples)
+{
+	int i;
+
+	for (i = 0; i + 8 <= samples; i += 8)
+		_mm256_storeu_si256((__m256i *) (buf + i), load_trunc(val + i));
+
+	return i;
+}
+#endif
+
+void convert_uint8_to_float(void *buf, float *val, int samples)
+{
+	int i = 0;
+
+#ifdef CONVERT_AVX2
+	if (use_avx2())
+		i = uint8_to_float_avx2(buf, val, samples);
+#endif
+	for (; i < samples; i++)
 		val[i] = ((uint8_t *) buf)[i];
 }
 
 void convert_int16_to_float(void *buf, float *val, int samples)
 {
-	int i;
+	int i = 0;
 
-	for (i = 0; i < samples; i++)
+#ifdef CONVERT_AVX2
+	if (use_avx2())
+		i = int16_to_float_avx2(buf, val, samples);
+#endif
+	for (; i < samples; i++)
 		val[i] = ((int16_t *) buf)[i];
 }
 
 void convert_int24_to_float(void *buf, float *val, int samples)
 {
-	int i;
+	int i = 0;
 	int32_t tmp;
 
-	for (i = 0; i < samples; i++) {
+#ifdef CONVERT_AVX2
+	if (use_avx2())
+		i = int24_to_float_avx2(buf, val, samples);
+#endif
+	for (; i < samples; i++) {
 		tmp = ((uint8_t *) buf)[i * 3 + 2] << 24;
 		tmp |= ((uint8_t *) buf)[i * 3 + 1] << 16;
 		tmp |= ((uint8_t *) buf)[i * 3] << 8;
@@ -50,64 +253,66 @@ void convert_int24_to_float(void *buf, float *val, int samples)
 
 void convert_int32_to_float(void *buf, float *val, int samples)
 {
-	int i;
+	int i = 0;
 
-	for (i = 0; i < samples; i++)
+#ifdef CONVERT_AVX2
+	if (use_avx2())
+		i = int32_to_float_avx2(buf, val, samples);
+#endif
+	for (; i < samples; i++)
 		val[i] = ((int32_t *) buf)[i];
 }
 
+/* the interleaved channels are converted as one sample stream */
 void convert_float_to_uint8(float *val, void *buf, int samples, int channels)
 {
-	int i, c, idx;
+	int i = 0, n = samples * channels;
 
-	for (i = 0; i < samples; i++) {
-		for (c = 0; c < channels; c++) {
-			idx = i * channels + c;
-			((uint8_t *) buf)[idx] = (uint8_t) val[idx];
-		}
-	}
+#ifdef CONVERT_AVX2
+	if (use_avx2())
+		i = float_to_uint8_avx2(val, buf, n);
+#endif
+	for (; i < n; i++)
+		((uint8_t *) buf)[i] = (uint8_t) val[i];
 }
 
 void convert_float_to_int16(float *val, void *buf, int samples, int channels)
 {
-	int i, c, idx;
+	int i = 0, n = samples * channels;
 
-	for (i = 0; i < samples; i++) {
-		for (c = 0; c < channels; c++) {
-			idx = i * channels + c;
-			((int16_t *) buf)[idx] = (int16_t) val[idx];
-		}
-	}
+#ifdef CONVERT_AVX2
+	if (use_avx2())
+		i = float_to_int16_avx2(val, buf, n);
+#endif
+	for (; i < n; i++)
+		((int16_t *) buf)[i] = (int16_t) val[i];
 }
 
 void convert_float_to_int24(float *val, void *buf, int samples, int channels)
 {
-	int i, c, idx_f, idx_i;
+	int i = 0, n = samples * channels;
 	int32_t val_f_i;
 
-	for (i = 0; i < samples; i++) {
-		for (c = 0; c < channels; c++) {
-			idx_f = i * channels + c;
-			idx_i = 3 * idx_f;
-			val_f_i = (int32_t) val[idx_f];
-			((int8_t *) buf)[idx_i + 0] =
-				(int8_t) (val_f_i & 0xff);
-			((int8_t *) buf)[idx_i + 1] =
-				(int8_t) ((val_f_i >> 8) & 0xff);
-			((int8_t *) buf)[idx_i + 2] =
-				(int8_t) ((val_f_i >> 16) & 0xff);
-		}
+#ifdef CONVERT_AVX2
+	if (use_avx2())
+		i = float_to_int24_avx2(val, buf, n);
+#endif
+	for (; i < n; i++) {
+		val_f_i = (int32_t) val[i];
+		((int8_t *) buf)[i * 3 + 0] = (int8_t) (val_f_i & 0xff);
+		((int8_t *) buf)[i * 3 + 1] = (int8_t) ((val_f_i >> 8) & 0xff);
+		((int8_t *) buf)[i * 3 + 2] = (int8_t) ((val_f_i >> 16) & 0xff);
 	}
 }
 
 void convert_float_to_int32(float *val, void *buf, int samples, int channels)
 {
-	int i, c, idx;
+	int i = 0, n = samples * channels;
 
-	for (i = 0; i < samples; i++) {
-		for (c = 0; c < channels; c++) {
-			idx = i * channels + c;
-			((int32_t *) buf)[idx] = (int32_t) val[idx];
-		}
-	}
+#ifdef CONVERT_AVX2
+	if (use_avx2())
+		i = float_to_int32_avx2(val, buf, n);
+#endif
+	for (; i < n; i++)
+		((int32_t *) buf)[i] = (int32_t) val[i];
 }
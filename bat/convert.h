@@ -13,6 +13,9 @@
  *
  */
 
+#include <stdbool.h>
+
+void convert_use_simd(bool);
 void convert_uint8_to_float(void *, float *, int);
 void convert_int16_to_float(void *, float *, int);
 void convert_int24_to_float(void *, float *, int);
@@ -18,10 +18,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <errno.h>
 
+#include "aconfig.h"
 #include "common.h"
 #include "bat-signal.h"
 #include "gettext.h"
+#ifdef HAVE_LIBFFTW3F
+#include "analyze.h"
+#endif
 
 /* How one measurement step works:
    - Listen and measure the average loudness of the environment for 1 second.
@@ -153,6 +158,187 @@ static void play_and_listen(struct bat *bat, void *buffer, int frames)
 	return;
 }
 
+void roundtrip_latency_free(struct bat *bat)
+{
+	free(bat->latency.chirp);
+	free(bat->latency.capture);
+	bat->latency.chirp = bat->latency.capture = NULL;
+	bat->latency.capture_size = 0;
+}
+
+#ifdef HAVE_LIBFFTW3F
+/* Cross-correlation measurement, selected with --latency-xcorr:
+   - Wait for 1 second, as above.
+   - Play a short chirp and capture one second from the same point on.
+   - The peak of the cross-correlation of the capture with the chirp is
+     the round trip latency, interpolated to a fraction of a frame.
+   - Repeat for the requested number of runs and report statistics. */
+
+static int compare_delay(const void *a, const void *b)
+{
+	float da = *(const float *) a, db = *(const float *) b;
+
+	return (da > db) - (da < db);
+}
+
+static void xcorr_statistics(struct bat *bat)
+{
+	struct roundtrip_latency *lat = &bat->latency;
+	float sorted[LATENCY_RUNS_MAX];
+	float mean = 0.0, sigma = 0.0, median;
+	int n;
+
+	for (n = 0; n < lat->runs; n++)
+		mean += lat->delay[n];
+	mean /= lat->runs;
+	for (n = 0; n < lat->runs; n++)
+		sigma += (lat->delay[n] - mean) * (lat->delay[n] - mean);
+	sigma = lat->runs > 1 ? sqrtf(sigma / (lat->runs - 1)) : 0.0;
+
+	memcpy(sorted, lat->delay, lat->runs * sizeof(float));
+	qsort(sorted, lat->runs, sizeof(float), compare_delay);
+	median = lat->runs % 2 ? sorted[lat->runs / 2] :
+			(sorted[lat->runs / 2 - 1] + sorted[lat->runs / 2]) / 2;
+
+	fprintf(bat->log, _("Final round trip latency: %.2f frames (%.3f ms)\n"),
+			mean, mean * 1000 / bat->rate);
+	fprintf(bat->log, _(" %d tests, deviation %.2f, min %.2f, max %.2f,"),
+			lat->runs, sigma, sorted[0], sorted[lat->runs - 1]);
+	fprintf(bat->log, _(" median %.2f frames\n"), median);
+
+	lat->final_result = (int) (mean * 1000 / bat->rate + 0.5);
+}
+
+static void xcorr_measure(struct bat *bat)
+{
+	struct roundtrip_latency *lat = &bat->latency;
+	int num = lat->number;
+	float delay = 0.0, peak_db = 0.0;
+	int err;
+
+	lat->captured = 0;
+	lat->samples = 0;
+
+	err = xcorr_delay(bat, lat->capture, lat->window, lat->chirp,
+			lat->chirp_frames, &delay, &peak_db);
+	if (err == -ENOPEAK) {
+		fprintf(bat->err, _("Test%d, no correlation peak (%.1f dB)\n"),
+				num, peak_db);
+		if (++lat->error > LATENCY_TEST_NUMBER) {
+			fprintf(bat->err, _("Could not detect signal."));
+			fprintf(bat->err, _("Too much background noise?\n"));
+			goto failure;
+		}
+		/* let's start over */
+		lat->state = LATENCY_STATE_WAITING;
+		return;
+	} else if (err < 0) {
+		fprintf(bat->err, _("Correlation failed: %d\n"), err);
+		goto failure;
+	}
+
+	lat->delay[num - 1] = delay;
+	fprintf(bat->log, _("Test%d, round trip latency %.2f frames (%.3f ms),"),
+			num, delay, delay * 1000 / bat->rate);
+	fprintf(bat->log, _(" correlation peak %.1f dB\n"), peak_db);
+
+	if (num == lat->runs) {
+		xcorr_statistics(bat);
+		lat->state = LATENCY_STATE_COMPLETE_SUCCESS;
+		lat->is_capturing = false;
+		return;
+	}
+
+	lat->number++;
+	lat->state = LATENCY_STATE_WAITING;
+	return;
+
+failure:
+	lat->state = LATENCY_STATE_COMPLETE_FAILURE;
+	lat->is_capturing = false;
+}
+
+static void xcorr_listen(struct bat *bat, void *buffer, int frames)
+{
+	struct roundtrip_latency *lat = &bat->latency;
+	int i, need = lat->captured + frames * bat->channels;
+	float *p;
+
+	if (need > lat->capture_size) {
+		p = realloc(lat->capture, need * sizeof(float));
+		if (p == NULL) {
+			fprintf(bat->err, _("Not enough memory.\n"));
+			lat->state = LATENCY_STATE_COMPLETE_FAILURE;
+			lat->is_capturing = false;
+			return;
+		}
+		lat->capture = p;
+		lat->capture_size = need;
+	}
+
+	/* keep the first channel */
+	p = lat->capture + lat->captured;
+	bat->convert_sample_to_float(buffer, p, frames * bat->channels);
+	for (i = 0; i < frames; i++)
+		p[i] = p[i * bat->channels];
+	lat->captured += frames;
+
+	if (lat->captured >= lat->window)
+		xcorr_measure(bat);
+}
+
+static int xcorr_output(struct bat *bat, void *buffer, int bytes,
+		int frames)
+{
+	struct roundtrip_latency *lat = &bat->latency;
+	int err, n = lat->chirp_frames - lat->chirp_pos;
+	float *val;
+
+	/* Output silence after the chirp */
+	if (n <= 0) {
+		memset(buffer, 0, bytes);
+		return 0;
+	}
+
+	val = calloc(frames, sizeof(float));
+	if (val == NULL)
+		return -ENOMEM;
+
+	if (n > frames)
+		n = frames;
+	memcpy(val, lat->chirp + lat->chirp_pos, n * sizeof(float));
+	lat->chirp_pos += n;
+
+	err = generate_mono_waveform(bat, val, frames, buffer);
+	free(val);
+
+	return err;
+}
+
+static int xcorr_init(struct bat *bat)
+{
+	struct roundtrip_latency *lat = &bat->latency;
+
+	roundtrip_latency_free(bat);
+
+	lat->chirp_frames = bat->rate * XCORR_CHIRP_MS / 1000;
+	lat->window = bat->rate * XCORR_WINDOW_MS / 1000;
+	lat->chirp_pos = 0;
+	lat->captured = 0;
+
+	lat->chirp = malloc(lat->chirp_frames * sizeof(float));
+	if (lat->chirp == NULL)
+		return -ENOMEM;
+	generate_chirp(bat, lat->chirp, lat->chirp_frames);
+
+	/* each run takes about 3 seconds */
+	if (bat->frames < (lat->runs * 3 + 2) * bat->rate)
+		bat->frames = (lat->runs * 3 + 2) * bat->rate;
+
+	return xcorr_prepare(bat, lat->window, lat->chirp_frames);
+}
+#endif
+
 static void calculate_threshold(struct bat *bat)
 {
 	float average;
@@ -166,7 +352,7 @@ static void calculate_threshold(struct bat *bat)
 						* 32767.0f);
 }
 
-void roundtrip_latency_init(struct bat *bat)
+int roundtrip_latency_init(struct bat *bat)
 {
 	bat->latency.number = 1;
 	bat->latency.state = LATENCY_STATE_MEASURE_FOR_1_SECOND;
@@ -180,6 +366,12 @@ void roundtrip_latency_init(struct bat *bat)
 	bat->latency.xrun_error = false;
 	bat->frames = LATENCY_TEST_TIME_LIMIT * bat->rate;
 	bat->periods_played = 0;
+
+#ifdef HAVE_LIBFFTW3F
+	if (bat->latency.xcorr)
+		return xcorr_init(bat);
+#endif
+	return 0;
 }
 
 int handleinput(struct bat *bat, void *buffer, int frames)
@@ -201,6 +393,12 @@ int handleinput(struct bat *bat, void *buffer, int frames)
 
 	/* Playing sine wave and listening if it comes back */
 	case LATENCY_STATE_PLAY_AND_LISTEN:
+#ifdef HAVE_LIBFFTW3F
+		if (bat->latency.xcorr) {
+			xcorr_listen(bat, buffer, frames);
+			break;
+		}
+#endif
 		play_and_listen(bat, buffer, frames);
 		break;
 
@@ -231,11 +429,17 @@ int handleoutput(struct bat *bat, void *buffer, int bytes, int frames)
 			&& bat->latency.is_capturing == false)
 		return bat->latency.state;
 
-	if (bat->latency.state == LATENCY_STATE_PLAY_AND_LISTEN)
+	if (bat->latency.state == LATENCY_STATE_PLAY_AND_LISTEN) {
+#ifdef HAVE_LIBFFTW3F
+		if (bat->latency.xcorr)
+			return xcorr_output(bat, buffer, bytes, frames);
+#endif
 		err = generate_sine_wave(bat, frames, buffer);
-	else
+	} else {
 		/* Output silence */
 		memset(buffer, 0, bytes);
+		bat->latency.chirp_pos = 0;
+	}
 
 	return err;
 }
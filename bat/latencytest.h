@@ -12,6 +12,7 @@
  * GNU General Public License for more details.
  *
  */
-void roundtrip_latency_init(struct bat *);
+int roundtrip_latency_init(struct bat *);
+void roundtrip_latency_free(struct bat *);
 int handleinput(struct bat *, void *, int);
 int handleoutput(struct bat *, void *, int, int);
@@ -0,0 +1,352 @@
+/*
+ * Machine readable alsabat results
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <math.h>
+
+#include "gettext.h"
+#include "common.h"
+#include "results.h"
+
+/*
+ * The analysis records its measurements here while it logs them, and
+ * the results are written as one JSON object per test. Every channel
+ * has its own slot, so the parallel analysis needs no locking.
+ */
+struct bat_results *results_new(const char *config)
+{
+	struct bat_results *res;
+	int c;
+
+	res = calloc(1, sizeof(*res));
+	if (res == NULL)
+		return NULL;
+
+	if (config) {
+		res->config = strdup(config);
+		if (res->config == NULL) {
+			free(res);
+			return NULL;
+		}
+	}
+	for (c = 0; c < MAX_CHANNELS; c++)
+		res->channel[c].snr_db = SNR_DB_INVALID;
+
+	return res;
+}
+
+void results_free(struct bat_results *res)
+{
+	if (res == NULL)
+		return;
+	free(res->config);
+	free(res);
+}
+
+void results_peak(struct bat *bat, int channel, float hz, float db)
+{
+	struct channel_result *ch;
+
+	if (bat->results == NULL)
+		return;
+	ch = &bat->results->channel[channel];
+	if (ch->peaks < MAX_PEAKS) {
+		ch->peak_hz[ch->peaks] = hz;
+		ch->peak_db[ch->peaks] = db;
+		ch->peaks++;
+	}
+}
+
+void results_snr(struct bat *bat, int channel, float snr_db)
+{
+	if (bat->results)
+		bat->results->channel[channel].snr_db = snr_db;
+}
+
+void results_tone(struct bat *bat, int channel, int tone, float level_db,
+		float thdn_db)
+{
+	struct channel_result *ch;
+
+	if (bat->results == NULL)
+		return;
+	ch = &bat->results->channel[channel];
+	ch->tone_level_db[tone] = level_db;
+	ch->tone_thdn_db[tone] = thdn_db;
+	if (ch->tones <= tone)
+		ch->tones = tone + 1;
+}
+
+void results_stats(struct bat *bat, int channel,
+		const struct signal_stats *stats)
+{
+	if (bat->results == NULL)
+		return;
+	bat->results->channel[channel].stats = *stats;
+	bat->results->channel[channel].has_stats = true;
+}
+
+void results_channel(struct bat *bat, int channel, int err)
+{
+	if (bat->results == NULL)
+		return;
+	bat->results->channel[channel].analyzed = true;
+	bat->results->channel[channel].err = err;
+}
+
+/* forget the measurements of a channel the analysis did not report */
+void results_channel_clear(struct bat *bat, int channel)
+{
+	struct channel_result *ch;
+
+	if (bat->results == NULL)
+		return;
+	ch = &bat->results->channel[channel];
+	memset(ch, 0, sizeof(*ch));
+	ch->snr_db = SNR_DB_INVALID;
+}
+
+static void json_string(FILE *fp, const char *s)
+{
+	if (s == NULL) {
+		fputs("null", fp);
+		return;
+	}
+
+	fputc('"', fp);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(fp, "\\%c", *s);
+		else if ((unsigned char) *s < 0x20)
+			fprintf(fp, "\\u%04x", *s);
+		else
+			fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+/* JSON has no NaN or infinity */
+static void json_float(FILE *fp, double val)
+{
+	if (isfinite(val))
+		fprintf(fp, "%.3f", val);
+	else
+		fputs("null", fp);
+}
+
+static const char *format_name(enum _bat_pcm_format format)
+{
+	switch (format) {
+	case BAT_PCM_FORMAT_U8:
+		return "U8";
+	case BAT_PCM_FORMAT_S16_LE:
+		return "S16_LE";
+	case BAT_PCM_FORMAT_S24_3LE:
+		return "S24_3LE";
+	case BAT_PCM_FORMAT_S32_LE:
+		return "S32_LE";
+	default:
+		return NULL;
+	}
+}
+
+static const char *signal_name(enum _bat_signal signal)
+{
+	switch (signal) {
+	case BAT_SIGNAL_MULTITONE:
+		return "multitone";
+	case BAT_SIGNAL_SWEEP:
+		return "sweep";
+	case BAT_SIGNAL_MLS:
+		return "mls";
+	default:
+		return "sine";
+	}
+}
+
+static void write_stats(FILE *fp, struct channel_result *ch)
+{
+	struct signal_stats *s = &ch->stats;
+
+	if (!ch->has_stats) {
+		fputs("null", fp);
+		return;
+	}
+
+	fputs("{ \"peak\": ", fp);
+	json_float(fp, s->peak);
+	fputs(", \"rms\": ", fp);
+	json_float(fp, s->rms);
+	fputs(", \"crest_db\": ", fp);
+	json_float(fp, s->crest_db);
+	fputs(", \"dc\": ", fp);
+	json_float(fp, s->dc);
+	fprintf(fp, ",\n        \"clipped\": %d, \"clip_runs\": %d,"
+			" \"clip_longest\": %d,", s->clipped, s->clip_runs,
+			s->clip_longest);
+	fprintf(fp, " \"dropouts\": %d, \"dropout_longest\": %d,",
+			s->dropouts, s->dropout_longest);
+	fprintf(fp, " \"zero_runs\": %d, \"zero_longest\": %d }",
+			s->zero_runs, s->zero_longest);
+}
+
+static void write_channel(struct bat *bat, FILE *fp, int c)
+{
+	struct channel_result *ch = &bat->results->channel[c];
+	int i;
+
+	fprintf(fp, "    { \"channel\": %d, \"analyzed\": %s, \"return\": %d,",
+			c + 1, ch->analyzed ? "true" : "false", ch->err);
+	fputs(" \"target_hz\": ", fp);
+	json_float(fp, bat->signal == BAT_SIGNAL_SINE ?
+			bat->target_freq[c] : NAN);
+	fputs(",\n      \"peaks\": [", fp);
+	for (i = 0; i < ch->peaks; i++) {
+		fprintf(fp, "%s{ \"hz\": ", i ? ", " : " ");
+		json_float(fp, ch->peak_hz[i]);
+		fputs(", \"db\": ", fp);
+		json_float(fp, ch->peak_db[i]);
+		fputs(" }", fp);
+	}
+	fputs(" ],\n      \"snr_db\": ", fp);
+	json_float(fp, snr_is_valid(ch->snr_db) ? ch->snr_db : NAN);
+	fputs(",\n      \"tones\": [", fp);
+	for (i = 0; i < ch->tones; i++) {
+		fprintf(fp, "%s{ \"hz\": ", i ? ", " : " ");
+		json_float(fp, bat->tone_freq[i]);
+		fputs(", \"level_db\": ", fp);
+		json_float(fp, ch->tone_level_db[i]);
+		fputs(", \"thdn_db\": ", fp);
+		json_float(fp, ch->tone_thdn_db[i]);
+		fputs(" }", fp);
+	}
+	fputs(" ],\n      \"stats\": ", fp);
+	write_stats(fp, ch);
+	fputs(" }", fp);
+}
+
+static void write_latency(struct bat *bat, FILE *fp)
+{
+	struct roundtrip_latency *lat = &bat->latency;
+	bool success = lat->state == LATENCY_STATE_COMPLETE_SUCCESS;
+	int i, runs;
+
+	if (lat->xcorr)
+		runs = success ? lat->runs : lat->number - 1;
+	else
+		runs = success ? LATENCY_TEST_NUMBER : lat->number - 1;
+
+	fprintf(fp, "{ \"success\": %s, \"method\": \"%s\", \"ms\": %d,",
+			success ? "true" : "false",
+			lat->xcorr ? "xcorr" : "threshold",
+			success ? lat->final_result : 0);
+	fputs(" \"runs_ms\": [", fp);
+	for (i = 0; i < runs; i++) {
+		fputs(i ? ", " : " ", fp);
+		json_float(fp, lat->xcorr ? lat->delay[i] * 1000 / bat->rate
+				: lat->result[i]);
+	}
+	fputs(" ]", fp);
+	if (lat->xcorr) {
+		fputs(", \"runs_frames\": [", fp);
+		for (i = 0; i < runs; i++) {
+			fputs(i ? ", " : " ", fp);
+			json_float(fp, lat->delay[i]);
+		}
+		fputs(" ]", fp);
+	}
+	fputs(" }", fp);
+}
+
+FILE *results_open(struct bat *bat, const char *path, bool batch)
+{
+	FILE *fp;
+
+	if (strcmp(path, "-") == 0) {
+		fp = stdout;
+	} else {
+		fp = fopen(path, "w");
+		if (fp == NULL) {
+			fprintf(bat->err, _("Cannot open file: %s %d\n"),
+					path, -errno);
+			return NULL;
+		}
+	}
+
+	if (batch)
+		fputs("[\n", fp);
+
+	return fp;
+}
+
+/* write the results of the finished test, first is false to append */
+void results_write(struct bat *bat, FILE *fp, bool first)
+{
+	struct bat_results *res = bat->results;
+	int c;
+
+	if (!first)
+		fputs(",\n", fp);
+
+	fputs("{\n  \"config\": ", fp);
+	json_string(fp, res->config);
+	fprintf(fp, ",\n  \"return\": %d,\n", res->err);
+	fputs("  \"playback_device\": ", fp);
+	json_string(fp, bat->playback.device);
+	fputs(",\n  \"capture_device\": ", fp);
+	json_string(fp, bat->capture.device);
+	fprintf(fp, ",\n  \"rate\": %u,\n  \"channels\": %d,\n",
+			bat->rate, bat->channels);
+	fputs("  \"format\": ", fp);
+	json_string(fp, format_name(bat->format));
+	fprintf(fp, ",\n  \"frames\": %d,\n", bat->frames);
+	fputs("  \"signal\": ", fp);
+	json_string(fp, signal_name(bat->signal));
+	fprintf(fp, ",\n  \"underruns\": %u,\n  \"overruns\": %u,\n",
+			bat->underruns, bat->overruns);
+	fputs("  \"test_seconds\": ", fp);
+	json_float(fp, res->test_seconds);
+	fputs(",\n  \"analysis_seconds\": ", fp);
+	json_float(fp, res->analysis_seconds);
+
+	fputs(",\n  \"latency\": ", fp);
+	if (bat->roundtriplatency)
+		write_latency(bat, fp);
+	else
+		fputs("null", fp);
+
+	fputs(",\n  \"channel\": [\n", fp);
+	for (c = 0; c < bat->channels && c < MAX_CHANNELS; c++) {
+		write_channel(bat, fp, c);
+		fputs(c + 1 < bat->channels ? ",\n" : "\n", fp);
+	}
+	fputs("  ]\n}", fp);
+	fflush(fp);
+}
+
+void results_close(FILE *fp, bool batch)
+{
+	if (batch)
+		fputs("\n]", fp);
+	fputs("\n", fp);
+	if (fp != stdout)
+		fclose(fp);
+	else
+		fflush(fp);
+}
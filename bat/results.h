@@ -0,0 +1,63 @@
+/*
+ * Machine readable alsabat results
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/* time domain statistics of a captured channel */
+struct signal_stats {
+	float peak;			/* largest deviation from the mean */
+	float rms;			/* without the DC offset */
+	float crest_db;
+	float dc;			/* mean against the format zero level */
+	int clipped;			/* samples at full scale */
+	int clip_runs;			/* runs of at least CLIP_RUN_MIN */
+	int clip_longest;
+	int dropouts;			/* runs of one repeated sample */
+	int dropout_longest;
+	int zero_runs;			/* runs of silence */
+	int zero_longest;
+};
+
+struct channel_result {
+	bool analyzed;
+	int err;
+	int peaks;			/* detected peaks */
+	float peak_hz[MAX_PEAKS];
+	float peak_db[MAX_PEAKS];	/* over the spectrum mean */
+	float snr_db;			/* SNR_DB_INVALID if not measured */
+	int tones;			/* multi-tone results */
+	float tone_level_db[MAX_TONES];
+	float tone_thdn_db[MAX_TONES];
+	bool has_stats;
+	struct signal_stats stats;
+};
+
+struct bat_results {
+	char *config;			/* batch line, NULL for the command line */
+	int err;
+	double test_seconds;		/* playback and capture */
+	double analysis_seconds;
+	struct channel_result channel[MAX_CHANNELS];
+};
+
+struct bat_results *results_new(const char *);
+void results_free(struct bat_results *);
+void results_peak(struct bat *, int, float, float);
+void results_snr(struct bat *, int, float);
+void results_tone(struct bat *, int, int, float, float);
+void results_stats(struct bat *, int, const struct signal_stats *);
+void results_channel(struct bat *, int, int);
+void results_channel_clear(struct bat *, int);
+FILE *results_open(struct bat *, const char *, bool);
+void results_write(struct bat *, FILE *, bool);
+void results_close(FILE *, bool);
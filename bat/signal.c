@@ -109,16 +109,16 @@ static int reorder(struct bat *bat, float *val, int frames)
 	return 0;
 }
 
-static int adjust_waveform(struct bat *bat, float *val, int frames,
-		int channels)
+/* scale and offset from a waveform of magnitude 1 to the sample format */
+static int waveform_scale(struct bat *bat, float *factor, float *offset)
 {
-	int i, nsamples, max;
-	float factor, offset = 0.0;
+	int max;
 
+	*offset = 0.0;
 	switch (bat->format) {
 	case BAT_PCM_FORMAT_U8:
 		max = INT8_MAX;
-		offset = max;	/* shift for unsigned format */
+		*offset = max;	/* shift for unsigned format */
 		break;
 	case BAT_PCM_FORMAT_S16_LE:
 		max  = INT16_MAX;
@@ -134,7 +134,21 @@ static int adjust_waveform(struct bat *bat, float *val, int frames,
 		return -EINVAL;
 	}
 
-	factor = max * RANGE_FACTOR;
+	*factor = max * RANGE_FACTOR;
+
+	return 0;
+}
+
+static int adjust_waveform(struct bat *bat, float *val, int frames,
+		int channels)
+{
+	int i, err, nsamples;
+	float factor, offset;
+
+	err = waveform_scale(bat, &factor, &offset);
+	if (err != 0)
+		return err;
+
 	nsamples = channels * frames;
 
 	for (i = 0; i < nsamples; i++)
@@ -143,45 +157,125 @@ static int adjust_waveform(struct bat *bat, float *val, int frames,
 	return 0;
 }
 
-int generate_sine_wave(struct bat *bat, int frames, void *buf)
+/*
+ * Initialize the lane generator, with the same output as the generator
+ * above: -magnitude * sin(w * n).
+ */
+int sin_lanes_init(struct sin_lanes *sl, float magnitude, float frequency,
+		float sample_rate)
 {
-	int err = 0;
-	int c, nsamples;
-	float *sinus_f = NULL;
-	static struct sin_generator sg[MAX_CHANNELS];
+	double w = (double) frequency / sample_rate * 2 * M_PI;
+	int j;
 
-	nsamples = bat->channels * frames;
-	sinus_f = (float *) malloc(nsamples * sizeof(float));
-	if (sinus_f == NULL) {
-		fprintf(bat->err, _("Not enough memory.\n"));
-		return -ENOMEM;
+	if (frequency >= sample_rate / 2)
+		return -1;
+	for (j = 0; j < SIN_LANES; j++) {
+		sl->real[j] = -magnitude * sin(w * j);
+		sl->imag[j] = magnitude * cos(w * j);
 	}
+	sl->step_real = cos(w * SIN_LANES);
+	sl->step_imag = sin(w * SIN_LANES);
+	sl->frequency = frequency;
+	sl->sample_rate = sample_rate;
+	sl->magnitude = magnitude;
+	return 0;
+}
 
-	for (c = 0; c < bat->channels; c++) {
-		/* initialize static struct at the first time */
-		if (sg[c].frequency != bat->target_freq[c])
-			sin_generator_init(&sg[c], 1.0, bat->target_freq[c],
-					bat->rate);
-		/* fill buffer for each channel */
-		sin_generator_vfill(&sg[c], sinus_f + c * frames, frames);
+/* step all lanes by SIN_LANES samples */
+static void sin_lanes_step(struct sin_lanes *sl)
+{
+	const double pr = sl->step_real;
+	const double pi = sl->step_imag;
+	double sr, si;
+	int j;
+
+	for (j = 0; j < SIN_LANES; j++) {
+		sr = sl->real[j];
+		si = sl->imag[j];
+		sl->real[j] = sr * pr - si * pi;
+		sl->imag[j] = sr * pi + pr * si;
 	}
+}
 
-	/* reorder samples to interleaved mode */
-	err = reorder(bat, sinus_f, frames);
-	if (err != 0)
-		goto exit;
+/*
+ * Fill every stride-th float of buf with n samples plus offset, so the
+ * channels can be generated straight into an interleaved buffer.
+ */
+void sin_lanes_fill(struct sin_lanes *sl, float *buf, int n, int stride,
+		float offset)
+{
+	double real[SIN_LANES], imag[SIN_LANES], g;
+	int i, j, k;
 
-	/* adjust amplitude and offset of waveform */
-	err = adjust_waveform(bat, sinus_f, frames, bat->channels);
+	for (i = 0; i + SIN_LANES <= n; i += SIN_LANES) {
+		for (j = 0; j < SIN_LANES; j++)
+			buf[(i + j) * stride] = sl->real[j] + offset;
+		sin_lanes_step(sl);
+	}
+
+	/* a partial step: the lanes continue at the first unused sample */
+	k = n - i;
+	if (k > 0) {
+		for (j = 0; j < k; j++)
+			buf[(i + j) * stride] = sl->real[j] + offset;
+		memcpy(real, sl->real, sizeof(real));
+		memcpy(imag, sl->imag, sizeof(imag));
+		sin_lanes_step(sl);
+		for (j = SIN_LANES - 1; j >= 0; j--) {
+			if (j + k < SIN_LANES) {
+				sl->real[j] = real[j + k];
+				sl->imag[j] = imag[j + k];
+			} else {
+				sl->real[j] = sl->real[j + k - SIN_LANES];
+				sl->imag[j] = sl->imag[j + k - SIN_LANES];
+			}
+		}
+	}
+
+	/* renormalize the rounding drift of the magnitude */
+	for (j = 0; j < SIN_LANES; j++) {
+		g = sl->magnitude / sqrt(sl->real[j] * sl->real[j]
+				+ sl->imag[j] * sl->imag[j]);
+		sl->real[j] *= g;
+		sl->imag[j] *= g;
+	}
+}
+
+/*
+ * Generate the sine of every channel in blocks, straight into the
+ * interleaved float buffer and then to the sample format, so a long
+ * signal is generated in one pass through the cache.
+ */
+int generate_sine_wave(struct bat *bat, int frames, void *buf)
+{
+	static struct sin_lanes sl[MAX_CHANNELS];
+	float block[SIN_BLOCK_FRAMES * MAX_CHANNELS];
+	float factor, offset;
+	int err, c, n;
+
+	err = waveform_scale(bat, &factor, &offset);
 	if (err != 0)
-		goto exit;
+		return err;
 
-	bat->convert_float_to_sample(sinus_f, buf, frames, bat->channels);
+	for (c = 0; c < bat->channels; c++) {
+		/* initialize static struct at the first time */
+		if (sl[c].frequency != bat->target_freq[c]
+				|| sl[c].sample_rate != bat->rate
+				|| sl[c].magnitude != factor)
+			sin_lanes_init(&sl[c], factor, bat->target_freq[c],
+					bat->rate);
+	}
 
-exit:
-	free(sinus_f);
+	for (; frames > 0; frames -= n) {
+		n = frames < SIN_BLOCK_FRAMES ? frames : SIN_BLOCK_FRAMES;
+		for (c = 0; c < bat->channels; c++)
+			sin_lanes_fill(&sl[c], block + c, n, bat->channels,
+					offset);
+		bat->convert_float_to_sample(block, buf, n, bat->channels);
+		buf = (char *) buf + n * bat->frame_size;
+	}
 
-	return err;
+	return 0;
 }
 
 /* generate single channel sine waveform without sample conversion */
@@ -201,3 +295,259 @@ int generate_sine_wave_raw_mono(struct bat *bat, float *buf,
 
 	return err;
 }
+
+/* Galois LFSR feedback masks of primitive polynomials, by MLS order */
+static const unsigned int mls_taps[MLS_ORDER_MAX + 1] = {
+	[10] = 0x240,
+	[11] = 0x500,
+	[12] = 0xe08,
+	[13] = 0x1c80,
+	[14] = 0x3802,
+	[15] = 0x6000,
+	[16] = 0xd008,
+	[17] = 0x12000,
+	[18] = 0x20400,
+	[19] = 0x72000,
+	[20] = 0x90000,
+};
+
+/* MLS order giving a period just below one second */
+static int mls_order(struct bat *bat)
+{
+	int order = MLS_ORDER_MIN;
+
+	while (order < MLS_ORDER_MAX && (2u << order) <= bat->rate)
+		order++;
+
+	return order;
+}
+
+/*
+ * Period in frames of the sweep and MLS signals. The sweep period is a
+ * power of two so the analysis can use the fast FFT sizes, the MLS
+ * period is 2^order - 1 by definition.
+ */
+int signal_period(struct bat *bat)
+{
+	int order = mls_order(bat);
+
+	if (bat->signal == BAT_SIGNAL_MLS)
+		return (1 << order) - 1;
+
+	return 1 << order;
+}
+
+/*
+ * Fill one period of the sweep or MLS signal, with the same peak
+ * magnitude as the sine wave. The player repeats this period, so the
+ * analysis can regenerate it as reference.
+ */
+int generate_signal_period(struct bat *bat, float *buf)
+{
+	int i, order, period = signal_period(bat);
+	double f1 = SWEEP_LOW, f2 = bat->rate * RATE_FACTOR;
+	double k, t, duration = (double) period / bat->rate;
+	unsigned int lfsr = 1;
+
+	switch (bat->signal) {
+	case BAT_SIGNAL_SWEEP:
+		/* exponential sweep: the frequency doubles at a fixed rate */
+		k = log(f2 / f1);
+		for (i = 0; i < period; i++) {
+			t = (double) i / bat->rate;
+			buf[i] = sin(2.0 * M_PI * f1 * duration / k
+					* (exp(t * k / duration) - 1.0));
+		}
+		return 0;
+	case BAT_SIGNAL_MLS:
+		/* half scale: the same mean amplitude as the sine wave */
+		order = mls_order(bat);
+		for (i = 0; i < period; i++) {
+			buf[i] = (lfsr & 1) ? 2.0 / M_PI : -2.0 / M_PI;
+			lfsr = (lfsr >> 1) ^ (-(lfsr & 1) & mls_taps[order]);
+		}
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+/* multi-tone: Schroeder phases keep the crest factor of the sum low */
+static void multitone_init(struct bat *bat, struct sin_generator *sg)
+{
+	double phase;
+	int k;
+
+	for (k = 0; k < bat->tones; k++) {
+		sin_generator_init(&sg[k], 1.0 / bat->tones,
+				bat->tone_freq[k], bat->rate);
+		phase = M_PI * k * k / bat->tones;
+		/* the generator outputs -magnitude * sin(w * n + phase) */
+		sg[k].state_real = -sg[k].magnitude * sin(phase);
+		sg[k].state_imag = sg[k].magnitude * cos(phase);
+	}
+}
+
+static int fill_multitone(struct bat *bat, float *buf, int frames)
+{
+	static struct sin_generator sg[MAX_TONES];
+	static int tones;
+	int i, k;
+
+	/* initialize static struct at the first time */
+	if (tones != bat->tones || sg[0].frequency != bat->tone_freq[0]
+			|| sg[0].sample_rate != bat->rate) {
+		multitone_init(bat, sg);
+		tones = bat->tones;
+	}
+
+	memset(buf, 0, frames * sizeof(float));
+	for (k = 0; k < bat->tones; k++)
+		for (i = 0; i < frames; i++)
+			buf[i] += sin_generator_next_sample(&sg[k]);
+
+	return 0;
+}
+
+static int fill_periodic(struct bat *bat, float *buf, int frames)
+{
+	static float *period_buf;
+	static int period, pos;
+	static enum _bat_signal signal;
+	static unsigned int rate;
+	int err, n;
+
+	/* generate the period at the first time, or for another test */
+	if (period_buf == NULL || signal != bat->signal || rate != bat->rate) {
+		free(period_buf);
+		signal = bat->signal;
+		rate = bat->rate;
+		pos = 0;
+		period = signal_period(bat);
+		period_buf = malloc(period * sizeof(float));
+		if (period_buf == NULL) {
+			fprintf(bat->err, _("Not enough memory.\n"));
+			return -ENOMEM;
+		}
+		err = generate_signal_period(bat, period_buf);
+		if (err != 0)
+			return err;
+	}
+
+	while (frames > 0) {
+		n = period - pos < frames ? period - pos : frames;
+		memcpy(buf, period_buf + pos, n * sizeof(float));
+		buf += n;
+		frames -= n;
+		pos = (pos + n) % period;
+	}
+
+	return 0;
+}
+
+/*
+ * Output a mono waveform on every channel. signal_f holds the waveform
+ * in its first frames and has room for all channels.
+ */
+static int output_mono(struct bat *bat, float *signal_f, int frames,
+		void *buf)
+{
+	int err, c;
+
+	for (c = 1; c < bat->channels; c++)
+		memcpy(signal_f + c * frames, signal_f,
+				frames * sizeof(float));
+
+	/* reorder samples to interleaved mode */
+	err = reorder(bat, signal_f, frames);
+	if (err != 0)
+		return err;
+
+	/* adjust amplitude and offset of waveform */
+	err = adjust_waveform(bat, signal_f, frames, bat->channels);
+	if (err != 0)
+		return err;
+
+	bat->convert_float_to_sample(signal_f, buf, frames, bat->channels);
+
+	return 0;
+}
+
+static float *alloc_channels(struct bat *bat, int frames)
+{
+	float *signal_f;
+
+	signal_f = (float *) malloc(bat->channels * frames * sizeof(float));
+	if (signal_f == NULL)
+		fprintf(bat->err, _("Not enough memory.\n"));
+
+	return signal_f;
+}
+
+/* generate the selected test signal, the same on every channel */
+int generate_test_signal(struct bat *bat, int frames, void *buf)
+{
+	int err = 0;
+	float *signal_f = NULL;
+
+	if (bat->signal == BAT_SIGNAL_SINE)
+		return generate_sine_wave(bat, frames, buf);
+
+	signal_f = alloc_channels(bat, frames);
+	if (signal_f == NULL)
+		return -ENOMEM;
+
+	if (bat->signal == BAT_SIGNAL_MULTITONE)
+		err = fill_multitone(bat, signal_f, frames);
+	else
+		err = fill_periodic(bat, signal_f, frames);
+	if (err == 0)
+		err = output_mono(bat, signal_f, frames, buf);
+
+	free(signal_f);
+
+	return err;
+}
+
+/* convert a mono waveform of magnitude 1 to samples on every channel */
+int generate_mono_waveform(struct bat *bat, const float *val, int frames,
+		void *buf)
+{
+	int err;
+	float *signal_f;
+
+	signal_f = alloc_channels(bat, frames);
+	if (signal_f == NULL)
+		return -ENOMEM;
+
+	memcpy(signal_f, val, frames * sizeof(float));
+	err = output_mono(bat, signal_f, frames, buf);
+
+	free(signal_f);
+
+	return err;
+}
+
+/*
+ * Exponential chirp from TONE_LOW to the highest test frequency, with
+ * tapered ends so it starts and stops without a click. Its
+ * autocorrelation is a sharp peak, used to measure the latency.
+ */
+void generate_chirp(struct bat *bat, float *buf, int frames)
+{
+	double f1 = TONE_LOW, f2 = bat->rate * RATE_FACTOR;
+	double k = log(f2 / f1), duration = (double) frames / bat->rate;
+	double t, gain;
+	int i, taper = frames / 10;
+
+	for (i = 0; i < frames; i++) {
+		t = (double) i / bat->rate;
+		gain = 1.0;
+		if (i < taper)
+			gain = 0.5 - 0.5 * cos(M_PI * i / taper);
+		else if (i >= frames - taper)
+			gain = 0.5 - 0.5 * cos(M_PI * (frames - 1 - i) / taper);
+		buf[i] = gain * sin(2.0 * M_PI * f1 * duration / k
+				* (exp(t * k / duration) - 1.0));
+	}
+}
@@ -235,6 +235,10 @@ static int play_sample(struct bat *bat, struct pcm *pcm,
 				&& bat->periods_played >= bat->periods_total)
 			break;
 
+		/* live analysis is done or failed */
+		if (bat->ring && ring_stopped(bat->ring))
+			break;
+
 		err = pcm_write(pcm, buffer, bytes);
 		if (err != 0)
 			break;
@@ -407,6 +411,10 @@ static int capture_sample(struct bat *bat, struct pcm *pcm,
 		if (fwrite(buffer, 1, bytes, fp) != bytes)
 			break;
 
+		/* hand the chunk to the live analysis */
+		if (bat->ring)
+			ring_write(bat->ring, buffer, bytes);
+
 		bytes_read += bytes;
 
 		bat->periods_played++;
@@ -416,6 +424,9 @@ static int capture_sample(struct bat *bat, struct pcm *pcm,
 			break;
 	}
 
+	if (bat->ring)
+		ring_close(bat->ring);
+
 	err = update_wav_header(bat, fp, bytes_read);
 
 	fclose(fp);
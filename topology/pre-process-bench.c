@@ -0,0 +1,212 @@
+/*
+  Benchmark of the topology pre-processor: a topology with many pipelines
+  is generated in memory and pre-processed a number of times.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of version 2 of the GNU General Public License as
+  published by the Free Software Foundation.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+*/
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <alsa/asoundlib.h>
+#include "topology.h"
+
+struct text {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int text_printf(struct text *t, const char *fmt, ...)
+{
+	va_list va;
+	size_t size;
+	char *buf;
+	int len;
+
+	va_start(va, fmt);
+	len = vsnprintf(NULL, 0, fmt, va);
+	va_end(va);
+	if (len < 0)
+		return -EINVAL;
+
+	if (t->len + len + 1 > t->size) {
+		size = t->size ? t->size * 2 : 65536;
+		while (size < t->len + len + 1)
+			size *= 2;
+		buf = realloc(t->buf, size);
+		if (!buf)
+			return -ENOMEM;
+		t->buf = buf;
+		t->size = size;
+	}
+
+	va_start(va, fmt);
+	vsnprintf(t->buf + t->len, len + 1, fmt, va);
+	va_end(va);
+	t->len += len;
+
+	return 0;
+}
+
+/*
+ * Every widget class has tuple attributes, so each widget adds its own data and vendor
+ * tuples sections, with the tokens of the "bench" VendorToken. The pipeline class has one
+ * widget of every class and is instantiated the given number of times.
+ */
+static int generate(struct text *t, int classes, int attrs, int pipelines)
+{
+	int c, a, p, err = 0;
+
+	/* the pre-processor expects the variable definitions */
+	err |= text_printf(t, "Define {\n\tBENCH_PIPELINES %d\n}\n", pipelines);
+
+	/* the tokens of the tuple attributes, so the output builds with alsatplg */
+	err |= text_printf(t, "Object.Base.VendorToken.\"bench\" {\n");
+	for (a = 0; a < attrs; a++)
+		err |= text_printf(t, "\tparam%d %d\n", a, 100 + a);
+	err |= text_printf(t, "}\n");
+
+	for (c = 0; c < classes; c++) {
+		err |= text_printf(t, "Class.Widget.\"bench%d\" {\n"
+				   "\tDefineAttribute.\"index\" {}\n"
+				   "\tDefineAttribute.\"instance\" {}\n"
+				   "\tDefineAttribute.\"type\" { type \"string\" }\n", c);
+		for (a = 0; a < attrs; a++)
+			err |= text_printf(t, "\tDefineAttribute.\"param%d\" "
+					   "{ token_ref \"bench.word\" }\n", a);
+		err |= text_printf(t, "\tattributes {\n"
+				   "\t\tconstructor [ \"index\" \"instance\" ]\n"
+				   "\t\tmandatory [ \"type\" ]\n"
+				   "\t\tunique \"instance\"\n"
+				   "\t}\n"
+				   "\ttype \"effect\"\n");
+		for (a = 0; a < attrs; a++)
+			err |= text_printf(t, "\tparam%d %d\n", a, a);
+		err |= text_printf(t, "}\n");
+	}
+
+	err |= text_printf(t, "Class.Pipeline.\"bench-pipeline\" {\n"
+			   "\tDefineAttribute.\"index\" {}\n"
+			   "\tattributes {\n"
+			   "\t\tconstructor [ \"index\" ]\n"
+			   "\t\tunique \"index\"\n"
+			   "\t}\n");
+	for (c = 0; c < classes; c++)
+		err |= text_printf(t, "\tObject.Widget.\"bench%d\".1 {}\n", c);
+	err |= text_printf(t, "}\n");
+
+	err |= text_printf(t, "Object.Pipeline.\"bench-pipeline\" {\n");
+	for (p = 0; p < pipelines; p++)
+		err |= text_printf(t, "\t%d { index %d }\n", p, p);
+	err |= text_printf(t, "}\n");
+
+	return err ? -ENOMEM : 0;
+}
+
+static void usage(void)
+{
+	printf("Usage: pre-process-bench [-p pipelines] [-c classes] [-a attributes] [-r rounds] [-o file]\n"
+	       "  -p  pipelines in the topology (default 200)\n"
+	       "  -c  widget classes, one widget of each per pipeline (default 10)\n"
+	       "  -a  tuple attributes of every widget class (default 8)\n"
+	       "  -r  rounds of the pre-processing (default 5)\n"
+	       "  -o  write the pre-processed output of the last round to a file\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct tplg_pre_processor *tplg_pp;
+	struct text t = { NULL };
+	const char *output_file = NULL;
+	int pipelines = 200, classes = 10, attrs = 8, rounds = 5;
+	int i, c, err;
+	double start, total = 0, best = 0, us;
+
+	while ((c = getopt(argc, argv, "p:c:a:r:o:h")) >= 0) {
+		switch (c) {
+		case 'p':
+			pipelines = atoi(optarg);
+			break;
+		case 'c':
+			classes = atoi(optarg);
+			break;
+		case 'a':
+			attrs = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 'o':
+			output_file = optarg;
+			break;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if (pipelines < 1 || classes < 1 || attrs < 0 || rounds < 1) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	err = generate(&t, classes, attrs, pipelines);
+	if (err < 0) {
+		fprintf(stderr, "Cannot generate the topology: %s\n", strerror(-err));
+		goto out;
+	}
+
+	printf("topology: %d pipelines, %d widgets, %d tuples, %zu bytes\n",
+	       pipelines, pipelines * classes, pipelines * classes * attrs, t.len);
+
+	for (i = 0; i < rounds; i++) {
+		bool last = i == rounds - 1 && output_file;
+
+		err = init_pre_processor(&tplg_pp, last ? SND_OUTPUT_STDIO : SND_OUTPUT_BUFFER,
+					 last ? output_file : NULL);
+		if (err < 0) {
+			fprintf(stderr, "Cannot create the pre-processor: %s\n", snd_strerror(err));
+			goto out;
+		}
+
+		start = now_us();
+		err = pre_process(tplg_pp, t.buf, t.len, NULL, NULL);
+		us = now_us() - start;
+		free_pre_processor(tplg_pp);
+		if (err < 0) {
+			fprintf(stderr, "Cannot pre-process the topology: %s\n", snd_strerror(err));
+			goto out;
+		}
+
+		total += us;
+		if (i == 0 || us < best)
+			best = us;
+	}
+
+	printf("pre-process: %.1f ms average, %.1f ms best, %.2f us per widget\n",
+	       total / rounds / 1000, best / 1000, best / (pipelines * classes));
+	err = 0;
+
+out:
+	free(t.buf);
+	return err < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
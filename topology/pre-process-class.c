@@ -84,6 +84,52 @@ bool tplg_class_is_attribute_unique(const char *attr, snd_config_t *class_cfg)
 	return false;
 }
 
+/*
+ * Index the class types, the class definitions of every type and their attributes once
+ * after the input config is loaded. Every object looks up its class and attributes, and
+ * large topologies have hundreds of objects.
+ */
+int tplg_class_index(struct tplg_pre_processor *tplg_pp)
+{
+	snd_config_iterator_t i, next, i2, next2;
+	snd_config_t *type, *class, *attributes;
+	int ret;
+
+	if (snd_config_search(tplg_pp->input_cfg, "Class", &tplg_pp->class_cfg) < 0) {
+		tplg_pp->class_cfg = NULL;
+		return 0;
+	}
+
+	ret = tplg_index_config(tplg_pp, tplg_pp->class_cfg);
+	if (ret < 0)
+		return ret;
+
+	snd_config_for_each(i, next, tplg_pp->class_cfg) {
+		type = snd_config_iterator_entry(i);
+		if (snd_config_get_type(type) != SND_CONFIG_TYPE_COMPOUND)
+			continue;
+
+		ret = tplg_index_config(tplg_pp, type);
+		if (ret < 0)
+			return ret;
+
+		snd_config_for_each(i2, next2, type) {
+			class = snd_config_iterator_entry(i2);
+			if (snd_config_get_type(class) != SND_CONFIG_TYPE_COMPOUND)
+				continue;
+
+			if (snd_config_search(class, "DefineAttribute", &attributes) < 0)
+				continue;
+
+			ret = tplg_index_config(tplg_pp, attributes);
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
 /*
  * Helper function to look up class definition from the Object config.
  * ex: For an object declaration, Object.Widget.pga.0{}, return the config correspdonding to
@@ -92,10 +138,8 @@ bool tplg_class_is_attribute_unique(const char *attr, snd_config_t *class_cfg)
 snd_config_t *tplg_class_lookup(struct tplg_pre_processor *tplg_pp, snd_config_t *cfg)
 {
 	snd_config_iterator_t first, end;
-	snd_config_t *class, *class_cfg = NULL;
+	snd_config_t *class, *type = NULL, *class_cfg = NULL;
 	const char *class_type, *class_name;
-	char *class_config_id;
-	int ret;
 
 	if (snd_config_get_id(cfg, &class_type) < 0)
 		return NULL;
@@ -113,40 +157,48 @@ snd_config_t *tplg_class_lookup(struct tplg_pre_processor *tplg_pp, snd_config_t
 	if (snd_config_get_id(class, &class_name) < 0)
 		return NULL;
 
-	class_config_id = tplg_snprintf("Class.%s.%s", class_type, class_name);
-	if (!class_config_id)
-		return NULL;
+	if (tplg_pp->class_cfg)
+		type = tplg_index_find(tplg_pp, tplg_pp->class_cfg, class_type);
 
-	ret = snd_config_search(tplg_pp->input_cfg, class_config_id, &class_cfg);
-	if (ret < 0)
-		SNDERR("No Class definition found for %s\n", class_config_id);
+	if (type && snd_config_get_type(type) == SND_CONFIG_TYPE_COMPOUND)
+		class_cfg = tplg_index_find(tplg_pp, type, class_name);
+
+	if (!class_cfg)
+		SNDERR("No Class definition found for Class.%s.%s\n", class_type, class_name);
 
-	free(class_config_id);
 	return class_cfg;
 }
 
+/* find the attribute config by name in the class definition, NULL if not defined */
+snd_config_t *tplg_class_get_attribute(struct tplg_pre_processor *tplg_pp,
+				       snd_config_t *class, const char *name)
+{
+	snd_config_t *attributes;
+
+	if (snd_config_search(class, "DefineAttribute", &attributes) < 0)
+		return NULL;
+
+	if (snd_config_get_type(attributes) != SND_CONFIG_TYPE_COMPOUND)
+		return NULL;
+
+	return tplg_index_find(tplg_pp, attributes, name);
+}
+
 /* find the attribute config by name in the class definition */
 snd_config_t *tplg_class_find_attribute_by_name(struct tplg_pre_processor *tplg_pp,
 						snd_config_t *class, const char *name)
 {
-	snd_config_t *attr = NULL;
+	snd_config_t *attr;
 	const char *class_id;
-	char *attr_str;
-	int ret;
 
 	if (snd_config_get_id(class, &class_id) < 0)
 		return NULL;
 
-	attr_str = tplg_snprintf("DefineAttribute.%s", name);
-	if (!attr_str)
-		return NULL;
-
-	ret = snd_config_search(class, attr_str, &attr);
-	if (ret < 0)
+	attr = tplg_class_get_attribute(tplg_pp, class, name);
+	if (!attr)
 		SNDERR("No definition for attribute '%s' in class '%s'\n",
 			name, class_id);
 
-	free(attr_str);
 	return attr;
 }
 
@@ -210,16 +262,12 @@ snd_config_type_t tplg_class_get_attribute_type(struct tplg_pre_processor *tplg_
 const char *tplg_class_get_attribute_token_ref(struct tplg_pre_processor *tplg_pp,
 					       snd_config_t *class, const char *attr_name)
 {
-	snd_config_t *attributes, *attr, *token_ref;
+	snd_config_t *attr, *token_ref;
 	const char *token;
 	int ret;
 
-	ret = snd_config_search(class, "DefineAttribute", &attributes);
-	if (ret < 0)
-		return NULL;
-
-	ret = snd_config_search(attributes, attr_name, &attr);
-	if (ret < 0)
+	attr = tplg_class_get_attribute(tplg_pp, class, attr_name);
+	if (!attr)
 		return NULL;
 
 	ret = snd_config_search(attr, "token_ref", &token_ref);
@@ -238,7 +286,7 @@ long tplg_class_attribute_valid_tuple_value(struct tplg_pre_processor *tplg_pp,
 					    snd_config_t *class, snd_config_t *attr)
 {
 
-	snd_config_t *attributes, *cfg, *valid, *tuples, *n;
+	snd_config_t *cfg, *valid, *tuples, *n;
 	snd_config_iterator_t i, next;
 	const char *attr_name, *attr_value;
 	int ret;
@@ -252,13 +300,8 @@ long tplg_class_attribute_valid_tuple_value(struct tplg_pre_processor *tplg_pp,
 		return -EINVAL;
 
 	/* find attribute definition in class */
-	ret = snd_config_search(class, "DefineAttribute", &attributes);
-	if (ret < 0)
-		return -EINVAL;
-
-
-	ret = snd_config_search(attributes, attr_name, &cfg);
-	if (ret < 0)
+	cfg = tplg_class_get_attribute(tplg_pp, class, attr_name);
+	if (!cfg)
 		return -EINVAL;
 
 	/* check if it has valid values */
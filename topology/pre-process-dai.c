@@ -90,7 +90,7 @@ static int tplg_update_pcm_object(struct tplg_pre_processor *tplg_pp,
 		return 0;
 
 	/* find parent config with name */
-	dest = tplg_find_config(top, parent_name);
+	dest = tplg_index_find(tplg_pp, top, parent_name);
 	if (!dest) {
 		SNDERR("Cannot find parent section %s\n", parent_name);
 		return -EINVAL;
@@ -42,7 +42,7 @@ int tplg_build_base_object(struct tplg_pre_processor *tplg_pp, snd_config_t *obj
 		return 0;
 
 	/* find parent config with name */
-	dest = tplg_find_config(top, parent_name);
+	dest = tplg_index_find(tplg_pp, top, parent_name);
 	if (!dest) {
 		SNDERR("Cannot find parent config %s\n", parent_name);
 		return -EINVAL;
@@ -374,7 +374,7 @@ int tplg_build_dapm_route_object(struct tplg_pre_processor *tplg_pp, snd_config_
 		goto err;
 	}
 
-	ret = snd_config_add(top, route);
+	ret = tplg_index_add(tplg_pp, top, route);
 	if (ret < 0) {
 		SNDERR("Error adding route config for %s %d\n", name, ret);
 		goto err;
@@ -110,7 +110,7 @@ int tplg_parent_update(struct tplg_pre_processor *tplg_pp, snd_config_t *parent,
 		return -EINVAL;
 
 	/* get config with name */
-	cfg = tplg_find_config(top, parent_name);
+	cfg = tplg_index_find(tplg_pp, top, parent_name);
 	if (!cfg)
 		return ret;
 
@@ -529,7 +529,7 @@ static snd_config_t *tplg_object_lookup_in_config(struct tplg_pre_processor *tpl
 		return NULL;
 
 	if (snd_config_search(class, config_id, &obj_cfg) < 0)
-		return NULL;
+		obj_cfg = NULL;
 	free(config_id);
 	return obj_cfg;
 }
@@ -557,6 +557,10 @@ static int tplg_pp_add_object_tuple_section(struct tplg_pre_processor *tplg_pp,
 		}
 	}
 
+	ret = tplg_index_config(tplg_pp, top);
+	if (ret < 0)
+		return ret;
+
 	type = strchr(token_ref, '.');
 	if(!type) {
 		SNDERR("Error getting type for %s\n", token_ref);
@@ -577,10 +581,11 @@ static int tplg_pp_add_object_tuple_section(struct tplg_pre_processor *tplg_pp,
 		goto free;
 	}
 
-	tuple_cfg = tplg_find_config(top, data_name);
+	tuple_cfg = tplg_index_find(tplg_pp, top, data_name);
 	if (!tuple_cfg) {
 		/* add new SectionVendorTuples */
-		ret = tplg_config_make_add(&tuple_cfg, data_name, SND_CONFIG_TYPE_COMPOUND, top);
+		ret = tplg_index_make_add(tplg_pp, &tuple_cfg, data_name, SND_CONFIG_TYPE_COMPOUND,
+					  top);
 		if (ret < 0) {
 			SNDERR("Error creating new vendor tuples config %s\n", data_name);
 			goto err;
@@ -686,15 +691,19 @@ static int tplg_pp_add_object_data_section(struct tplg_pre_processor *tplg_pp,
 		}
 	}
 
+	ret = tplg_index_config(tplg_pp, top);
+	if (ret < 0)
+		return ret;
+
 	/* nothing to do if data section already exists */
-	data_cfg = tplg_find_config(top, data_name);
+	data_cfg = tplg_index_find(tplg_pp, top, data_name);
 	if (data_cfg)
 		return 0;
 
 	tplg_pp_debug("Building data section %s ...", data_name);
 
 	/* add new SectionData */
-	ret = tplg_config_make_add(&data_cfg, data_name, SND_CONFIG_TYPE_COMPOUND, top);
+	ret = tplg_index_make_add(tplg_pp, &data_cfg, data_name, SND_CONFIG_TYPE_COMPOUND, top);
 	if (ret < 0)
 		return ret;
 
@@ -882,7 +891,7 @@ static int tplg_build_parent_data(struct tplg_pre_processor *tplg_pp, snd_config
 		return ret;
 	}
 
-	top = tplg_find_config(section_cfg, parent_id);
+	top = tplg_index_find(tplg_pp, section_cfg, parent_id);
 	if (!top) {
 		SNDERR("SectionBE %s not found\n", parent_id);
 		return -EINVAL;
@@ -927,6 +936,13 @@ int tplg_build_object_from_template(struct tplg_pre_processor *tplg_pp, snd_conf
 		}
 	}
 
+	/* the sections in the output config are indexed, objects are looked up by name */
+	if (top_config == tplg_pp->output_cfg) {
+		ret = tplg_index_config(tplg_pp, top);
+		if (ret < 0)
+			return ret;
+	}
+
 	/* get object name */
 	object_name = tplg_object_get_name(tplg_pp, obj);
 	if (!object_name) {
@@ -943,12 +959,12 @@ int tplg_build_object_from_template(struct tplg_pre_processor *tplg_pp, snd_conf
 	if (skip_name) {
 		*wtop = top;
 	} else {
-		*wtop = tplg_find_config(top, object_name);
+		*wtop = tplg_index_find(tplg_pp, top, object_name);
 		if (*wtop)
 			goto template;
 
-		ret = tplg_config_make_add(wtop, object_name, SND_CONFIG_TYPE_COMPOUND,
-					   top);
+		ret = tplg_index_make_add(tplg_pp, wtop, object_name, SND_CONFIG_TYPE_COMPOUND,
+					  top);
 		if (ret < 0) {
 			SNDERR("Error creating config for %s\n", object_name);
 			return ret;
@@ -1828,7 +1844,6 @@ static int tplg_build_object(struct tplg_pre_processor *tplg_pp, snd_config_t *n
 	snd_config_for_each(i, next, obj_local) {
 		snd_config_t *n, *new, *class_attr;
 		const char *id, *s;
-		char *attr_config_name;
 
 		n = snd_config_iterator_entry(i);
 
@@ -1860,13 +1875,8 @@ static int tplg_build_object(struct tplg_pre_processor *tplg_pp, snd_config_t *n
 validate:
 		/* validate attribute value */
 		snd_config_get_id(n, &id);
-		attr_config_name = tplg_snprintf("DefineAttribute.%s", id);
-		if (!attr_config_name)
-			return -ENOMEM;
-
-		ret = snd_config_search(class_cfg, attr_config_name, &class_attr);
-		free(attr_config_name);
-		if (ret < 0)
+		class_attr = tplg_class_get_attribute(tplg_pp, class_cfg, id);
+		if (!class_attr)
 			continue;
 
 		if (!tplg_object_is_attribute_valid(tplg_pp, class_attr, n)) {
@@ -21,6 +21,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -185,6 +186,224 @@ int tplg_config_make_add(snd_config_t **config, const char *id, snd_config_type_
 	return ret;
 }
 
+static unsigned int tplg_index_hash(snd_config_t *parent, const char *id)
+{
+	uintptr_t p = (uintptr_t)parent;
+	unsigned int hash = 2166136261u;
+	size_t k;
+
+	for (k = 0; k < sizeof(p); k++, p >>= 8)
+		hash = (hash ^ (p & 0xff)) * 16777619u;
+	while (id && *id)
+		hash = (hash ^ (unsigned char)*id++) * 16777619u;
+
+	return hash;
+}
+
+static struct tplg_index_entry *tplg_index_lookup(struct tplg_index *index,
+						  snd_config_t *parent, const char *id,
+						  unsigned int hash)
+{
+	struct tplg_index_entry *e;
+
+	if (!index || !index->table)
+		return NULL;
+
+	for (e = index->table[hash & index->mask]; e; e = e->next) {
+		if (e->hash != hash || e->parent != parent)
+			continue;
+		if (!id || !e->id) {
+			if (id == e->id)
+				return e;
+			continue;
+		}
+		if (!strcmp(e->id, id))
+			return e;
+	}
+
+	return NULL;
+}
+
+static int tplg_index_grow(struct tplg_index *index)
+{
+	struct tplg_index_entry **table, *e, *next;
+	unsigned int i, mask;
+
+	mask = index->table ? index->mask * 2 + 1 : 255;
+	table = calloc(mask + 1, sizeof(*table));
+	if (!table)
+		return -ENOMEM;
+
+	for (i = 0; index->table && i <= index->mask; i++) {
+		for (e = index->table[i]; e; e = next) {
+			next = e->next;
+			e->next = table[e->hash & mask];
+			table[e->hash & mask] = e;
+		}
+	}
+
+	free(index->table);
+	index->table = table;
+	index->mask = mask;
+
+	return 0;
+}
+
+/* the id is not copied, it must be the id of the config or a constant */
+static int tplg_index_insert(struct tplg_index *index, snd_config_t *parent, const char *id,
+			     snd_config_t *config)
+{
+	struct tplg_index_entry *e;
+	unsigned int hash = tplg_index_hash(parent, id);
+	int ret;
+
+	e = tplg_index_lookup(index, parent, id, hash);
+	if (e) {
+		e->config = config;
+		return 0;
+	}
+
+	if (!index->table || index->count > index->mask) {
+		ret = tplg_index_grow(index);
+		if (ret < 0)
+			return ret;
+	}
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return -ENOMEM;
+
+	e->hash = hash;
+	e->parent = parent;
+	e->id = id;
+	e->config = config;
+	e->next = index->table[hash & index->mask];
+	index->table[hash & index->mask] = e;
+	index->count++;
+
+	return 0;
+}
+
+static bool tplg_index_is_indexed(struct tplg_pre_processor *tplg_pp, snd_config_t *config)
+{
+	return tplg_index_lookup(tplg_pp->index, config, NULL,
+				 tplg_index_hash(config, NULL)) != NULL;
+}
+
+/* add all children of the compound config to the index, once */
+int tplg_index_config(struct tplg_pre_processor *tplg_pp, snd_config_t *config)
+{
+	snd_config_iterator_t i, next;
+	snd_config_t *n;
+	const char *id;
+	int ret;
+
+	if (snd_config_get_type(config) != SND_CONFIG_TYPE_COMPOUND)
+		return 0;
+
+	if (!tplg_pp->index) {
+		tplg_pp->index = calloc(1, sizeof(*tplg_pp->index));
+		if (!tplg_pp->index)
+			return -ENOMEM;
+	}
+
+	if (tplg_index_is_indexed(tplg_pp, config))
+		return 0;
+
+	snd_config_for_each(i, next, config) {
+		n = snd_config_iterator_entry(i);
+		if (snd_config_get_id(n, &id) < 0)
+			continue;
+
+		ret = tplg_index_insert(tplg_pp->index, config, id, n);
+		if (ret < 0)
+			return ret;
+	}
+
+	/* the children are looked up in the index from now on */
+	return tplg_index_insert(tplg_pp->index, config, NULL, config);
+}
+
+/* find the child config by id, with the hash if the config is indexed */
+snd_config_t *tplg_index_find(struct tplg_pre_processor *tplg_pp, snd_config_t *config,
+			      const char *name)
+{
+	struct tplg_index_entry *e;
+
+	if (!tplg_index_is_indexed(tplg_pp, config))
+		return tplg_find_config(config, name);
+
+	e = tplg_index_lookup(tplg_pp->index, config, name, tplg_index_hash(config, name));
+
+	return e ? e->config : NULL;
+}
+
+static int tplg_index_child(struct tplg_pre_processor *tplg_pp, snd_config_t *parent,
+			    snd_config_t *config)
+{
+	const char *id;
+	int ret;
+
+	if (!tplg_index_is_indexed(tplg_pp, parent))
+		return 0;
+
+	ret = snd_config_get_id(config, &id);
+	if (ret < 0)
+		return ret;
+
+	return tplg_index_insert(tplg_pp->index, parent, id, config);
+}
+
+/*
+ * add config to parent and to the index of parent. The config belongs to parent once
+ * added, even if the index update fails.
+ */
+int tplg_index_add(struct tplg_pre_processor *tplg_pp, snd_config_t *parent,
+		   snd_config_t *config)
+{
+	int ret;
+
+	ret = snd_config_add(parent, config);
+	if (ret < 0)
+		return ret;
+
+	return tplg_index_child(tplg_pp, parent, config);
+}
+
+/* make a new config and add it to parent and to the index of parent */
+int tplg_index_make_add(struct tplg_pre_processor *tplg_pp, snd_config_t **config,
+			const char *id, snd_config_type_t type, snd_config_t *parent)
+{
+	int ret;
+
+	ret = tplg_config_make_add(config, id, type, parent);
+	if (ret < 0)
+		return ret;
+
+	return tplg_index_child(tplg_pp, parent, *config);
+}
+
+void tplg_index_free(struct tplg_pre_processor *tplg_pp)
+{
+	struct tplg_index *index = tplg_pp->index;
+	struct tplg_index_entry *e, *next;
+	unsigned int i;
+
+	if (!index)
+		return;
+
+	for (i = 0; index->table && i <= index->mask; i++) {
+		for (e = index->table[i]; e; e = next) {
+			next = e->next;
+			free(e);
+		}
+	}
+
+	free(index->table);
+	free(index);
+	tplg_pp->index = NULL;
+}
+
 /*
  * The pre-processor will need to concat multiple strings separate by '.' to construct the object
  * name and search for configs with ID's separated by '.'.
@@ -239,13 +458,20 @@ static int pre_process_config(struct tplg_pre_processor *tplg_pp, snd_config_t *
 	snd_config_iterator_t i, next, i2, next2;
 	snd_config_t *n, *n2;
 	const char *id;
-	int err;
+	int err = 0;
 
 	if (snd_config_get_type(cfg) != SND_CONFIG_TYPE_COMPOUND) {
 		fprintf(stderr, "compound type expected at top level");
 		return -EINVAL;
 	}
 
+	/* index the class definitions, they don't change while the objects are processed */
+	err = tplg_class_index(tplg_pp);
+	if (err < 0) {
+		fprintf(stderr, "failed to index the class definitions\n");
+		goto out;
+	}
+
 	/* parse topology objects */
 	snd_config_for_each(i, next, cfg) {
 		n = snd_config_iterator_entry(i);
@@ -257,7 +483,8 @@ static int pre_process_config(struct tplg_pre_processor *tplg_pp, snd_config_t *
 
 		if (snd_config_get_type(n) != SND_CONFIG_TYPE_COMPOUND) {
 			fprintf(stderr, "compound type expected for %s", id);
-			return -EINVAL;
+			err = -EINVAL;
+			goto out;
 		}
 
 		snd_config_for_each(i2, next2, n) {
@@ -268,17 +495,21 @@ static int pre_process_config(struct tplg_pre_processor *tplg_pp, snd_config_t *
 
 			if (snd_config_get_type(n2) != SND_CONFIG_TYPE_COMPOUND) {
 				fprintf(stderr, "compound type expected for %s", id);
-				return -EINVAL;
+				err = -EINVAL;
+				goto out;
 			}
 
 			/* pre-process Object instance. Top-level object have no parent */
 			err = tplg_pre_process_objects(tplg_pp, n2, NULL);
 			if (err < 0)
-				return err;
+				goto out;
 		}
 	}
 
-	return 0;
+out:
+	/* the plugins modify the configs without the index */
+	tplg_index_free(tplg_pp);
+	return err;
 }
 
 void free_pre_processor(struct tplg_pre_processor *tplg_pp)
@@ -286,6 +517,7 @@ void free_pre_processor(struct tplg_pre_processor *tplg_pp)
 	snd_output_close(tplg_pp->output);
 	snd_output_close(tplg_pp->dbg_output);
 	snd_config_delete(tplg_pp->output_cfg);
+	tplg_index_free(tplg_pp);
 	if (tplg_pp->define_cfg)
 		snd_config_delete(tplg_pp->define_cfg);
 	free(tplg_pp->inc_path);
@@ -95,7 +95,10 @@ const char *tplg_object_get_name(struct tplg_pre_processor *tplg_pp,
 snd_config_t *tplg_object_get_section(struct tplg_pre_processor *tplg_pp, snd_config_t *class);
 
 /* class helpers */
+int tplg_class_index(struct tplg_pre_processor *tplg_pp);
 snd_config_t *tplg_class_lookup(struct tplg_pre_processor *tplg_pp, snd_config_t *cfg);
+snd_config_t *tplg_class_get_attribute(struct tplg_pre_processor *tplg_pp,
+				       snd_config_t *class, const char *name);
 snd_config_t *tplg_class_find_attribute_by_name(struct tplg_pre_processor *tplg_pp,
 						snd_config_t *class, const char *name);
 bool tplg_class_is_attribute_mandatory(const char *attr, snd_config_t *class_cfg);
@@ -115,5 +118,34 @@ snd_config_t *tplg_find_config(snd_config_t *config, const char *name);
 int tplg_config_make_add(snd_config_t **config, const char *id, snd_config_type_t type,
 			 snd_config_t *parent);
 
+/*
+ * Hash index of the children of the class definitions and the output sections, keyed by
+ * the parent config and the child id. A config is indexed once with tplg_index_config()
+ * and the children must be added with tplg_index_add() or tplg_index_make_add() then.
+ * Lookups in configs that are not indexed fall back to tplg_find_config().
+ */
+struct tplg_index_entry {
+	struct tplg_index_entry *next;
+	unsigned int hash;
+	snd_config_t *parent;
+	const char *id;			/* NULL marks the indexed parent */
+	snd_config_t *config;
+};
+
+struct tplg_index {
+	struct tplg_index_entry **table;
+	unsigned int mask;
+	unsigned int count;
+};
+
+int tplg_index_config(struct tplg_pre_processor *tplg_pp, snd_config_t *config);
+snd_config_t *tplg_index_find(struct tplg_pre_processor *tplg_pp, snd_config_t *config,
+			      const char *name);
+int tplg_index_add(struct tplg_pre_processor *tplg_pp, snd_config_t *parent,
+		   snd_config_t *config);
+int tplg_index_make_add(struct tplg_pre_processor *tplg_pp, snd_config_t **config,
+			const char *id, snd_config_type_t type, snd_config_t *parent);
+void tplg_index_free(struct tplg_pre_processor *tplg_pp);
+
 char *tplg_snprintf(char *fmt, ...);
 #endif
@@ -29,6 +29,8 @@ struct tplg_pre_processor {
 	snd_config_t *define_cfg;
 	snd_config_t *define_cfg_merged;
 	char *inc_path;
+	snd_config_t *class_cfg;	/* "Class" node of input_cfg */
+	struct tplg_index *index;	/* see tplg_index_config() */
 };
 
 int pre_process(struct tplg_pre_processor *tplg_pp, char *config, size_t config_size,